@@ -0,0 +1,247 @@
+/*
+ * ActuatorScheduler.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <pico/stdlib.h>
+#include <ActuatorScheduler.hxx>
+
+static inline TickType_t ms_to_ticks(unsigned int ms)
+{
+    TickType_t ticks = pdMS_TO_TICKS(ms);
+
+    return (ticks > 0) ? ticks : 1;
+}
+
+ActuatorScheduler::ActuatorScheduler()
+{
+    bzero(_channels, sizeof(_channels));
+    _n_channels = 0;
+}
+
+ActuatorScheduler::~ActuatorScheduler()
+{
+
+}
+
+int ActuatorScheduler::addChannel(unsigned int pin, bool idleLevel)
+{
+    int ret = 0;
+    struct channel *ch = NULL;
+
+    if (_n_channels >= ACTUATOR_MAX_CHANNELS) {
+        ret = -1;
+        goto done;
+    }
+
+    ch = &_channels[_n_channels];
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    ch->timer = xTimerCreateStatic("Actuator",
+                                   1,
+                                   pdFALSE,
+                                   this,
+                                   ActuatorScheduler::timer_callback,
+                                   &ch->timerBuffer);
+#else
+    ch->timer = xTimerCreate("Actuator",
+                             1,
+                             pdFALSE,
+                             this,
+                             ActuatorScheduler::timer_callback);
+#endif
+    if (ch->timer == NULL) {
+        ret = -1;
+        goto done;
+    }
+
+    ch->pin = pin;
+    ch->idle = idleLevel;
+    gpio_put(pin, idleLevel);
+
+    ret = _n_channels;
+    _n_channels++;
+
+done:
+
+    return ret;
+}
+
+bool ActuatorScheduler::run(unsigned int channel,
+                            const struct actuator_step *steps, unsigned int n,
+                            actuator_done_t done, void *arg)
+{
+    bool result = false;
+    struct channel *ch = NULL;
+    TickType_t ticks = 0;
+
+    if ((channel >= _n_channels) || (n == 0) || (n > ACTUATOR_MAX_STEPS)) {
+        goto done;
+    }
+
+    ch = &_channels[channel];
+    ticks = ms_to_ticks(steps[0].ms);
+
+    taskENTER_CRITICAL();
+    memcpy(ch->steps, steps, sizeof(struct actuator_step) * n);
+    ch->n = n;
+    ch->cur = 0;
+    ch->deadline = xTaskGetTickCount() + ticks;
+    ch->done = done;
+    ch->arg = arg;
+    ch->busy = true;
+    taskEXIT_CRITICAL();
+
+    gpio_put(ch->pin, steps[0].level);
+
+    if (xTimerChangePeriod(ch->timer, ticks, 0) != pdPASS) {
+        taskENTER_CRITICAL();
+        ch->busy = false;
+        ch->done = NULL;
+        taskEXIT_CRITICAL();
+        gpio_put(ch->pin, ch->idle);
+        goto done;
+    }
+
+    result = true;
+
+done:
+
+    return result;
+}
+
+bool ActuatorScheduler::pulse(unsigned int channel, bool level,
+                              unsigned int ms,
+                              actuator_done_t done, void *arg)
+{
+    struct actuator_step step = {
+        .level = level,
+        .ms = ms,
+    };
+
+    return run(channel, &step, 1, done, arg);
+}
+
+void ActuatorScheduler::cancel(unsigned int channel)
+{
+    struct channel *ch = NULL;
+
+    if (channel >= _n_channels) {
+        return;
+    }
+
+    ch = &_channels[channel];
+    xTimerStop(ch->timer, 0);
+
+    taskENTER_CRITICAL();
+    ch->busy = false;
+    ch->done = NULL;
+    taskEXIT_CRITICAL();
+
+    gpio_put(ch->pin, ch->idle);
+}
+
+bool ActuatorScheduler::isBusy(unsigned int channel) const
+{
+    if (channel >= _n_channels) {
+        return false;
+    }
+
+    return _channels[channel].busy;
+}
+
+void ActuatorScheduler::setIdle(unsigned int channel, bool level)
+{
+    struct channel *ch = NULL;
+
+    if (channel >= _n_channels) {
+        return;
+    }
+
+    ch = &_channels[channel];
+    ch->idle = level;
+    if (ch->busy == false) {
+        gpio_put(ch->pin, level);
+    }
+}
+
+bool ActuatorScheduler::idle(unsigned int channel) const
+{
+    if (channel >= _n_channels) {
+        return false;
+    }
+
+    return _channels[channel].idle;
+}
+
+void ActuatorScheduler::notify_task(unsigned int channel, void *arg)
+{
+    (void)(channel);
+
+    xTaskNotifyGive((TaskHandle_t) arg);
+}
+
+void ActuatorScheduler::timer_callback(TimerHandle_t timer)
+{
+    ActuatorScheduler *scheduler =
+        (ActuatorScheduler *) pvTimerGetTimerID(timer);
+
+    for (unsigned int i = 0; i < scheduler->_n_channels; i++) {
+        if (scheduler->_channels[i].timer == timer) {
+            scheduler->advance(i);
+            break;
+        }
+    }
+}
+
+void ActuatorScheduler::advance(unsigned int channel)
+{
+    struct channel *ch = &_channels[channel];
+    bool more = false;
+    bool level = false;
+    TickType_t ticks = 0;
+    actuator_done_t done = NULL;
+    void *arg = NULL;
+
+    taskENTER_CRITICAL();
+    if ((ch->busy == false) ||
+        ((int32_t) (xTaskGetTickCount() - ch->deadline) < 0)) {
+        // Stale expiry of a sequence that has since been replaced
+        taskEXIT_CRITICAL();
+        return;
+    }
+
+    ch->cur++;
+    if (ch->cur < ch->n) {
+        more = true;
+        level = ch->steps[ch->cur].level;
+        ticks = ms_to_ticks(ch->steps[ch->cur].ms);
+        ch->deadline = xTaskGetTickCount() + ticks;
+    } else {
+        ch->busy = false;
+        done = ch->done;
+        arg = ch->arg;
+        ch->done = NULL;
+    }
+    taskEXIT_CRITICAL();
+
+    if (more) {
+        gpio_put(ch->pin, level);
+        xTimerChangePeriod(ch->timer, ticks, 0);
+    } else {
+        gpio_put(ch->pin, ch->idle);
+        if (done) {
+            done(channel, arg);
+        }
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,87 @@
+/*
+ * ActuatorScheduler.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef ACTUATORSCHEDULER_HXX
+#define ACTUATORSCHEDULER_HXX
+
+#include <FreeRTOS.h>
+#include <task.h>
+#include <timers.h>
+
+#define ACTUATOR_MAX_CHANNELS 4
+#define ACTUATOR_MAX_STEPS    8
+
+struct actuator_step {
+    bool level;
+    unsigned int ms;
+};
+
+typedef void (*actuator_done_t)(unsigned int channel, void *arg);
+
+/*
+ * Drives timed GPIO sequences from FreeRTOS software timers so that the
+ * caller never sleeps. Each channel owns one GPIO and one timer; when a
+ * sequence finishes, the GPIO returns to the channel's idle level and the
+ * optional completion callback runs in the timer service task.
+ */
+class ActuatorScheduler {
+
+public:
+
+    ActuatorScheduler();
+    ~ActuatorScheduler();
+
+    int addChannel(unsigned int pin, bool idleLevel);
+
+    bool run(unsigned int channel,
+             const struct actuator_step *steps, unsigned int n,
+             actuator_done_t done = NULL, void *arg = NULL);
+    bool pulse(unsigned int channel, bool level, unsigned int ms,
+               actuator_done_t done = NULL, void *arg = NULL);
+    void cancel(unsigned int channel);
+    bool isBusy(unsigned int channel) const;
+
+    void setIdle(unsigned int channel, bool level);
+    bool idle(unsigned int channel) const;
+
+    // Completion callback that gives a task notification to arg
+    static void notify_task(unsigned int channel, void *arg);
+
+private:
+
+    static void timer_callback(TimerHandle_t timer);
+    void advance(unsigned int channel);
+
+    struct channel {
+        unsigned int pin;
+        bool idle;
+        TimerHandle_t timer;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+        StaticTimer_t timerBuffer;
+#endif
+        struct actuator_step steps[ACTUATOR_MAX_STEPS];
+        unsigned int n;
+        unsigned int cur;
+        TickType_t deadline;
+        actuator_done_t done;
+        void *arg;
+        volatile bool busy;
+    } _channels[ACTUATOR_MAX_CHANNELS];
+    unsigned int _n_channels;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
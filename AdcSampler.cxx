@@ -0,0 +1,332 @@
+/*
+ * AdcSampler.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <math.h>
+#include <pico/stdlib.h>
+#include <hardware/adc.h>
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+#include <hardware/sync.h>
+#include <AdcSampler.hxx>
+
+#define ADC_CLOCK_HZ     48000000
+#define ADC_ERROR        0x8000
+#define ADC_VREF         3.3f
+
+// The ADC is a singleton, so is its sampler
+static AdcSampler *sampler = NULL;
+
+// RP2040 datasheet: 0.706V at 27C, -1.721mV/C
+static float sensor_temp(float volts)
+{
+    return 27.0f - ((volts - 0.706f) / 0.001721f);
+}
+
+AdcSampler::AdcSampler()
+{
+    _dma = -1;
+    _mask = 0;
+    bzero(_order, sizeof(_order));
+    _n_order = 0;
+    _phase = 0;
+    _rateHz = 0;
+    _running = false;
+    _tempC = 0.0f;
+    _tempValid = false;
+    bzero(_inputs, sizeof(_inputs));
+    bzero(&_stats, sizeof(_stats));
+}
+
+AdcSampler::~AdcSampler()
+{
+    stop();
+}
+
+bool AdcSampler::start(uint8_t mask, unsigned int rateHz)
+{
+    bool result = false;
+    dma_channel_config config;
+    float div;
+
+    mask &= (1 << ADC_SAMPLER_INPUTS) - 1;
+    if (_running || (mask == 0) || (rateHz == 0) ||
+        ((sampler != NULL) && (sampler != this))) {
+        goto done;
+    }
+
+    if (rateHz < ADC_SAMPLER_RATE_MIN) {
+        rateHz = ADC_SAMPLER_RATE_MIN;
+    } else if (rateHz > ADC_SAMPLER_RATE_MAX) {
+        rateHz = ADC_SAMPLER_RATE_MAX;
+    }
+
+    _dma = dma_claim_unused_channel(false);
+    if (_dma < 0) {
+        goto done;
+    }
+
+    // Round-robin visits the enabled inputs in ascending order
+    _n_order = 0;
+    for (unsigned int i = 0; i < ADC_SAMPLER_INPUTS; i++) {
+        if (mask & (1 << i)) {
+            _order[_n_order++] = i;
+        }
+    }
+    _phase = 0;
+    _mask = mask;
+    _rateHz = rateHz;
+    _tempValid = false;
+    bzero(_inputs, sizeof(_inputs));
+    bzero(&_stats, sizeof(_stats));
+    sampler = this;
+
+    adc_init();
+    for (unsigned int i = 0; i < ADC_SAMPLER_TEMP; i++) {
+        if (mask & (1 << i)) {
+            adc_gpio_init(26 + i);
+        }
+    }
+    adc_set_temp_sensor_enabled((mask & (1 << ADC_SAMPLER_TEMP)) != 0);
+    if (mask & (1 << ADC_SAMPLER_TEMP)) {
+        // One conversion to go by until the first lap is in
+        adc_select_input(ADC_SAMPLER_TEMP);
+        _tempC = sensor_temp(((float) adc_read() * ADC_VREF) / 4096.0f);
+        _tempValid = true;
+    }
+    adc_select_input(_order[0]);
+    adc_set_round_robin(mask);
+    adc_fifo_setup(true, true, 1, true, false);
+    div = ((float) ADC_CLOCK_HZ / (float) rateHz) - 1.0f;
+    adc_set_clkdiv(div);
+    adc_fifo_drain();
+
+    config = dma_channel_get_default_config(_dma);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, true);
+    channel_config_set_ring(&config, true, ADC_SAMPLER_RING_BITS);
+    channel_config_set_dreq(&config, DREQ_ADC);
+
+    dma_channel_set_irq1_enabled(_dma, true);
+    irq_add_shared_handler(DMA_IRQ_1, AdcSampler::dma_handler,
+                           PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_1, true);
+
+    dma_channel_configure(_dma, &config, _ring, &adc_hw->fifo,
+                          ADC_SAMPLER_RING, true);
+    _stats.started = time_us_64();
+    _running = true;
+    adc_run(true);
+
+    result = true;
+
+done:
+
+    return result;
+}
+
+void AdcSampler::stop(void)
+{
+    if (_running == false) {
+        return;
+    }
+
+    _running = false;
+    adc_run(false);
+    dma_channel_set_irq1_enabled(_dma, false);
+    dma_channel_abort(_dma);
+    dma_channel_acknowledge_irq1(_dma);
+    irq_remove_handler(DMA_IRQ_1, AdcSampler::dma_handler);
+    dma_channel_unclaim(_dma);
+    _dma = -1;
+
+    // Leave the ADC as adc_read() expects it
+    adc_set_round_robin(0);
+    adc_fifo_setup(false, false, 0, false, false);
+    adc_fifo_drain();
+    sampler = NULL;
+}
+
+bool AdcSampler::isRunning(void) const
+{
+    return _running;
+}
+
+uint8_t AdcSampler::mask(void) const
+{
+    return _mask;
+}
+
+unsigned int AdcSampler::rateHz(void) const
+{
+    return _rateHz;
+}
+
+uint16_t AdcSampler::raw(unsigned int input) const
+{
+    if (input >= ADC_SAMPLER_INPUTS) {
+        return 0;
+    }
+
+    return _inputs[input].ema >> ADC_SAMPLER_EMA_SHIFT;
+}
+
+float AdcSampler::volts(unsigned int input) const
+{
+    if (input >= ADC_SAMPLER_INPUTS) {
+        return 0.0f;
+    }
+
+    return ((float) _inputs[input].ema * ADC_VREF) /
+        (float) (4096 << ADC_SAMPLER_EMA_SHIFT);
+}
+
+float AdcSampler::noise(unsigned int input) const
+{
+    if (input >= ADC_SAMPLER_INPUTS) {
+        return 0.0f;
+    }
+
+    return sqrtf((float) _inputs[input].var) /
+        (float) (1 << ADC_SAMPLER_EMA_SHIFT);
+}
+
+float AdcSampler::tempC(void) const
+{
+    return _tempC;
+}
+
+bool AdcSampler::hasTemp(void) const
+{
+    return _tempValid;
+}
+
+const struct adc_input_stats &AdcSampler::inputStats(unsigned int input) const
+{
+    return _inputs[input % ADC_SAMPLER_INPUTS];
+}
+
+const struct adc_sampler_stats &AdcSampler::getStats(void) const
+{
+    return _stats;
+}
+
+unsigned int AdcSampler::measuredRateHz(void) const
+{
+    uint64_t elapsed = time_us_64() - _stats.started;
+
+    if ((_running == false) || (elapsed == 0)) {
+        return 0;
+    }
+
+    return (unsigned int) (((uint64_t) _stats.samples * 1000000) / elapsed);
+}
+
+void AdcSampler::resetStats(void)
+{
+    uint32_t status;
+
+    status = save_and_disable_interrupts();
+    _stats.samples = 0;
+    _stats.errors = 0;
+    _stats.laps = 0;
+    _stats.isr_us_total = 0;
+    _stats.isr_us_max = 0;
+    _stats.started = time_us_64();
+    for (unsigned int i = 0; i < ADC_SAMPLER_INPUTS; i++) {
+        _inputs[i].samples = 0;
+    }
+    restore_interrupts(status);
+}
+
+void AdcSampler::dma_handler(void)
+{
+    if ((sampler == NULL) || (sampler->_dma < 0) ||
+        (dma_channel_get_irq1_status(sampler->_dma) == false)) {
+        return;
+    }
+
+    dma_channel_acknowledge_irq1(sampler->_dma);
+
+    // The write address has wrapped back to the start of the ring
+    dma_channel_set_trans_count(sampler->_dma, ADC_SAMPLER_RING, true);
+    sampler->processLap();
+}
+
+/*
+ * Runs in the DMA interrupt while the channel is already refilling the
+ * ring from the start. Each slot must be read before it is overwritten,
+ * a sample period after the one before it; ADC_SAMPLER_RATE_MAX keeps
+ * that period (50 us) well above the interrupt latency and the cost of
+ * folding one sample.
+ */
+void AdcSampler::processLap(void)
+{
+    uint64_t t0 = time_us_64();
+    struct adc_input_stats *in = NULL;
+    uint32_t elapsed;
+    uint16_t sample;
+    int32_t d;
+    int64_t var;
+
+    for (unsigned int i = 0; i < _n_order; i++) {
+        _inputs[_order[i]].min = 0xffff;
+        _inputs[_order[i]].max = 0;
+    }
+
+    for (unsigned int i = 0; i < ADC_SAMPLER_RING; i++) {
+        sample = _ring[i];
+        in = &_inputs[_order[_phase]];
+        _phase = (_phase + 1) % _n_order;
+
+        if (sample & ADC_ERROR) {
+            _stats.errors++;
+            continue;
+        }
+        sample &= 0x0fff;
+
+        if (in->samples == 0) {
+            in->ema = sample << ADC_SAMPLER_EMA_SHIFT;
+        } else {
+            in->ema += sample - (in->ema >> ADC_SAMPLER_EMA_SHIFT);
+        }
+        d = (int32_t) (sample << ADC_SAMPLER_EMA_SHIFT) - (int32_t) in->ema;
+        var = (int64_t) in->var +
+            (((int64_t) d * d - (int64_t) in->var) >> ADC_SAMPLER_EMA_SHIFT);
+        in->var = (uint32_t) var;
+        in->last = sample;
+        if (sample < in->min) {
+            in->min = sample;
+        }
+        if (sample > in->max) {
+            in->max = sample;
+        }
+        in->samples++;
+    }
+    _stats.samples += ADC_SAMPLER_RING;
+    _stats.laps++;
+
+    if (_mask & (1 << ADC_SAMPLER_TEMP)) {
+        _tempC = sensor_temp(volts(ADC_SAMPLER_TEMP));
+        _tempValid = true;
+    }
+
+    elapsed = time_us_64() - t0;
+    _stats.isr_us_total += elapsed;
+    if (elapsed > _stats.isr_us_max) {
+        _stats.isr_us_max = elapsed;
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
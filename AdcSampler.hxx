@@ -0,0 +1,105 @@
+/*
+ * AdcSampler.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef ADCSAMPLER_HXX
+#define ADCSAMPLER_HXX
+
+#include <stdint.h>
+
+#define ADC_SAMPLER_INPUTS     5
+#define ADC_SAMPLER_TEMP       4         // Internal temperature sensor
+// ADC3 is GPIO29, which the Pico W shares with the CYW43 SPI clock
+#define ADC_SAMPLER_MASK       0x17      // ADC0-2 and the temperature sensor
+#define ADC_SAMPLER_RATE_HZ    1000      // Aggregate over all inputs
+#define ADC_SAMPLER_RATE_MIN   733       // 16-bit integer clock divider
+#define ADC_SAMPLER_RATE_MAX   20000     // See processLap()
+#define ADC_SAMPLER_RING_BITS  8         // 256-byte ring, 128 samples
+#define ADC_SAMPLER_RING       ((1 << ADC_SAMPLER_RING_BITS) / 2)
+#define ADC_SAMPLER_EMA_SHIFT  4         // alpha = 1/16
+
+struct adc_input_stats {
+    uint16_t last;
+    uint16_t min;                        // Over the last lap of the ring
+    uint16_t max;
+    uint32_t samples;
+    uint32_t ema;                        // << ADC_SAMPLER_EMA_SHIFT
+    uint32_t var;                        // EMA of squared deviation, << 8
+};
+
+struct adc_sampler_stats {
+    uint32_t samples;
+    uint32_t errors;
+    uint32_t laps;
+    uint32_t isr_us_total;
+    uint32_t isr_us_max;
+    uint64_t started;
+};
+
+/*
+ * Runs the ADC free in round-robin mode over the inputs in the mask and
+ * has a DMA channel write the conversions into a ring. Each time the
+ * ring has been filled the DMA interrupt re-arms the channel and folds
+ * the lap into per-input exponential moving averages, so readers only
+ * load a cached value and never touch the ADC.
+ */
+class AdcSampler {
+
+public:
+
+    AdcSampler();
+    ~AdcSampler();
+
+    bool start(uint8_t mask = ADC_SAMPLER_MASK,
+               unsigned int rateHz = ADC_SAMPLER_RATE_HZ);
+    void stop(void);
+    bool isRunning(void) const;
+
+    uint8_t mask(void) const;
+    unsigned int rateHz(void) const;
+
+    uint16_t raw(unsigned int input) const;      // Filtered, 12-bit
+    float volts(unsigned int input) const;
+    float noise(unsigned int input) const;       // Std deviation, counts
+    float tempC(void) const;
+    bool hasTemp(void) const;
+
+    const struct adc_input_stats &inputStats(unsigned int input) const;
+    const struct adc_sampler_stats &getStats(void) const;
+    unsigned int measuredRateHz(void) const;
+    void resetStats(void);
+
+private:
+
+    static void dma_handler(void);
+    void processLap(void);
+
+    uint16_t _ring[ADC_SAMPLER_RING]
+    __attribute__((aligned(1 << ADC_SAMPLER_RING_BITS)));
+    int _dma;
+    uint8_t _mask;
+    uint8_t _order[ADC_SAMPLER_INPUTS];
+    unsigned int _n_order;
+    unsigned int _phase;
+    unsigned int _rateHz;
+    volatile bool _running;
+    volatile float _tempC;
+    volatile bool _tempValid;
+    struct adc_input_stats _inputs[ADC_SAMPLER_INPUTS];
+    struct adc_sampler_stats _stats;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,187 @@
+/*
+ * AuthIndex.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <pico/stdlib.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <AuthIndex.hxx>
+
+AuthIndex::AuthIndex()
+{
+    _nodes = 0;
+    bzero(&_stats, sizeof(_stats));
+}
+
+AuthIndex::~AuthIndex()
+{
+
+}
+
+unsigned int AuthIndex::hash(uint32_t node_num)
+{
+    uint32_t h = node_num * 0x9e3779b1;
+
+    h ^= h >> 16;
+
+    return h;
+}
+
+AuthIndex::slot *AuthIndex::insert(vector<struct slot> &slots,
+                                   uint32_t node_num, unsigned int &nodes)
+{
+    unsigned int mask = slots.size() - 1;
+    unsigned int i = hash(node_num) & mask;
+
+    while ((slots[i].node_num != 0) && (slots[i].node_num != node_num)) {
+        i = (i + 1) & mask;
+    }
+
+    if (slots[i].node_num == 0) {
+        slots[i].node_num = node_num;
+        nodes++;
+    }
+
+    return &slots[i];
+}
+
+/*
+ * Node 0 is never a valid sender and marks empty slots. A node listed
+ * twice as an admin (or as a mate) keeps only its first key.
+ */
+void AuthIndex::rebuild(const vector<struct nvm_admin_entry> &admins,
+                        const vector<struct nvm_mate_entry> &mates)
+{
+    struct slot empty = { 0, -1, -1, };
+    unsigned int size = AUTH_INDEX_MIN_SLOTS;
+    unsigned int nodes = 0;
+    struct key key;
+    struct slot *slot = NULL;
+
+    while (size < (admins.size() + mates.size()) * 2) {
+        size <<= 1;
+    }
+
+    vector<struct slot> slots(size, empty);
+    vector<struct key> keys;
+    keys.reserve(admins.size() + mates.size());
+
+    for (vector<struct nvm_admin_entry>::const_iterator it = admins.begin();
+         it != admins.end(); it++) {
+        if (it->node_num == 0) {
+            continue;
+        }
+        slot = insert(slots, it->node_num, nodes);
+        if (slot->admin < 0) {
+            memcpy(key.bytes, it->pubkey, sizeof(key.bytes));
+            slot->admin = keys.size();
+            keys.push_back(key);
+        }
+    }
+
+    for (vector<struct nvm_mate_entry>::const_iterator it = mates.begin();
+         it != mates.end(); it++) {
+        if (it->node_num == 0) {
+            continue;
+        }
+        slot = insert(slots, it->node_num, nodes);
+        if (slot->mate < 0) {
+            memcpy(key.bytes, it->pubkey, sizeof(key.bytes));
+            slot->mate = keys.size();
+            keys.push_back(key);
+        }
+    }
+
+    // The old tables are freed on return, outside the critical section
+    taskENTER_CRITICAL();
+    _slots.swap(slots);
+    _keys.swap(keys);
+    _nodes = nodes;
+    _stats.rebuilds++;
+    taskEXIT_CRITICAL();
+}
+
+/*
+ * Called with the index locked.
+ */
+const AuthIndex::slot *AuthIndex::find(uint32_t node_num)
+{
+    const struct slot *slot = NULL;
+    unsigned int mask, i, probes = 0;
+
+    _stats.lookups++;
+    if ((node_num == 0) || _slots.empty()) {
+        goto done;
+    }
+
+    mask = _slots.size() - 1;
+    for (i = hash(node_num) & mask; _slots[i].node_num != 0;
+         i = (i + 1) & mask) {
+        probes++;
+        if (_slots[i].node_num == node_num) {
+            slot = &_slots[i];
+            break;
+        }
+    }
+
+    _stats.probes += probes;
+    if (probes > _stats.probe_max) {
+        _stats.probe_max = probes;
+    }
+
+done:
+
+    return slot;
+}
+
+/*
+ * Returns the AUTH_ROLE_* the node holds with this key.
+ */
+uint8_t AuthIndex::roles(uint32_t node_num, const uint8_t *pubkey)
+{
+    uint8_t roles = 0;
+    const struct slot *slot = NULL;
+
+    taskENTER_CRITICAL();
+    slot = find(node_num);
+    if (slot != NULL) {
+        if ((slot->admin >= 0) &&
+            (memcmp(_keys[slot->admin].bytes, pubkey, 32) == 0)) {
+            roles |= AUTH_ROLE_ADMIN;
+        }
+        if ((slot->mate >= 0) &&
+            (memcmp(_keys[slot->mate].bytes, pubkey, 32) == 0)) {
+            roles |= AUTH_ROLE_MATE;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    return roles;
+}
+
+unsigned int AuthIndex::nodes(void) const
+{
+    return _nodes;
+}
+
+unsigned int AuthIndex::slots(void) const
+{
+    return _slots.size();
+}
+
+const struct auth_index_stats &AuthIndex::getStats(void) const
+{
+    return _stats;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
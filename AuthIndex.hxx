@@ -0,0 +1,87 @@
+/*
+ * AuthIndex.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef AUTHINDEX_HXX
+#define AUTHINDEX_HXX
+
+#include <stdint.h>
+#include <vector>
+#include <BaseNvm.hxx>
+
+#define AUTH_INDEX_MIN_SLOTS  16         // Power of two
+
+#define AUTH_ROLE_ADMIN       0x01
+#define AUTH_ROLE_MATE        0x02
+
+using namespace std;
+
+struct auth_index_stats {
+    unsigned int rebuilds;
+    unsigned int lookups;
+    unsigned int probes;                 // Slots visited, in total
+    unsigned int probe_max;
+};
+
+/*
+ * Open-addressed hash of the admin and mate rosters keyed by node
+ * number, so authorizing a message costs the same however long the
+ * lists in the NVM are. Each slot records where the node's admin and
+ * mate keys are in a private copy; the table is at least twice the
+ * number of nodes, which keeps linear probe chains short. It is built
+ * aside and swapped in, so lookups from other tasks only ever see a
+ * complete index.
+ */
+class AuthIndex {
+
+public:
+
+    AuthIndex();
+    ~AuthIndex();
+
+    void rebuild(const vector<struct nvm_admin_entry> &admins,
+                 const vector<struct nvm_mate_entry> &mates);
+
+    uint8_t roles(uint32_t node_num, const uint8_t *pubkey);
+
+    unsigned int nodes(void) const;
+    unsigned int slots(void) const;
+    const struct auth_index_stats &getStats(void) const;
+
+private:
+
+    struct slot {
+        uint32_t node_num;               // 0 when empty
+        int16_t admin;                   // Index into _keys, or -1
+        int16_t mate;
+    };
+
+    struct key {
+        uint8_t bytes[32];
+    };
+
+    static unsigned int hash(uint32_t node_num);
+    static struct slot *insert(vector<struct slot> &slots,
+                               uint32_t node_num, unsigned int &nodes);
+    const struct slot *find(uint32_t node_num);
+
+    vector<struct slot> _slots;
+    vector<struct key> _keys;
+    unsigned int _nodes;
+    struct auth_index_stats _stats;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,266 @@
+/*
+ * ButtonCapture.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <pico/stdlib.h>
+#include <hardware/irq.h>
+#include <button.pio.h>
+#include <ButtonCapture.hxx>
+
+#define BUTTON_LEVEL      0x80000000
+#define BUTTON_COUNT      0x7fffffff
+
+static ButtonCapture *capture = NULL;
+
+static inline TickType_t us_to_ticks(uint64_t us)
+{
+    TickType_t ticks = pdMS_TO_TICKS((us + 999) / 1000);
+
+    return (ticks > 0) ? ticks : 1;
+}
+
+ButtonCapture::ButtonCapture()
+{
+    _pio = NULL;
+    _sm = -1;
+    _offset = 0;
+    _irq = 0;
+    _task = NULL;
+    _callback = NULL;
+    _callbackArg = NULL;
+    _pressed = false;
+    _held = false;
+    _second = false;
+    _pendingShort = false;
+    _pressUs = 0;
+    _releaseUs = 0;
+    _pendingDur = 0;
+    bzero(&_stats, sizeof(_stats));
+}
+
+ButtonCapture::~ButtonCapture()
+{
+
+}
+
+bool ButtonCapture::begin(unsigned int pin)
+{
+    bool result = false;
+    PIO pios[2] = { pio1, pio0, };
+
+    if ((_sm >= 0) || (capture != NULL)) {
+        goto done;
+    }
+
+    // The CYW43 driver prefers pio0, so try pio1 first
+    for (unsigned int i = 0; i < 2; i++) {
+        if (pio_can_add_program(pios[i], &button_program) == false) {
+            continue;
+        }
+        _sm = pio_claim_unused_sm(pios[i], false);
+        if (_sm >= 0) {
+            _pio = pios[i];
+            break;
+        }
+    }
+    if (_sm < 0) {
+        goto done;
+    }
+
+    capture = this;
+    _offset = pio_add_program(_pio, &button_program);
+    _irq = (pio_get_index(_pio) == 0) ? PIO0_IRQ_1 : PIO1_IRQ_1;
+    irq_add_shared_handler(_irq, ButtonCapture::pio_handler,
+                           PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(_irq, true);
+    button_program_init(_pio, _sm, _offset, pin);
+    enableIrq(true);
+
+    result = true;
+
+done:
+
+    return result;
+}
+
+bool ButtonCapture::isCapturing(void) const
+{
+    return _sm >= 0;
+}
+
+void ButtonCapture::setTask(TaskHandle_t task)
+{
+    _task = task;
+}
+
+void ButtonCapture::setCallback(button_gesture_t callback, void *arg)
+{
+    _callback = callback;
+    _callbackArg = arg;
+}
+
+void ButtonCapture::enableIrq(bool enabled)
+{
+    pio_set_irq1_source_enabled(_pio,
+                                (enum pio_interrupt_source)
+                                (pis_sm0_rx_fifo_not_empty + _sm),
+                                enabled);
+}
+
+/*
+ * The interrupt only masks itself and wakes the classifier, which
+ * drains the FIFO and unmasks it again.
+ */
+void ButtonCapture::pio_handler(void)
+{
+    BaseType_t woken = pdFALSE;
+
+    if ((capture == NULL) ||
+        pio_sm_is_rx_fifo_empty(capture->_pio, capture->_sm)) {
+        return;
+    }
+
+    capture->enableIrq(false);
+    capture->_stats.irqs++;
+    if (capture->_task != NULL) {
+        vTaskNotifyGiveFromISR(capture->_task, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+}
+
+void ButtonCapture::run(void)
+{
+    TickType_t wait = portMAX_DELAY;
+    uint64_t now = time_us_64();
+    uint64_t elapsed;
+
+    if (_sm < 0) {
+        vTaskDelay(portMAX_DELAY);
+        return;
+    }
+
+    if (_pressed && (_held == false)) {
+        elapsed = now - _pressUs;
+        wait = (elapsed < BUTTON_HELD_US) ?
+            us_to_ticks(BUTTON_HELD_US - elapsed) : 0;
+    } else if (_pendingShort) {
+        elapsed = now - _releaseUs;
+        wait = (elapsed < BUTTON_DOUBLE_GAP_US) ?
+            us_to_ticks(BUTTON_DOUBLE_GAP_US - elapsed) : 0;
+    }
+
+    ulTaskNotifyTake(pdTRUE, wait);
+
+    now = time_us_64();
+    while (pio_sm_is_rx_fifo_empty(_pio, _sm) == false) {
+        edge(pio_sm_get(_pio, _sm), now);
+    }
+    enableIrq(true);
+
+    if (_pressed && (_held == false) && ((now - _pressUs) >= BUTTON_HELD_US)) {
+        _held = true;
+        if (_second) {
+            // Not a double after all; the first press was a short one
+            _second = false;
+            emit(BUTTON_SHORT, _pendingDur);
+        }
+        emit(BUTTON_HELD, now - _pressUs);
+    }
+
+    if (_pendingShort && ((now - _releaseUs) >= BUTTON_DOUBLE_GAP_US)) {
+        _pendingShort = false;
+        emit(BUTTON_SHORT, _pendingDur);
+    }
+}
+
+void ButtonCapture::edge(uint32_t word, uint64_t now)
+{
+    uint32_t count = BUTTON_COUNT - (word & BUTTON_COUNT);
+    uint64_t tdur;
+
+    _stats.edges++;
+    tdur = ((uint64_t) count * BUTTON_PIO_TICK_US) + BUTTON_DEBOUNCE_US;
+
+    if ((word & BUTTON_LEVEL) == 0) {
+        // Pressed; tdur is how long it was released
+        _second = false;
+        if (_pendingShort) {
+            _pendingShort = false;
+            if (tdur <= BUTTON_DOUBLE_GAP_US) {
+                _second = true;
+            } else {
+                emit(BUTTON_SHORT, _pendingDur);
+            }
+        }
+        _pressed = true;
+        _held = false;
+        _pressUs = now;
+    } else if (_pressed) {
+        // Released; tdur is how long it was pressed
+        _pressed = false;
+        if (_held) {
+            // Already reported
+        } else if (tdur >= BUTTON_LONG_US) {
+            if (_second) {
+                emit(BUTTON_SHORT, _pendingDur);
+            }
+            emit(BUTTON_LONG, tdur);
+        } else if (_second) {
+            emit(BUTTON_DOUBLE, tdur);
+        } else {
+            _pendingShort = true;
+            _pendingDur = tdur;
+            _releaseUs = now;
+        }
+        _second = false;
+    }
+}
+
+void ButtonCapture::emit(enum ButtonGesture gesture, uint64_t tdur)
+{
+    _stats.gestures[gesture]++;
+    if (_callback) {
+        _callback(gesture, tdur, _callbackArg);
+    }
+}
+
+const struct button_capture_stats &ButtonCapture::getStats(void) const
+{
+    return _stats;
+}
+
+const char *ButtonCapture::gestureStr(enum ButtonGesture gesture)
+{
+    const char *s = "unknown";
+
+    switch (gesture) {
+    case BUTTON_SHORT:
+        s = "short";
+        break;
+    case BUTTON_LONG:
+        s = "long";
+        break;
+    case BUTTON_DOUBLE:
+        s = "double";
+        break;
+    case BUTTON_HELD:
+        s = "held";
+        break;
+    default:
+        break;
+    }
+
+    return s;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,99 @@
+/*
+ * ButtonCapture.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef BUTTONCAPTURE_HXX
+#define BUTTONCAPTURE_HXX
+
+#include <FreeRTOS.h>
+#include <task.h>
+#include <hardware/pio.h>
+
+#define BUTTON_PIO_TICK_US     10        // One loop of button.pio
+#define BUTTON_DEBOUNCE_US     5120      // Its confirmation window
+#define BUTTON_LONG_US         1500000
+#define BUTTON_HELD_US         5000000
+#define BUTTON_DOUBLE_GAP_US   400000
+
+enum ButtonGesture {
+    BUTTON_SHORT,
+    BUTTON_LONG,
+    BUTTON_DOUBLE,
+    BUTTON_HELD,
+    BUTTON_GESTURE_MAX,
+};
+
+struct button_capture_stats {
+    unsigned int irqs;
+    unsigned int edges;
+    unsigned int gestures[BUTTON_GESTURE_MAX];
+};
+
+typedef void (*button_gesture_t)(enum ButtonGesture gesture,
+                                 uint64_t tdur, void *arg);
+
+/*
+ * Captures an active-low push button with a PIO state machine that
+ * debounces in hardware and measures how long each level was held, so
+ * the CPU sees one interrupt per stable edge. run() is the classifier:
+ * called in a loop from a task, it turns the edges into short, long,
+ * double and held gestures and hands them to the callback.
+ */
+class ButtonCapture {
+
+public:
+
+    ButtonCapture();
+    ~ButtonCapture();
+
+    bool begin(unsigned int pin);
+    bool isCapturing(void) const;
+    void setTask(TaskHandle_t task);
+    void setCallback(button_gesture_t callback, void *arg);
+
+    void run(void);
+
+    const struct button_capture_stats &getStats(void) const;
+
+    static const char *gestureStr(enum ButtonGesture gesture);
+
+private:
+
+    static void pio_handler(void);
+    void edge(uint32_t word, uint64_t now);
+    void emit(enum ButtonGesture gesture, uint64_t tdur);
+    void enableIrq(bool enabled);
+
+    PIO _pio;
+    int _sm;
+    unsigned int _offset;
+    unsigned int _irq;
+    TaskHandle_t _task;
+    button_gesture_t _callback;
+    void *_callbackArg;
+
+    bool _pressed;
+    bool _held;
+    bool _second;
+    bool _pendingShort;
+    uint64_t _pressUs;
+    uint64_t _releaseUs;
+    uint64_t _pendingDur;
+
+    struct button_capture_stats _stats;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,306 @@
+/*
+ * CommandBench.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <pico/stdlib.h>
+#include <meshroom.h>
+#include <CommandBench.hxx>
+
+// Recorded from the field
+static const char *corpus[] = {
+    "tv on",
+    "tv off",
+    "tv vol 20",
+    "tv vol +3",
+    "tv vol -",
+    "tv chan 7",
+    "tv chan +",
+    "TV VOL -2",
+    "ac on",
+    "ac off",
+    "ac temp 24",
+    "ac temp +1",
+    "ac mode heater",
+    "ac mode dehumidifier",
+    "ac fanspeed +",
+    "ac fandir 2",
+    "  ac   temp   26  ",
+    "buzz",
+    "morse sos",
+    "rule",
+    "rule add if env temp > 28 for 10 min then ac on, mode ac, temp 25",
+    "reset",
+    "status",
+    "env",
+    "hello",
+};
+
+static const char *tokens[] = {
+    "tv", "ac", "buzz", "morse", "rule", "reset", "on", "off", "vol",
+    "chan", "temp", "mode", "fanspeed", "fandir", "heater", "auto", "+",
+    "-", "+1", "-1", "0", "255", "65536", "4294967296", "-2147483649",
+    "99999999999999999999", "add", "del", "if", "then", "for", ">", "<=",
+    " ", "  ", "\t", ",", ":",
+};
+
+static const char *verbs[] = {
+    "tv", "ac", "buzz", "morse", "rule", "reset", "status", "env",
+};
+
+static const char *tv_cmds[] = { "on", "off", "vol", "chan", };
+static const char *ac_cmds[] = {
+    "on", "off", "temp", "mode", "fanspeed", "fandir",
+};
+static const char *ac_modes[] = { "ac", "heater", "dehumidifier", "auto", };
+
+CommandBench::CommandBench()
+{
+    _state = 1;
+    bzero(_samples, sizeof(_samples));
+    _n_samples = 0;
+    bzero(&_result, sizeof(_result));
+}
+
+CommandBench::~CommandBench()
+{
+
+}
+
+// xorshift32
+uint32_t CommandBench::random(void)
+{
+    _state ^= _state << 13;
+    _state ^= _state >> 17;
+    _state ^= _state << 5;
+
+    return _state;
+}
+
+uint32_t CommandBench::random(uint32_t n)
+{
+    return (n > 0) ? (random() % n) : 0;
+}
+
+static void append_number(string &s, int32_t n)
+{
+    char buf[16];
+
+    snprintf(buf, sizeof(buf), "%ld", (long) n);
+    s.append(buf);
+}
+
+void CommandBench::generate(string &input)
+{
+    const char *verb = verbs[random(count_of(verbs))];
+
+    input = verb;
+    if (strcmp(verb, "tv") == 0) {
+        input += " ";
+        input += tv_cmds[random(count_of(tv_cmds))];
+    } else if (strcmp(verb, "ac") == 0) {
+        input += " ";
+        input += ac_cmds[random(count_of(ac_cmds))];
+        if (input == "ac mode") {
+            input += " ";
+            input += ac_modes[random(count_of(ac_modes))];
+            return;
+        }
+    } else if (strcmp(verb, "morse") == 0) {
+        input += " ";
+        for (unsigned int i = random(12); i > 0; i--) {
+            input += (char) ('a' + random(26));
+        }
+        return;
+    } else {
+        return;
+    }
+
+    switch (random(4)) {
+    case 0:
+        input += " +";
+        break;
+    case 1:
+        input += " -";
+        break;
+    case 2:
+        input += " ";
+        input += (random(2) ? "+" : "-");
+        append_number(input, random(10));
+        break;
+    default:
+        input += " ";
+        append_number(input, random(100));
+        break;
+    }
+}
+
+void CommandBench::mutate(string &input)
+{
+    size_t pos, len;
+
+    for (unsigned int n = 1 + random(4); n > 0; n--) {
+        pos = input.empty() ? 0 : random(input.size());
+        switch (random(6)) {
+        case 0:
+            // Any byte, including control and high-bit characters
+            if (input.empty() == false) {
+                input[pos] = (char) (1 + random(255));
+            }
+            break;
+        case 1:
+            input.insert(pos, tokens[random(count_of(tokens))]);
+            break;
+        case 2:
+            len = random(input.size() - pos + 1);
+            input.erase(pos, len);
+            break;
+        case 3:
+            len = random(input.size() - pos + 1);
+            input.insert(pos, input.substr(pos, len));
+            break;
+        case 4:
+            input.resize(pos);
+            break;
+        default:
+            input.append(" ");
+            input.append(tokens[random(count_of(tokens))]);
+            break;
+        }
+        if (input.size() > BENCH_INPUT_MAX) {
+            input.resize(BENCH_INPUT_MAX);
+        }
+    }
+}
+
+// Reservoir sampling keeps the distribution of any number of commands
+void CommandBench::sample(unsigned int index, uint32_t us)
+{
+    uint16_t value = (us > UINT16_MAX) ? UINT16_MAX : us;
+    uint32_t slot;
+
+    if (_n_samples < BENCH_MAX_SAMPLES) {
+        _samples[_n_samples++] = value;
+    } else {
+        slot = random(index + 1);
+        if (slot < BENCH_MAX_SAMPLES) {
+            _samples[slot] = value;
+        }
+    }
+}
+
+void CommandBench::run(enum Mode mode, unsigned int iterations,
+                       uint32_t seed, bench_handler_t handler, void *arg,
+                       const MessageArena *arena)
+{
+    struct message_arena_stats arena0;
+    unsigned int allocs0;
+    string input, reply;
+    char failure[BENCH_FAILURE_MAX + 1];
+    uint64_t t0;
+    uint32_t us;
+
+    bzero(&_result, sizeof(_result));
+    _result.mode = mode;
+    _result.seed = seed;
+    _state = (seed != 0) ? seed : 1;
+    _n_samples = 0;
+
+    bzero(&arena0, sizeof(arena0));
+    if (arena) {
+        arena0 = arena->getStats();
+    }
+
+    for (unsigned int i = 0; i < iterations; i++) {
+        if (mode == BENCH_CORPUS) {
+            input = corpus[i % count_of(corpus)];
+        } else if ((mode == BENCH_FUZZ) && random(2)) {
+            input = corpus[random(count_of(corpus))];
+            mutate(input);
+        } else {
+            generate(input);
+            if (mode == BENCH_FUZZ) {
+                mutate(input);
+            }
+        }
+
+        // Handlers edit the message in place
+        snprintf(failure, sizeof(failure), "%s", input.c_str());
+
+        // The input string itself is not the handler's allocation
+        allocs0 = heap_trace_current_allocs();
+        t0 = time_us_64();
+        try {
+            reply = handler(input, arg);
+        } catch (...) {
+            reply.clear();
+            if (_result.exceptions == 0) {
+                memcpy(_result.failure, failure, sizeof(failure));
+            }
+            _result.exceptions++;
+        }
+        us = time_us_64() - t0;
+        _result.allocs += heap_trace_current_allocs() - allocs0;
+
+        _result.commands++;
+        if (reply.empty() == false) {
+            _result.replies++;
+        }
+        _result.elapsed_us += us;
+        if (us > _result.max_us) {
+            _result.max_us = us;
+        }
+        sample(i, us);
+    }
+
+    if (arena) {
+        _result.arena_allocs = arena->getStats().allocs - arena0.allocs;
+        _result.arena_fallbacks =
+            arena->getStats().fallbacks - arena0.fallbacks;
+    }
+
+    if (_n_samples > 0) {
+        sort(_samples, _samples + _n_samples);
+        _result.p50_us = _samples[(_n_samples - 1) / 2];
+        _result.p99_us = _samples[((_n_samples - 1) * 99) / 100];
+    }
+}
+
+const struct command_bench_result &CommandBench::result(void) const
+{
+    return _result;
+}
+
+const char *CommandBench::modeStr(unsigned int mode)
+{
+    const char *s = "unknown";
+
+    switch (mode) {
+    case BENCH_CORPUS:
+        s = "corpus";
+        break;
+    case BENCH_GENERATED:
+        s = "gen";
+        break;
+    case BENCH_FUZZ:
+        s = "fuzz";
+        break;
+    default:
+        break;
+    }
+
+    return s;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
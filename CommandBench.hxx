@@ -0,0 +1,92 @@
+/*
+ * CommandBench.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef COMMANDBENCH_HXX
+#define COMMANDBENCH_HXX
+
+#include <stdint.h>
+#include <string>
+#include <MessageArena.hxx>
+
+#define BENCH_MAX_SAMPLES   512
+#define BENCH_INPUT_MAX     160
+#define BENCH_FAILURE_MAX   48
+#define BENCH_MAX_ITERATIONS 20000  // Keeps the worker's stall short
+
+using namespace std;
+
+struct command_bench_result {
+    unsigned int mode;
+    uint32_t seed;
+    unsigned int commands;
+    unsigned int replies;                // Non-empty replies
+    unsigned int exceptions;
+    unsigned int allocs;                 // Heap allocations
+    unsigned int arena_allocs;
+    unsigned int arena_fallbacks;
+    uint64_t elapsed_us;                 // In the handler only
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+    char failure[BENCH_FAILURE_MAX + 1]; // First input that threw
+};
+
+typedef string (*bench_handler_t)(string &message, void *arg);
+
+/*
+ * Drives a command handler with a recorded corpus, with commands made up
+ * from the chat grammar, or with mutations of both, and measures the
+ * handler alone: throughput, heap and arena allocations per command and
+ * the latency distribution. Exceptions escaping the handler are counted
+ * and the first offending input is kept.
+ */
+class CommandBench {
+
+public:
+
+    enum Mode {
+        BENCH_CORPUS,
+        BENCH_GENERATED,
+        BENCH_FUZZ,
+        BENCH_MODE_MAX,
+    };
+
+    CommandBench();
+    ~CommandBench();
+
+    void run(enum Mode mode, unsigned int iterations, uint32_t seed,
+             bench_handler_t handler, void *arg,
+             const MessageArena *arena = NULL);
+    const struct command_bench_result &result(void) const;
+
+    static const char *modeStr(unsigned int mode);
+
+private:
+
+    uint32_t random(void);
+    uint32_t random(uint32_t n);
+    void generate(string &input);
+    void mutate(string &input);
+    void sample(unsigned int index, uint32_t us);
+
+    uint32_t _state;
+    uint16_t _samples[BENCH_MAX_SAMPLES];
+    unsigned int _n_samples;
+    struct command_bench_result _result;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,122 @@
+/*
+ * DupCache.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <pico/stdlib.h>
+#include <DupCache.hxx>
+
+DupCache::DupCache()
+{
+    clear();
+    bzero(&_stats, sizeof(_stats));
+}
+
+DupCache::~DupCache()
+{
+
+}
+
+void DupCache::clear(void)
+{
+    bzero(_entries, sizeof(_entries));
+    memset(_buckets, -1, sizeof(_buckets));
+    _head = 0;
+    _count = 0;
+}
+
+unsigned int DupCache::size(void) const
+{
+    return _count;
+}
+
+unsigned int DupCache::hash(uint32_t from, uint32_t id)
+{
+    uint32_t h = (from * 0x9e3779b1) ^ id;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+
+    return h & (DUP_CACHE_BUCKETS - 1);
+}
+
+void DupCache::unlink(int index)
+{
+    int8_t *link = &_buckets[_entries[index].bucket];
+
+    while (*link >= 0) {
+        if (*link == index) {
+            *link = _entries[index].next;
+            break;
+        }
+        link = &_entries[*link].next;
+    }
+}
+
+/*
+ * Returns true if (from, id) has been seen within the TTL; otherwise
+ * records it and returns false.
+ */
+bool DupCache::check(uint32_t from, uint32_t id)
+{
+    uint32_t now = time_us_64() / 1000;
+    unsigned int bucket = hash(from, id);
+    struct entry *e = NULL;
+    int index;
+
+    _stats.lookups++;
+    for (index = _buckets[bucket]; index >= 0; index = e->next) {
+        e = &_entries[index];
+        if ((e->from == from) && (e->id == id)) {
+            if ((now - e->ts) < DUP_CACHE_TTL_MS) {
+                _stats.hits++;
+                return true;
+            }
+            // Same id reused much later: treat it as new
+            _stats.expired++;
+            e->ts = now;
+            return false;
+        }
+    }
+
+    index = _head;
+    if (_count == DUP_CACHE_ENTRIES) {
+        unlink(index);
+        _stats.evictions++;
+    } else {
+        _count++;
+    }
+    _head = (_head + 1) % DUP_CACHE_ENTRIES;
+
+    e = &_entries[index];
+    e->from = from;
+    e->id = id;
+    e->ts = now;
+    e->bucket = bucket;
+    e->next = _buckets[bucket];
+    _buckets[bucket] = index;
+
+    return false;
+}
+
+const struct dup_cache_stats &DupCache::getStats(void) const
+{
+    return _stats;
+}
+
+void DupCache::resetStats(void)
+{
+    bzero(&_stats, sizeof(_stats));
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,71 @@
+/*
+ * DupCache.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef DUPCACHE_HXX
+#define DUPCACHE_HXX
+
+#include <stdint.h>
+
+#define DUP_CACHE_ENTRIES  64
+#define DUP_CACHE_BUCKETS  32            // Power of two
+#define DUP_CACHE_TTL_MS   (10 * 60 * 1000)
+
+struct dup_cache_stats {
+    unsigned int lookups;
+    unsigned int hits;
+    unsigned int expired;                // Matched, but too old to count
+    unsigned int evictions;
+};
+
+/*
+ * Remembers the last DUP_CACHE_ENTRIES (from, packet id) pairs. The
+ * entries live in a ring, so the oldest is overwritten first, and are
+ * chained into hash buckets for lookup; nothing is allocated.
+ */
+class DupCache {
+
+public:
+
+    DupCache();
+    ~DupCache();
+
+    bool check(uint32_t from, uint32_t id);
+    void clear(void);
+    unsigned int size(void) const;
+
+    const struct dup_cache_stats &getStats(void) const;
+    void resetStats(void);
+
+private:
+
+    static unsigned int hash(uint32_t from, uint32_t id);
+    void unlink(int index);
+
+    struct entry {
+        uint32_t from;
+        uint32_t id;
+        uint32_t ts;                     // ms
+        int8_t next;
+        uint8_t bucket;
+    } _entries[DUP_CACHE_ENTRIES];
+    int8_t _buckets[DUP_CACHE_BUCKETS];
+    unsigned int _head;
+    unsigned int _count;
+    struct dup_cache_stats _stats;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
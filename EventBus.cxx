@@ -0,0 +1,231 @@
+/*
+ * EventBus.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <pico/stdlib.h>
+#include <EventBus.hxx>
+
+EventBus::EventBus()
+{
+    bzero(_slots, sizeof(_slots));
+    bzero(&_stats, sizeof(_stats));
+}
+
+EventBus::~EventBus()
+{
+
+}
+
+int EventBus::subscribe(TaskHandle_t task, uint32_t mask)
+{
+    int id = -1;
+
+    if (task == NULL) {
+        goto done;
+    }
+
+    taskENTER_CRITICAL();
+    for (int i = 0; i < EVENT_BUS_MAX_SUBSCRIBERS; i++) {
+        if (_slots[i].task == NULL) {
+            bzero(&_slots[i], sizeof(_slots[i]));
+            _slots[i].task = task;
+            _slots[i].mask = mask;
+            id = i;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+done:
+
+    return id;
+}
+
+void EventBus::unsubscribe(int id)
+{
+    if ((id < 0) || (id >= EVENT_BUS_MAX_SUBSCRIBERS)) {
+        return;
+    }
+
+    taskENTER_CRITICAL();
+    _slots[id].task = NULL;
+    _slots[id].mask = 0;
+    taskEXIT_CRITICAL();
+}
+
+/*
+ * Called with the bus locked; returns the tasks to notify once it has
+ * been unlocked.
+ */
+unsigned int EventBus::deliver(const struct room_event &event,
+                               TaskHandle_t *tasks)
+{
+    unsigned int n = 0;
+    struct slot *slot = NULL;
+
+    if (event.type >= EVENT_TYPE_MAX) {
+        return 0;
+    }
+
+    _stats.published[event.type]++;
+    for (int i = 0; i < EVENT_BUS_MAX_SUBSCRIBERS; i++) {
+        slot = &_slots[i];
+        if ((slot->task == NULL) ||
+            ((slot->mask & EVENT_MASK(event.type)) == 0)) {
+            continue;
+        }
+
+        if (slot->count >= EVENT_BUS_QUEUE_DEPTH) {
+            slot->stats.dropped++;
+        } else {
+            slot->events[(slot->head + slot->count) %
+                         EVENT_BUS_QUEUE_DEPTH] = event;
+            slot->count++;
+            slot->stats.delivered++;
+            if (slot->count > slot->stats.depth_max) {
+                slot->stats.depth_max = slot->count;
+            }
+        }
+        tasks[n++] = slot->task;
+    }
+
+    if (n == 0) {
+        _stats.unheard++;
+    }
+
+    return n;
+}
+
+void EventBus::publish(struct room_event &event)
+{
+    TaskHandle_t tasks[EVENT_BUS_MAX_SUBSCRIBERS];
+    unsigned int n;
+
+    event.ts = time_us_64() / 1000;
+
+    taskENTER_CRITICAL();
+    n = deliver(event, tasks);
+    taskEXIT_CRITICAL();
+
+    for (unsigned int i = 0; i < n; i++) {
+        xTaskNotifyGive(tasks[i]);
+    }
+}
+
+void EventBus::publishFromISR(struct room_event &event, BaseType_t *woken)
+{
+    TaskHandle_t tasks[EVENT_BUS_MAX_SUBSCRIBERS];
+    unsigned int n;
+    UBaseType_t status;
+
+    event.ts = time_us_64() / 1000;
+
+    status = taskENTER_CRITICAL_FROM_ISR();
+    n = deliver(event, tasks);
+    taskEXIT_CRITICAL_FROM_ISR(status);
+
+    for (unsigned int i = 0; i < n; i++) {
+        vTaskNotifyGiveFromISR(tasks[i], woken);
+    }
+}
+
+bool EventBus::next(int id, struct room_event &event)
+{
+    bool result = false;
+    struct slot *slot = NULL;
+
+    if ((id < 0) || (id >= EVENT_BUS_MAX_SUBSCRIBERS)) {
+        goto done;
+    }
+
+    slot = &_slots[id];
+    taskENTER_CRITICAL();
+    if (slot->count > 0) {
+        event = slot->events[slot->head];
+        slot->head = (slot->head + 1) % EVENT_BUS_QUEUE_DEPTH;
+        slot->count--;
+        result = true;
+    }
+    taskEXIT_CRITICAL();
+
+done:
+
+    return result;
+}
+
+unsigned int EventBus::pending(int id) const
+{
+    if ((id < 0) || (id >= EVENT_BUS_MAX_SUBSCRIBERS)) {
+        return 0;
+    }
+
+    return _slots[id].count;
+}
+
+bool EventBus::subscriber(int id, TaskHandle_t &task, uint32_t &mask) const
+{
+    if ((id < 0) || (id >= EVENT_BUS_MAX_SUBSCRIBERS) ||
+        (_slots[id].task == NULL)) {
+        return false;
+    }
+
+    task = _slots[id].task;
+    mask = _slots[id].mask;
+
+    return true;
+}
+
+const struct event_subscriber_stats &EventBus::subscriberStats(int id) const
+{
+    return _slots[id % EVENT_BUS_MAX_SUBSCRIBERS].stats;
+}
+
+const struct event_bus_stats &EventBus::getStats(void) const
+{
+    return _stats;
+}
+
+const char *EventBus::typeStr(uint8_t type)
+{
+    const char *s = "unknown";
+
+    switch (type) {
+    case EVENT_BUTTON:
+        s = "button";
+        break;
+    case EVENT_ENV:
+        s = "env";
+        break;
+    case EVENT_MESH_RX:
+        s = "mesh rx";
+        break;
+    case EVENT_ROUTING:
+        s = "routing";
+        break;
+    case EVENT_TRACEROUTE:
+        s = "traceroute";
+        break;
+    case EVENT_RESET:
+        s = "reset";
+        break;
+    case EVENT_MORSE:
+        s = "morse";
+        break;
+    default:
+        break;
+    }
+
+    return s;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
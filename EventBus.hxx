@@ -0,0 +1,133 @@
+/*
+ * EventBus.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef EVENTBUS_HXX
+#define EVENTBUS_HXX
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#define EVENT_BUS_MAX_SUBSCRIBERS  6
+#define EVENT_BUS_QUEUE_DEPTH      8
+
+enum RoomEventType {
+    EVENT_BUTTON,
+    EVENT_ENV,
+    EVENT_MESH_RX,
+    EVENT_ROUTING,
+    EVENT_TRACEROUTE,
+    EVENT_RESET,
+    EVENT_MORSE,
+    EVENT_TYPE_MAX,
+};
+
+#define EVENT_MASK(type)  (1UL << (type))
+
+#define EVENT_ENV_TEMP      0x01
+#define EVENT_ENV_HUMIDITY  0x02
+#define EVENT_ENV_PRESSURE  0x04
+
+struct room_event {
+    uint8_t type;
+    uint32_t ts;                         // ms since boot
+    union {
+        struct {
+            uint8_t gesture;             // enum ButtonGesture
+            uint32_t tdur_ms;
+        } button;
+        struct {
+            uint8_t valid;               // EVENT_ENV_*
+            int16_t temperature;         // 0.1C
+            int16_t humidity;            // 0.1%
+            uint16_t pressure;           // 0.1hPa
+        } env;
+        struct {
+            uint32_t from;
+            uint16_t portnum;
+            int8_t snr;                  // 0.25dB
+        } rx;
+        struct {
+            uint32_t from;
+            uint8_t hops;
+        } route;
+        struct {
+            uint32_t count;
+        } reset;
+        struct {
+            bool playing;
+        } morse;
+    } u;
+};
+
+struct event_subscriber_stats {
+    unsigned int delivered;
+    unsigned int dropped;
+    unsigned int depth_max;
+};
+
+struct event_bus_stats {
+    unsigned int published[EVENT_TYPE_MAX];
+    unsigned int unheard;                // Published with no subscriber
+};
+
+/*
+ * Fan-out of small, by-value room events to a fixed set of subscriber
+ * tasks. Each subscriber owns a slot with an event mask and a bounded
+ * queue; publishing copies the event into every matching queue and
+ * gives the subscriber a task notification, so consumers block in
+ * ulTaskNotifyTake() and wake only for the events they asked for. When
+ * a queue is full the new event is dropped and counted. Nothing is
+ * allocated after construction.
+ */
+class EventBus {
+
+public:
+
+    EventBus();
+    ~EventBus();
+
+    int subscribe(TaskHandle_t task, uint32_t mask);
+    void unsubscribe(int id);
+
+    void publish(struct room_event &event);
+    void publishFromISR(struct room_event &event, BaseType_t *woken);
+    bool next(int id, struct room_event &event);
+
+    unsigned int pending(int id) const;
+    bool subscriber(int id, TaskHandle_t &task, uint32_t &mask) const;
+    const struct event_subscriber_stats &subscriberStats(int id) const;
+    const struct event_bus_stats &getStats(void) const;
+
+    static const char *typeStr(uint8_t type);
+
+private:
+
+    unsigned int deliver(const struct room_event &event,
+                         TaskHandle_t *tasks);
+
+    struct slot {
+        TaskHandle_t task;
+        uint32_t mask;
+        struct room_event events[EVENT_BUS_QUEUE_DEPTH];
+        unsigned int head;
+        unsigned int count;
+        struct event_subscriber_stats stats;
+    } _slots[EVENT_BUS_MAX_SUBSCRIBERS];
+    struct event_bus_stats _stats;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -46,13 +46,46 @@
 #define configTOTAL_HEAP_SIZE                   (128 * 1024)
 #define configAPPLICATION_ALLOCATED_HEAP        0
 
+/* Heap accounting (heap.cxx): C++ new/delete are routed into heap_4,
+every pvPortMalloc() is attributed to the calling task and every
+vPortFree() to the task that allocated the block. */
+#ifndef __ASSEMBLER__
+#include <stddef.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern void heap_trace_malloc(void *ptr, size_t size);
+extern void heap_trace_free(void *ptr, size_t size);
+#ifdef __cplusplus
+}
+#endif
+#define traceMALLOC(pvAddress, uiSize)          heap_trace_malloc(pvAddress, uiSize)
+#define traceFREE(pvAddress, uiSize)            heap_trace_free(pvAddress, uiSize)
+#endif
+
 /* Hook function related definitions. */
 #define configCHECK_FOR_STACK_OVERFLOW          1
 #define configUSE_MALLOC_FAILED_HOOK            0
 #define configUSE_DAEMON_TASK_STARTUP_HOOK      0
 
-/* Run time and task stats gathering related definitions. */
-#define configGENERATE_RUN_TIME_STATS           0
+/* Run time and task stats gathering related definitions. The run time
+counter is the free-running 1 MHz system timer (meshroom.cxx), 64 bits
+wide so that it does not wrap after 71 minutes; per-core utilisation is
+derived from the idle tasks' counters. */
+#define configGENERATE_RUN_TIME_STATS           1
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+#define configRUN_TIME_COUNTER_TYPE             uint64_t
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern uint64_t run_time_counter(void);
+#ifdef __cplusplus
+}
+#endif
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()
+#define portGET_RUN_TIME_COUNTER_VALUE()        run_time_counter()
+#endif
 #define configUSE_TRACE_FACILITY                1
 #define configUSE_STATS_FORMATTING_FUNCTIONS    1
 
@@ -0,0 +1,174 @@
+/*
+ * IrQueue.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <strings.h>
+#include <IrQueue.hxx>
+
+IrQueue::IrQueue(unsigned int coalesceMs)
+{
+    bzero(_slots, sizeof(_slots));
+    bzero(&_stats, sizeof(_stats));
+    _coalesceTicks = pdMS_TO_TICKS(coalesceMs);
+}
+
+IrQueue::~IrQueue()
+{
+
+}
+
+void IrQueue::submit(enum Kind kind, uint32_t value)
+{
+    if ((kind < 0) || (kind >= IR_KIND_MAX)) {
+        return;
+    }
+
+    taskENTER_CRITICAL();
+    _stats.requests++;
+    if (_slots[kind].pending) {
+        _stats.merged++;
+    }
+    _slots[kind].pending = true;
+    _slots[kind].value = value;
+    _slots[kind].last = xTaskGetTickCount();
+
+    // Keep a pending AC power frame carrying the latest AC state
+    if ((kind == IR_AC_STATE) && _slots[IR_AC_POWER].pending) {
+        _slots[IR_AC_POWER].value = value;
+    }
+    taskEXIT_CRITICAL();
+}
+
+bool IrQueue::isDue(enum Kind kind, TickType_t now) const
+{
+    if (_slots[kind].pending == false) {
+        return false;
+    }
+
+    if ((kind == IR_TV_POWER) || (kind == IR_AC_POWER)) {
+        return true;
+    }
+
+    return (now - _slots[kind].last) >= _coalesceTicks;
+}
+
+bool IrQueue::pop(enum Kind &kind, uint32_t &value)
+{
+    bool result = false;
+    TickType_t now;
+
+    taskENTER_CRITICAL();
+    now = xTaskGetTickCount();
+    for (int i = 0; i < IR_KIND_MAX; i++) {
+        if (isDue((enum Kind) i, now)) {
+            kind = (enum Kind) i;
+            value = _slots[i].value;
+            _slots[i].pending = false;
+            result = true;
+            break;
+        }
+    }
+
+    // The AC power frame carries the full AC state
+    if (result && (kind == IR_AC_POWER) && _slots[IR_AC_STATE].pending) {
+        _slots[IR_AC_STATE].pending = false;
+        _stats.superseded++;
+    }
+    taskEXIT_CRITICAL();
+
+    return result;
+}
+
+TickType_t IrQueue::nextDeadline(void) const
+{
+    TickType_t deadline = portMAX_DELAY;
+    TickType_t now, elapsed, wait;
+
+    taskENTER_CRITICAL();
+    now = xTaskGetTickCount();
+    for (int i = 0; i < IR_KIND_MAX; i++) {
+        if (_slots[i].pending == false) {
+            continue;
+        }
+
+        if (isDue((enum Kind) i, now)) {
+            deadline = 0;
+            break;
+        }
+
+        elapsed = now - _slots[i].last;
+        wait = _coalesceTicks - elapsed;
+        if (wait < deadline) {
+            deadline = wait;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    return deadline;
+}
+
+unsigned int IrQueue::pending(void) const
+{
+    unsigned int count = 0;
+
+    for (int i = 0; i < IR_KIND_MAX; i++) {
+        if (_slots[i].pending) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+void IrQueue::complete(bool success)
+{
+    if (success) {
+        _stats.transmissions++;
+    } else {
+        _stats.failed++;
+    }
+}
+
+const struct ir_queue_stats &IrQueue::getStats(void) const
+{
+    return _stats;
+}
+
+const char *IrQueue::kindStr(enum Kind kind)
+{
+    const char *s = "unknown";
+
+    switch (kind) {
+    case IR_TV_POWER:
+        s = "tv power";
+        break;
+    case IR_AC_POWER:
+        s = "ac power";
+        break;
+    case IR_AC_STATE:
+        s = "ac state";
+        break;
+    case IR_TV_CHAN:
+        s = "tv chan";
+        break;
+    case IR_TV_VOL:
+        s = "tv vol";
+        break;
+    default:
+        break;
+    }
+
+    return s;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
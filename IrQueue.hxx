@@ -0,0 +1,83 @@
+/*
+ * IrQueue.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef IRQUEUE_HXX
+#define IRQUEUE_HXX
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#define IR_QUEUE_COALESCE_MS 500
+
+struct ir_queue_stats {
+    unsigned int requests;
+    unsigned int merged;
+    unsigned int superseded;
+    unsigned int transmissions;
+    unsigned int failed;
+};
+
+/*
+ * Holds at most one pending transmission per command kind. Requests of
+ * the same kind that arrive before the pending one is sent overwrite its
+ * target value, so a burst of "vol up" collapses into a single absolute
+ * volume and a sweep of AC changes into the final AC state frame.
+ * Kinds are ordered by priority; power commands go out immediately, the
+ * others once they have been quiet for the coalescing window. A pending
+ * AC power frame is refreshed by later AC state requests, so sending it
+ * supersedes the pending state frame.
+ */
+class IrQueue {
+
+public:
+
+    enum Kind {
+        IR_TV_POWER,
+        IR_AC_POWER,
+        IR_AC_STATE,
+        IR_TV_CHAN,
+        IR_TV_VOL,
+        IR_KIND_MAX,
+    };
+
+    IrQueue(unsigned int coalesceMs = IR_QUEUE_COALESCE_MS);
+    ~IrQueue();
+
+    void submit(enum Kind kind, uint32_t value);
+    bool pop(enum Kind &kind, uint32_t &value);
+    TickType_t nextDeadline(void) const;
+    unsigned int pending(void) const;
+    void complete(bool success);
+
+    const struct ir_queue_stats &getStats(void) const;
+
+    static const char *kindStr(enum Kind kind);
+
+private:
+
+    bool isDue(enum Kind kind, TickType_t now) const;
+
+    struct slot {
+        bool pending;
+        uint32_t value;
+        TickType_t last;
+    } _slots[IR_KIND_MAX];
+    TickType_t _coalesceTicks;
+    struct ir_queue_stats _stats;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
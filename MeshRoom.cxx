@@ -6,6 +6,8 @@
 
 #include <stddef.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <strings.h>
 #include <pico/stdlib.h>
 #include <pico/flash.h>
 #include <hardware/flash.h>
@@ -22,30 +24,85 @@
 extern shared_ptr<MeshRoom> meshroom;
 
 MeshRoom::MeshRoom()
-    : SimpleClient(), HomeChat(), BaseNvm(), MorseBuzzer()
+    : SimpleClient(), HomeChat(), BaseNvm(), MorseBuzzer(),
+      _serial0(uart0), _serial1(uart1)
+#if defined(MESHROOM_MORSE_ALARM)
+    , _morsePlayer(BUZZER_PIN)
+#endif
 {
     bzero(&_main_body, sizeof(_main_body));
     _main_body.ir_flags =
         MESHROOM_IR_SONY_BRAVIA |
         MESHROOM_IR_PANASONIC_AC;
-    _tvOnOff = false;
-    _tvVol = 10;
-    _tvChan = 1;
-    _acOnOff = false;
-    _acMode = AC_AC;
-    _acTemp = 24;
-    _acFanSpeed = 0;
-    _acFanDir = 0;
+    _appliances.tvOnOff = false;
+    _appliances.tvVol = 10;
+    _appliances.tvChan = 1;
+    _appliances.acOnOff = false;
+    _appliances.acMode = AC_AC;
+    _appliances.acTemp = 24;
+    _appliances.acFanSpeed = 0;
+    _appliances.acFanDir = 0;
+    _benchAppliances = _appliances;
     _resetCount = 1;
     _lastReset = time(NULL);
 
+    _commandWorker = NULL;
+    _workerEvents = -1;
+    _textPacket = NULL;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    _replyQueue = xQueueCreateStatic(MESHROOM_REPLY_QUEUE_DEPTH,
+                                     sizeof(struct mesh_reply),
+                                     _replyQueueStorage,
+                                     &_replyQueueBuffer);
+#else
+    _replyQueue = xQueueCreate(MESHROOM_REPLY_QUEUE_DEPTH,
+                               sizeof(struct mesh_reply));
+#endif
+    bzero(&_cmdqStats, sizeof(_cmdqStats));
+    _benchPending = false;
+    _benchMode = CommandBench::BENCH_CORPUS;
+    _benchIterations = 0;
+    _benchSeed = 0;
+    _dryRun = false;
+    _txDutyPending = 0;
+    _compactPending = -1;
+    _configStartUs = 0;
+    _configMs = 0;
+    _serialBaudPending = 0;
+    _linkTelemetrySecs = 0;
+    _linkTelemetryLast = 0;
+    _lastFiltered = 0;
+    _filter.setDrop(MeshRoom::packet_drop, this);
+    _serial1.setFilter(&_filter);
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    _benchDone = xSemaphoreCreateBinaryStatic(&_benchDoneBuffer);
+    _nvmLock = xSemaphoreCreateMutexStatic(&_nvmLockBuffer);
+    _clientLock = xSemaphoreCreateMutexStatic(&_clientLockBuffer);
+#else
+    _benchDone = xSemaphoreCreateBinary();
+    _nvmLock = xSemaphoreCreateMutex();
+    _clientLock = xSemaphoreCreateMutex();
+#endif
+    bzero(&_protoStats, sizeof(_protoStats));
+    bzero(&_env, sizeof(_env));
+    _envTime = 0;
+    _rules.setAction(MeshRoom::rule_action, this);
+#if defined(MESHROOM_MORSE_ALARM)
+    _morsePlayer.setDone(MeshRoom::morse_done, this);
+#endif
+
     gpio_init(PUSHBUTTON_PIN);
     gpio_set_dir(PUSHBUTTON_PIN, GPIO_IN);
     gpio_pull_up(PUSHBUTTON_PIN);
-    gpio_set_irq_enabled_with_callback(PUSHBUTTON_PIN,
-                                       GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL,
-                                       true,
-                                       MeshRoom::gpio_callback);
+    _button.setCallback(MeshRoom::button_gesture, this);
+    if (_button.begin(PUSHBUTTON_PIN) == false) {
+        // No free state machine: fall back to edge interrupts
+        gpio_set_irq_enabled_with_callback(PUSHBUTTON_PIN,
+                                           GPIO_IRQ_EDGE_RISE |
+                                           GPIO_IRQ_EDGE_FALL,
+                                           true,
+                                           MeshRoom::gpio_callback);
+    }
 
     gpio_init(OUTRESET_PIN);
     gpio_set_dir(OUTRESET_PIN, GPIO_OUT);
@@ -63,7 +120,13 @@ MeshRoom::MeshRoom()
 
     gpio_init(ALERT_LED_PIN);
     gpio_set_dir(ALERT_LED_PIN, GPIO_OUT);
-    setAlertLed(false);
+    _alertLed = false;
+
+    _adc.start();
+
+    _buzzerActuator = _actuators.addChannel(BUZZER_PIN, false);
+    _resetActuator = _actuators.addChannel(OUTRESET_PIN, true);
+    _alertLedActuator = _actuators.addChannel(ALERT_LED_PIN, false);
 }
 
 MeshRoom::~MeshRoom()
@@ -74,73 +137,103 @@ MeshRoom::~MeshRoom()
 void MeshRoom::gpio_callback(uint gpio, uint32_t events)
 {
     static uint64_t t0 = 0;
-    struct button_event event = {
-        .ts = 0,
-        .tdur = 0,
-    };
+    uint64_t now, tdur;
+    BaseType_t woken = pdFALSE;
+    struct room_event event;
 
     if (gpio != PUSHBUTTON_PIN) {
         goto done;
     }
 
-    event.ts = time_us_64();
+    now = time_us_64();
 
     if (events & GPIO_IRQ_EDGE_FALL) {
-        t0 = event.ts;
+        t0 = now;
         goto done;
     }
 
-    if (events & GPIO_IRQ_EDGE_RISE) {
-        if (t0 == 0) {
-            goto done;
-        }
+    if (((events & GPIO_IRQ_EDGE_RISE) == 0) || (t0 == 0)) {
+        goto done;
+    }
 
-        event.tdur = event.ts - t0;
-        t0 = 0;
+    tdur = now - t0;
+    t0 = 0;
 
-        if (event.tdur < PUSHBUTTON_DURATION_THRESHOLD_US) {
-            goto done;
-        }
+    // Without the PIO there is no debouncing and no double press
+    if (tdur < BUTTON_DEBOUNCE_US) {
+        goto done;
     }
 
-
-    if (meshroom->_buttonEvents.size() < 5) {
-        meshroom->_buttonEvents.push_back(event);
+    event.type = EVENT_BUTTON;
+    if (tdur >= BUTTON_HELD_US) {
+        event.u.button.gesture = BUTTON_HELD;
+    } else if (tdur >= BUTTON_LONG_US) {
+        event.u.button.gesture = BUTTON_LONG;
+    } else {
+        event.u.button.gesture = BUTTON_SHORT;
     }
+    event.u.button.tdur_ms = tdur / 1000;
+    meshroom->_events.publishFromISR(event, &woken);
+    portYIELD_FROM_ISR(woken);
 
 done:
 
     return;
 }
 
-bool MeshRoom::getButtonEvent(struct button_event &event, bool clearOld)
+void MeshRoom::button_gesture(enum ButtonGesture gesture, uint64_t tdur,
+                              void *arg)
 {
-    bool result = false;
+    MeshRoom *meshroom = (MeshRoom *) arg;
+    struct room_event event;
 
-    if (_buttonEvents.empty()) {
-        goto done;
-    }
+    event.type = EVENT_BUTTON;
+    event.u.button.gesture = gesture;
+    event.u.button.tdur_ms = tdur / 1000;
+    meshroom->_events.publish(event);
+}
 
-    if (clearOld) {
-        event = _buttonEvents.back();
-        _buttonEvents.clear();
-    } else {
-        event = _buttonEvents.front();
-    }
+EventBus &MeshRoom::events(void)
+{
+    return _events;
+}
 
-done:
+void MeshRoom::morse_done(void *arg)
+{
+    MeshRoom *meshroom = (MeshRoom *) arg;
+    BaseType_t woken = pdFALSE;
+    struct room_event event;
+
+    event.type = EVENT_MORSE;
+    event.u.morse.playing = false;
+    meshroom->_events.publishFromISR(event, &woken);
+    portYIELD_FROM_ISR(woken);
+}
 
-    return result;
+void MeshRoom::setButtonTask(TaskHandle_t task)
+{
+    _button.setTask(task);
+}
+
+void MeshRoom::runButton(void)
+{
+    _button.run();
+}
+
+const ButtonCapture &MeshRoom::buttonCapture(void) const
+{
+    return _button;
 }
 
 void MeshRoom::tvOnOff(bool onOff)
 {
-    _tvOnOff = onOff;
+    appliances().tvOnOff = onOff;
+    queueIr(IrQueue::IR_TV_POWER, onOff);
 }
 
 bool MeshRoom::tvOnOff(void) const
 {
-    return _tvOnOff;
+    return appliances().tvOnOff;
 }
 
 void MeshRoom::tvVol(unsigned int volume)
@@ -149,12 +242,13 @@ void MeshRoom::tvVol(unsigned int volume)
         return;
     }
 
-    _tvVol = volume;
+    appliances().tvVol = volume;
+    queueIr(IrQueue::IR_TV_VOL, volume);
 }
 
 unsigned int MeshRoom::tvVol(void) const
 {
-    return _tvVol;
+    return appliances().tvVol;
 }
 
 void MeshRoom::tvChan(unsigned int chan)
@@ -163,41 +257,44 @@ void MeshRoom::tvChan(unsigned int chan)
         return;
     }
 
-    _tvChan = chan;
+    appliances().tvChan = chan;
+    queueIr(IrQueue::IR_TV_CHAN, chan);
 }
 
 unsigned int MeshRoom::tvChan(void) const
 {
-    return _tvChan;
+    return appliances().tvChan;
 }
 
 void MeshRoom::acOnOff(bool onOff)
 {
-    _acOnOff = onOff;
+    appliances().acOnOff = onOff;
+    queueIr(IrQueue::IR_AC_POWER, acStateFrame());
 }
 
 bool MeshRoom::acOnOff(void) const
 {
-    return _acOnOff;
+    return appliances().acOnOff;
 }
 
 void MeshRoom::acMode(enum AcMode mode)
 {
     if ((mode >= AC_AC) && (mode <= AC_AUTO)) {
-        _acMode = mode;
+        appliances().acMode = mode;
+        queueIr(IrQueue::IR_AC_STATE, acStateFrame());
     }
 }
 
 enum MeshRoom::AcMode MeshRoom::acMode(void) const
 {
-    return _acMode;
+    return appliances().acMode;
 }
 
 string MeshRoom::acModeStr(void) const
 {
     string s;
 
-    switch (_acMode) {
+    switch (appliances().acMode) {
     case AC_AC:
         s = "ac";
         break;
@@ -220,129 +317,1070 @@ string MeshRoom::acModeStr(void) const
 void MeshRoom::acTemp(unsigned int temp)
 {
     if ((temp >= 20) && (temp <= 30)) {
-        _acTemp = temp;
+        appliances().acTemp = temp;
+        queueIr(IrQueue::IR_AC_STATE, acStateFrame());
+    }
+}
+
+unsigned int MeshRoom::acTemp(void) const
+{
+    return appliances().acTemp;
+}
+
+void MeshRoom::acFanSpeed(unsigned int speed)
+{
+    if (speed <= 5) {
+        appliances().acFanSpeed = speed;
+        queueIr(IrQueue::IR_AC_STATE, acStateFrame());
+    }
+}
+
+unsigned int MeshRoom::acFanSpeed(void) const
+{
+    return appliances().acFanSpeed;
+}
+
+void MeshRoom::acFanDir(unsigned int dir)
+{
+    if (dir <= 6) {
+        appliances().acFanDir = dir;
+        queueIr(IrQueue::IR_AC_STATE, acStateFrame());
+    }
+}
+
+unsigned int MeshRoom::acFanDir(void) const
+{
+    return appliances().acFanDir;
+}
+
+uint32_t MeshRoom::acStateFrame(void) const
+{
+    const struct appliances &state = appliances();
+    uint32_t frame = 0;
+
+    frame |= (state.acOnOff ? 1 : 0) << 0;
+    frame |= ((uint32_t) state.acMode & 0x3) << 1;
+    frame |= (state.acTemp & 0x1f) << 3;
+    frame |= (state.acFanSpeed & 0x7) << 8;
+    frame |= (state.acFanDir & 0x7) << 11;
+
+    return frame;
+}
+
+void MeshRoom::queueIr(enum IrQueue::Kind kind, uint32_t value)
+{
+    if (benchCall()) {
+        return;
+    }
+
+    _irQueue.submit(kind, value);
+    if (_commandWorker != NULL) {
+        xTaskNotifyGive(_commandWorker);
+    }
+}
+
+void MeshRoom::runIrQueue(void)
+{
+    enum IrQueue::Kind kind;
+    uint32_t value;
+
+    while (_irQueue.pop(kind, value)) {
+        _irQueue.complete(irTransmit(kind, value));
+    }
+}
+
+unsigned int MeshRoom::irPending(void) const
+{
+    return _irQueue.pending();
+}
+
+const struct ir_queue_stats &MeshRoom::getIrQueueStats(void) const
+{
+    return _irQueue.getStats();
+}
+
+/*
+ * Hook for the infrared encoders; it receives only the final target
+ * state of each command kind after coalescing. Until the encoders exist
+ * it only reports whether an emitter is configured for the kind, and
+ * the outcome shows up in the IR queue statistics.
+ */
+bool MeshRoom::irTransmit(enum IrQueue::Kind kind, uint32_t value)
+{
+    bool result = false;
+
+    (void)(value);
+
+    switch (kind) {
+    case IrQueue::IR_TV_POWER:
+    case IrQueue::IR_TV_VOL:
+    case IrQueue::IR_TV_CHAN:
+        result = (ir_flags() &
+                  (MESHROOM_IR_SONY_BRAVIA | MESHROOM_IR_SAMSUNG_TV)) != 0;
+        break;
+    case IrQueue::IR_AC_POWER:
+    case IrQueue::IR_AC_STATE:
+        result = (ir_flags() & MESHROOM_IR_PANASONIC_AC) != 0;
+        break;
+    default:
+        break;
+    }
+
+    return result;
+}
+
+void MeshRoom::reset(actuator_done_t done, void *arg)
+{
+    struct room_event event;
+
+    _resetCount++;
+    _actuators.pulse(_resetActuator, false, OUTRESET_PULSE_MS, done, arg);
+    _lastReset = time(NULL);
+
+    event.type = EVENT_RESET;
+    event.u.reset.count = _resetCount;
+    _events.publish(event);
+}
+
+unsigned int MeshRoom::getResetCount(void) const
+{
+    return _resetCount;
+}
+
+time_t MeshRoom::getLastReset(void) const
+{
+    return _lastReset;
+}
+
+unsigned int MeshRoom::getLastResetSecsAgo(void) const
+{
+    time_t now;
+
+    now = time(NULL);
+
+    return now - _lastReset;
+}
+
+/*
+ * Frames dropped by the packet filter never reach SimpleClient, but they
+ * show that the radio is alive all the same.
+ */
+unsigned int MeshRoom::radioIdleSecs(void) const
+{
+    unsigned int secs = meshDeviceLastRecivedSecondsAgo();
+    unsigned int filtered;
+
+    if (_lastFiltered != 0) {
+        filtered = time(NULL) - _lastFiltered;
+        if (filtered < secs) {
+            secs = filtered;
+        }
+    }
+
+    return secs;
+}
+
+void MeshRoom::buzz(unsigned int ms, actuator_done_t done, void *arg)
+{
+    if (benchCall()) {
+        return;
+    }
+
+    _actuators.pulse(_buzzerActuator, true, ms, done, arg);
+}
+
+void MeshRoom::buzzMorseCode(const string &text, bool clearPrevious)
+{
+    struct room_event event;
+
+    if (benchCall()) {
+        return;
+    }
+
+#if defined(MESHROOM_MORSE_ALARM)
+    if (clearPrevious) {
+        _morsePlayer.clear();
+    }
+
+    _morsePlayer.addText(text);
+#else
+    if (clearPrevious) {
+        this->clearMorseText();
+    }
+
+    this->addMorseText(text);
+#endif
+
+    // After queuing, so a done from the previous text cannot follow it
+    if (text.empty() == false) {
+        event.type = EVENT_MORSE;
+        event.u.morse.playing = true;
+        _events.publish(event);
+    }
+}
+
+bool MeshRoom::isMorsePlaying(void) const
+{
+#if defined(MESHROOM_MORSE_ALARM)
+    return _morsePlayer.isEmpty() == false;
+#else
+    return this->isMorseEmpty() == false;
+#endif
+}
+
+bool MeshRoom::isAlertLedOn(void) const
+{
+    return _alertLed;
+}
+
+void MeshRoom::setAlertLed(bool onOff)
+{
+    _alertLed = onOff;
+    _actuators.setIdle(_alertLedActuator, onOff);
+}
+
+void MeshRoom::flipAlertLed(void)
+{
+    _alertLed = !_alertLed;
+    _actuators.setIdle(_alertLedActuator, _alertLed);
+}
+
+void MeshRoom::blinkAlertLed(unsigned int count,
+                             unsigned int onMs, unsigned int offMs,
+                             actuator_done_t done, void *arg)
+{
+    struct actuator_step steps[ACTUATOR_MAX_STEPS];
+    unsigned int n = 0;
+
+    for (unsigned int i = 0; (i < count) && (n < ACTUATOR_MAX_STEPS); i++) {
+        steps[n].level = true;
+        steps[n].ms = onMs;
+        n++;
+        steps[n].level = false;
+        steps[n].ms = offMs;
+        n++;
+    }
+
+    if (n > 0) {
+        _actuators.run(_alertLedActuator, steps, n, done, arg);
+    }
+}
+
+void MeshRoom::flipOnboardLed(void)
+{
+    PicoPlatform::get()->flipOnboardLed();
+}
+
+float MeshRoom::getOnboardTempC(void) const
+{
+    if (_adc.isRunning() && _adc.hasTemp()) {
+        return _adc.tempC();
+    }
+
+    return PicoPlatform::get()->getOnboardTempC();
+}
+
+AdcSampler &MeshRoom::adcSampler(void)
+{
+    return _adc;
+}
+
+/*
+ * Runs on meshtastic_task. Binary protocol requests take the same path
+ * to the command worker as text commands; everything else is decoded by
+ * SimpleClient.
+ */
+void MeshRoom::gotPacket(const meshtastic_MeshPacket &packet)
+{
+    struct room_event event;
+
+    // Retransmissions and floods can deliver the same packet again
+    if ((packet.id != 0) && _dups.check(packet.from, packet.id)) {
+        return;
+    }
+
+    event.type = EVENT_MESH_RX;
+    event.u.rx.from = packet.from;
+    event.u.rx.portnum =
+        (packet.which_payload_variant == meshtastic_MeshPacket_decoded_tag) ?
+        packet.decoded.portnum : 0;
+    event.u.rx.snr = (int8_t) (packet.rx_snr * 4.0f);
+    _events.publish(event);
+
+    if ((packet.which_payload_variant ==
+         meshtastic_MeshPacket_decoded_tag) &&
+        (packet.decoded.portnum == MESHROOM_PROTO_PORT)) {
+        queueCommand(packet, string());
+        return;
+    }
+
+    SimpleClient::gotPacket(packet);
+}
+
+void MeshRoom::gotTextMessage(const meshtastic_MeshPacket &packet,
+                              const string &message)
+{
+    SimpleClient::gotTextMessage(packet, message);
+    queueCommand(packet, message);
+}
+
+/*
+ * Classifies a command by its first word, or by the op of a binary
+ * request, without parsing it.
+ */
+enum RateLimiter::Class MeshRoom::commandClass(
+    const meshtastic_MeshPacket &packet, const string &message)
+{
+    static const char *actions[] = {
+        "tv", "ac", "reset", "buzz", "morse", "rule",
+    };
+    const char *s = message.c_str();
+    size_t len;
+    uint8_t op;
+
+    if (message.empty()) {
+        if (packet.decoded.payload.size < 2) {
+            return RateLimiter::RATE_QUERY;
+        }
+        op = packet.decoded.payload.bytes[1];
+        return ((op == MR_OP_STATUS) || (op == MR_OP_ENV) ||
+                (op == MR_OP_LINK)) ?
+            RateLimiter::RATE_QUERY : RateLimiter::RATE_ACTION;
+    }
+
+    s += strspn(s, " \t\r\n");
+    len = strcspn(s, " \t\r\n");
+    for (unsigned int i = 0; i < count_of(actions); i++) {
+        if ((strlen(actions[i]) == len) &&
+            (strncasecmp(s, actions[i], len) == 0)) {
+            return RateLimiter::RATE_ACTION;
+        }
+    }
+
+    return RateLimiter::RATE_QUERY;
+}
+
+/*
+ * Runs in meshtastic_task, the decode stage. Commands are handed to the
+ * command worker on the other core through a lock-free ring, so this is
+ * the only producer.
+ */
+void MeshRoom::queueCommand(const meshtastic_MeshPacket &packet,
+                            const string &message)
+{
+    struct mesh_command *cmd = NULL;
+    unsigned int depth = 0;
+    bool trusted;
+
+    // Only a sender proven by its PKI key is spared the global budget
+    trusted = isAuthorized(packet, false);
+    if (_limiter.admit(packet.from, commandClass(packet, message),
+                       trusted) == false) {
+        _cmdqStats.rate_limited++;
+        return;
+    }
+
+    cmd = _commandRing.acquire();
+    if (cmd == NULL) {
+        _cmdqStats.dropped++;
+        consoles_printf("command queue full, dropped message from %s\n",
+                        getDisplayName(packet.from).c_str());
+        return;
+    }
+
+    memcpy(&cmd->packet, &packet, sizeof(packet));
+    if (message.size() > MESHROOM_TEXT_MAX) {
+        _cmdqStats.truncated++;
+    }
+    strncpy(cmd->message, message.c_str(), MESHROOM_TEXT_MAX);
+    cmd->message[MESHROOM_TEXT_MAX] = '\0';
+    cmd->ts = time_us_64();
+    _commandRing.publish();
+
+    if (_commandWorker != NULL) {
+        xTaskNotifyGive(_commandWorker);
+    }
+
+    _cmdqStats.enqueued++;
+    depth = _commandRing.size();
+    if (depth > _cmdqStats.depth_max) {
+        _cmdqStats.depth_max = depth;
+    }
+}
+
+void MeshRoom::setCommandWorker(TaskHandle_t task)
+{
+    _commandWorker = task;
+    _events.unsubscribe(_workerEvents);
+    _workerEvents = _events.subscribe(task,
+                                      EVENT_MASK(EVENT_BUTTON) |
+                                      EVENT_MASK(EVENT_ENV));
+}
+
+/*
+ * Woken by a task notification for new commands, new IR requests and
+ * button and environment events from the bus; otherwise sleeps until the
+ * earlier of the next coalesced IR transmission and the next rules-engine
+ * deadline.
+ */
+void MeshRoom::runCommandWorker(void)
+{
+    struct mesh_command *cmd = NULL;
+    struct room_event event;
+    uint64_t t0, t1;
+    uint32_t wait_us, exec_us;
+    TickType_t wait;
+
+    wait = _irQueue.nextDeadline();
+    if (_rules.nextDeadline() < wait) {
+        wait = _rules.nextDeadline();
+    }
+    ulTaskNotifyTake(pdTRUE, wait);
+
+    if (_benchPending) {
+        serviceBench();
+    }
+
+    while ((cmd = _commandRing.front()) != NULL) {
+        t0 = time_us_64();
+        lockClient();
+        if (cmd->packet.decoded.portnum == MESHROOM_PROTO_PORT) {
+            handleBinary(cmd->packet);
+        } else {
+            _textPacket = &cmd->packet;
+            handleTextMessage(cmd->packet, string(cmd->message));
+            _textPacket = NULL;
+        }
+        unlockClient();
+        // The reply has been posted, nothing from the arena is live
+        _arena.release();
+        t1 = time_us_64();
+
+        wait_us = t0 - cmd->ts;
+        exec_us = t1 - t0;
+        _commandRing.pop();
+        _cmdqStats.processed++;
+        _cmdqStats.wait_us_total += wait_us;
+        if (wait_us > _cmdqStats.wait_us_max) {
+            _cmdqStats.wait_us_max = wait_us;
+        }
+        _cmdqStats.exec_us_total += exec_us;
+        if (exec_us > _cmdqStats.exec_us_max) {
+            _cmdqStats.exec_us_max = exec_us;
+        }
+    }
+
+    // Press duration in 0.1s units is the button input of the rules
+    while (_events.next(_workerEvents, event)) {
+        if (event.type == EVENT_BUTTON) {
+            _rules.update(RulesEngine::RULE_IN_BUTTON,
+                          event.u.button.tdur_ms / 100);
+        } else if (event.type == EVENT_ENV) {
+            if (event.u.env.valid & EVENT_ENV_TEMP) {
+                _rules.update(RulesEngine::RULE_IN_TEMP,
+                              event.u.env.temperature);
+            }
+            if (event.u.env.valid & EVENT_ENV_HUMIDITY) {
+                _rules.update(RulesEngine::RULE_IN_HUMIDITY,
+                              event.u.env.humidity);
+            }
+            if (event.u.env.valid & EVENT_ENV_PRESSURE) {
+                _rules.update(RulesEngine::RULE_IN_PRESSURE,
+                              event.u.env.pressure);
+            }
+        }
+    }
+    _rules.run();
+
+    runIrQueue();
+}
+
+/*
+ * Benchmarks run on the command worker itself, so they measure the real
+ * hot path (same task, stack and arena) and never race a live command.
+ */
+bool MeshRoom::runBench(enum CommandBench::Mode mode,
+                        unsigned int iterations, uint32_t seed,
+                        TickType_t timeout)
+{
+    if ((_commandWorker == NULL) || _benchPending ||
+        (iterations > BENCH_MAX_ITERATIONS)) {
+        return false;
+    }
+
+    _benchMode = mode;
+    _benchIterations = iterations;
+    _benchSeed = seed;
+    xSemaphoreTake(_benchDone, 0);
+    _benchPending = true;
+    xTaskNotifyGive(_commandWorker);
+
+    return xSemaphoreTake(_benchDone, timeout) == pdTRUE;
+}
+
+const struct command_bench_result &MeshRoom::benchResult(void) const
+{
+    return _bench.result();
+}
+
+string MeshRoom::bench_handler(string &message, void *arg)
+{
+    MeshRoom *meshroom = (MeshRoom *) arg;
+    string reply;
+
+    // There is no packet to authorize, so rule edits are refused too
+    meshroom->lockClient();
+    reply = meshroom->handleUnknown(0, message);
+    meshroom->unlockClient();
+    meshroom->_arena.release();
+
+    return reply;
+}
+
+void MeshRoom::serviceBench(void)
+{
+    /*
+     * Handlers act on a copy of the appliance state and drive no IR,
+     * buzzer or Morse output; other tasks keep using the real ones.
+     */
+    _benchAppliances = _appliances;
+    _dryRun = true;
+    _bench.run(_benchMode, _benchIterations, _benchSeed,
+               MeshRoom::bench_handler, this, &_arena);
+    _dryRun = false;
+
+    _benchPending = false;
+    xSemaphoreGive(_benchDone);
+}
+
+// Only the command worker runs the bench
+bool MeshRoom::benchCall(void) const
+{
+    return _dryRun && (xTaskGetCurrentTaskHandle() == _commandWorker);
+}
+
+struct MeshRoom::appliances &MeshRoom::appliances(void)
+{
+    return benchCall() ? _benchAppliances : _appliances;
+}
+
+const struct MeshRoom::appliances &MeshRoom::appliances(void) const
+{
+    return benchCall() ? _benchAppliances : _appliances;
+}
+
+struct reply_target {
+    MeshRoom *meshroom;
+    uint32_t dest;
+    uint8_t channel;
+};
+
+/*
+ * Replies produced by the command worker are framed into payload-sized
+ * chunks, posted to the outbound queue and written to the radio by
+ * meshtastic_task in processReplies().
+ */
+bool MeshRoom::textMessage(uint32_t dest, uint8_t channel,
+                           const string &message)
+{
+    struct reply_target target = {
+        .meshroom = this,
+        .dest = dest,
+        .channel = channel,
+    };
+    int compact;
+
+    taskENTER_CRITICAL();
+    compact = _compactPending;
+    _compactPending = -1;
+    taskEXIT_CRITICAL();
+    if (compact >= 0) {
+        _framer.setCompact(compact != 0);
+    }
+
+    return _framer.frame(message, MeshRoom::reply_chunk, &target) > 0;
+}
+
+bool MeshRoom::reply_chunk(const char *chunk,
+                           unsigned int index, unsigned int count,
+                           void *arg)
+{
+    struct reply_target *target = (struct reply_target *) arg;
+
+    return target->meshroom->postReply(target->dest, target->channel,
+                                       chunk, count > 1,
+                                       index * REPLY_FRAME_GAP_MS);
+}
+
+bool MeshRoom::postReply(uint32_t dest, uint8_t channel,
+                         const char *message, bool chunk, uint32_t delayMs)
+{
+    struct mesh_reply reply;
+    unsigned int depth = 0;
+    TickType_t wait = 0;
+
+    reply.dest = dest;
+    reply.channel = channel;
+    reply.portnum = meshtastic_PortNum_TEXT_MESSAGE_APP;
+    reply.chunk = chunk;
+    reply.delay_ms = delayMs;
+    if (strlen(message) > MESHROOM_TEXT_MAX) {
+        _cmdqStats.replies_truncated++;
+    }
+    strncpy(reply.message, message, MESHROOM_TEXT_MAX);
+    reply.message[MESHROOM_TEXT_MAX] = '\0';
+    reply.size = strlen(reply.message);
+    reply.ts = time_us_64();
+
+    // The worker may wait for meshtastic_task to drain the chunks ahead
+    // of it; meshtastic_task itself must never block on its own queue.
+    if (xTaskGetCurrentTaskHandle() == _commandWorker) {
+        wait = pdMS_TO_TICKS(MESHROOM_REPLY_WAIT_MS);
+    }
+
+    if (xQueueSend(_replyQueue, &reply, wait) != pdTRUE) {
+        _cmdqStats.replies_dropped++;
+        return false;
+    }
+
+    _cmdqStats.replies_queued++;
+    depth = uxQueueMessagesWaiting(_replyQueue);
+    if (depth > _cmdqStats.reply_depth_max) {
+        _cmdqStats.reply_depth_max = depth;
+    }
+
+    // Wake meshtastic_task
+    xSemaphoreGive(uart1_sem);
+
+    return true;
+}
+
+bool MeshRoom::postData(uint32_t dest, uint8_t channel,
+                        const void *buf, size_t size)
+{
+    struct mesh_reply reply;
+
+    if (size > MESHROOM_TEXT_MAX) {
+        _cmdqStats.replies_truncated++;
+        return false;
+    }
+
+    reply.dest = dest;
+    reply.channel = channel;
+    reply.portnum = MESHROOM_PROTO_PORT;
+    reply.size = size;
+    reply.chunk = false;
+    reply.delay_ms = 0;
+    memcpy(reply.message, buf, size);
+    reply.ts = time_us_64();
+
+    if (xQueueSend(_replyQueue, &reply, 0) != pdTRUE) {
+        _cmdqStats.replies_dropped++;
+        return false;
+    }
+
+    _cmdqStats.replies_queued++;
+    xSemaphoreGive(uart1_sem);
+
+    return true;
+}
+
+/*
+ * Moves posted replies into the transmit scheduler for as long as it has
+ * a free slot. Whatever does not fit stays in the reply queue, so that a
+ * worker posting more chunks waits in postReply() instead of losing them.
+ */
+void MeshRoom::scheduleReplies(void)
+{
+    struct mesh_reply reply;
+    uint32_t wait_us;
+    bool ok;
+
+    while ((_tx.full() == false) &&
+           (xQueueReceive(_replyQueue, &reply, 0) == pdTRUE)) {
+        wait_us = time_us_64() - reply.ts;
+        _cmdqStats.reply_wait_us_total += wait_us;
+        if (wait_us > _cmdqStats.reply_wait_us_max) {
+            _cmdqStats.reply_wait_us_max = wait_us;
+        }
+
+        if (reply.portnum == meshtastic_PortNum_TEXT_MESSAGE_APP) {
+            ok = _tx.submit(reply.dest, reply.channel, reply.message,
+                            reply.ts, !reply.chunk, reply.delay_ms);
+        } else {
+            ok = _tx.submitData(reply.dest, reply.channel, reply.portnum,
+                                (const uint8_t *) reply.message, reply.size,
+                                reply.ts);
+        }
+
+        if (ok) {
+            _cmdqStats.replies_scheduled++;
+        } else {
+            _cmdqStats.replies_rejected++;
+        }
+    }
+}
+
+/*
+ * Runs in meshtastic_task. Moves the posted replies into the transmit
+ * scheduler and writes whatever it releases to the radio.
+ */
+unsigned int MeshRoom::processReplies(void)
+{
+    unsigned int count = 0;
+    struct tx_item item;
+    unsigned int pct;
+    bool ok;
+
+    taskENTER_CRITICAL();
+    pct = _txDutyPending;
+    _txDutyPending = 0;
+    taskEXIT_CRITICAL();
+    if (pct != 0) {
+        _tx.setDutyCycle(pct);
+    }
+
+    scheduleReplies();
+
+    while (_tx.pop(item)) {
+        switch (item.kind) {
+        case TxScheduler::TX_REPLY:
+            ok = SimpleClient::textMessage(item.dest, item.channel,
+                                           string(item.text));
+            break;
+        case TxScheduler::TX_DATA:
+            ok = SimpleClient::dataMessage(item.dest, item.channel,
+                                           (meshtastic_PortNum) item.portnum,
+                                           (const uint8_t *) item.text,
+                                           item.size);
+            break;
+        case TxScheduler::TX_WANT_CONFIG:
+            ok = sendWantConfig();
+            if (ok == false) {
+                consoles_printf("sendWantConfig failed!\n");
+            } else if ((_configStartUs == 0) && (isConnected() == false)) {
+                _configStartUs = time_us_64();
+            }
+            break;
+        case TxScheduler::TX_HEARTBEAT:
+            ok = sendHeartbeat();
+            if (ok == false) {
+                consoles_printf("sendHeartbeat failed!\n");
+            }
+            break;
+        default:
+            ok = false;
+            break;
+        }
+
+        _tx.complete(item, ok);
+        count++;
+    }
+
+    // Slots freed above take replies that were held back
+    if (count > 0) {
+        scheduleReplies();
+    }
+
+    return count;
+}
+
+void MeshRoom::requestWantConfig(void)
+{
+    _tx.request(TxScheduler::TX_WANT_CONFIG);
+}
+
+/*
+ * The radio was just reset by the constructor; give it time to boot
+ * before its silence counts against the stored rate.
+ */
+void MeshRoom::startSerialLink(void)
+{
+    if (_main_body.serial1_baud != 0) {
+        _serial1.setBaud(_main_body.serial1_baud, SERIAL_LINK_BOOT_MS);
+    }
+}
+
+/*
+ * Called from the meshtastic task after draining serial1; applies a
+ * baud rate set from the shell, times the config download from the
+ * first want_config until connected and broadcasts the link statistics
+ * when asked to.
+ */
+void MeshRoom::pollSerialLink(void)
+{
+    struct mr_rsp rsp;
+    time_t now = time(NULL);
+    unsigned int baud;
+
+    taskENTER_CRITICAL();
+    baud = _serialBaudPending;
+    _serialBaudPending = 0;
+    taskEXIT_CRITICAL();
+    if ((baud != 0) && _serial1.setBaud(baud)) {
+        _configStartUs = 0;
+        requestWantConfig();
+    }
+
+    _serial0.poll();
+    _serial1.poll();
+    if (_serial1.rateChanged()) {
+        consoles_printf("serial1: %s %u baud\n",
+                        _serial1.onProbation() ? "retrying" : "fell back to",
+                        _serial1.baud());
+        _configStartUs = 0;
+        requestWantConfig();
+    }
+
+    if ((_configStartUs != 0) && isConnected()) {
+        _configMs = (time_us_64() - _configStartUs) / 1000;
+        _configStartUs = 0;
+    }
+
+    if ((_linkTelemetrySecs > 0) && isConnected() &&
+        ((now - _linkTelemetryLast) >= (time_t) _linkTelemetrySecs)) {
+        bzero(&rsp, sizeof(rsp));
+        rsp.hdr.version = MESHROOM_PROTO_VERSION;
+        rsp.hdr.op = MR_OP_LINK | MR_OP_RESPONSE;
+        rsp.status = MR_OK;
+        fillLink(rsp.u.link);
+        // Already on meshtastic_task, so skip the reply queue
+        if (_tx.submitData(0xffffffff, 0, MESHROOM_PROTO_PORT,
+                           (const uint8_t *) &rsp,
+                           sizeof(rsp.hdr) + sizeof(rsp.status) +
+                           sizeof(rsp.u.link), time_us_64())) {
+            _cmdqStats.replies_scheduled++;
+        } else {
+            _cmdqStats.replies_rejected++;
+        }
+        _linkTelemetryLast = now;
+    }
+}
+
+/*
+ * Guards the node, channel and roster state of SimpleClient, which
+ * meshtastic_task updates while decoding frames and the command worker
+ * reads while running handlers. Replies are only posted under it, and
+ * meshtastic_task drains them without it, so a worker waiting for reply
+ * queue space never holds up the task that frees it.
+ */
+bool MeshRoom::lockClient(TickType_t wait)
+{
+    return xSemaphoreTake(_clientLock, wait) == pdTRUE;
+}
+
+void MeshRoom::unlockClient(void)
+{
+    xSemaphoreGive(_clientLock);
+}
+
+void MeshRoom::setLinkTelemetry(unsigned int secs)
+{
+    _linkTelemetrySecs = secs;
+    _linkTelemetryLast = time(NULL);
+}
+
+unsigned int MeshRoom::linkTelemetry(void) const
+{
+    return _linkTelemetrySecs;
+}
+
+/*
+ * The UART is reprogrammed by meshtastic_task in pollSerialLink().
+ */
+bool MeshRoom::setSerialBaud(unsigned int baud)
+{
+    bool result = false;
+
+    if (SerialLink::isValidBaud(baud) == false) {
+        goto done;
+    }
+
+    _main_body.serial1_baud = baud;
+    saveNvm();
+    _serialBaudPending = baud;
+
+    result = true;
+
+done:
+
+    return result;
+}
+
+SerialLink &MeshRoom::serialLink(unsigned int index)
+{
+    return (index == 0) ? _serial0 : _serial1;
+}
+
+PacketFilter &MeshRoom::packetFilter(void)
+{
+    return _filter;
+}
+
+/*
+ * Runs in meshtastic_task, on the bytes read from serial1 before
+ * libmeshtastic decodes them. Only packets that the got* handlers would
+ * throw away anyway may be dropped here; the receive event is still
+ * published so the LED and subscribers see the traffic.
+ */
+bool MeshRoom::packet_drop(const struct packet_peek &peek, void *arg)
+{
+    MeshRoom *meshroom = (MeshRoom *) arg;
+    uint32_t me = meshroom->whoami();
+    struct room_event event;
+
+    // See gotTelemetry()
+    if ((me == 0) ||
+        (peek.portnum != meshtastic_PortNum_TELEMETRY_APP) ||
+        (peek.from == me)) {
+        return false;
     }
+
+    bzero(&event, sizeof(event));
+    event.type = EVENT_MESH_RX;
+    event.u.rx.from = peek.from;
+    event.u.rx.portnum = peek.portnum;
+    meshroom->_events.publish(event);
+    meshroom->_lastFiltered = time(NULL);
+
+    return true;
 }
 
-unsigned int MeshRoom::acTemp(void) const
+uint32_t MeshRoom::configDownloadMs(void) const
 {
-    return _acTemp;
+    return _configMs;
 }
 
-void MeshRoom::acFanSpeed(unsigned int speed)
+void MeshRoom::requestHeartbeat(void)
 {
-    if (speed <= 5) {
-        _acFanSpeed = speed;
-    }
+    _tx.request(TxScheduler::TX_HEARTBEAT);
 }
 
-unsigned int MeshRoom::acFanSpeed(void) const
+TickType_t MeshRoom::txNextDeadline(void)
 {
-    return _acFanSpeed;
+    return _tx.nextDeadline();
 }
 
-void MeshRoom::acFanDir(unsigned int dir)
+unsigned int MeshRoom::txPending(void) const
 {
-    if (dir <= 6) {
-        _acFanDir = dir;
-    }
+    return _tx.pending();
 }
 
-unsigned int MeshRoom::acFanDir(void) const
+/*
+ * The scheduler belongs to meshtastic_task; the new percentage is picked
+ * up by processReplies().
+ */
+void MeshRoom::setTxDutyCycle(unsigned int pct)
 {
-    return _acFanDir;
+    _txDutyPending = pct;
 }
 
-void MeshRoom::reset(void)
+unsigned int MeshRoom::txDutyCycle(void) const
 {
-    _resetCount++;
-
-    gpio_put(OUTRESET_PIN, false);
-    vTaskDelay(pdMS_TO_TICKS(500));
-    gpio_put(OUTRESET_PIN, true);
+    unsigned int pct = _txDutyPending;
 
-    _lastReset = time(NULL);
+    return (pct != 0) ? pct : _tx.dutyCycle();
 }
 
-unsigned int MeshRoom::getResetCount(void) const
+uint32_t MeshRoom::txBudgetMs(void) const
 {
-    return _resetCount;
+    return _tx.budgetMs();
 }
 
-time_t MeshRoom::getLastReset(void) const
+const struct tx_stats &MeshRoom::getTxStats(void) const
 {
-    return _lastReset;
+    return _tx.getStats();
 }
 
-unsigned int MeshRoom::getLastResetSecsAgo(void) const
+/*
+ * The framer belongs to the command worker; the new setting is picked
+ * up by textMessage().
+ */
+void MeshRoom::setReplyCompact(bool compact)
 {
-    time_t now;
+    _compactPending = compact ? 1 : 0;
+}
 
-    now = time(NULL);
+bool MeshRoom::replyCompact(void) const
+{
+    int compact = _compactPending;
 
-    return now - _lastReset;
+    return (compact >= 0) ? (compact != 0) : _framer.compact();
 }
 
-void MeshRoom::buzz(unsigned int ms)
+const struct reply_frame_stats &MeshRoom::getReplyFrameStats(void) const
 {
-    gpio_put(BUZZER_PIN, true);
-    vTaskDelay(pdMS_TO_TICKS(ms));
-    gpio_put(BUZZER_PIN, false);
+    return _framer.getStats();
 }
 
-void MeshRoom::buzzMorseCode(const string &text, bool clearPrevious)
+unsigned int MeshRoom::commandQueueDepth(void) const
 {
-    if (clearPrevious) {
-        this->clearMorseText();
-    }
-
-    this->addMorseText(text);
+    return _commandRing.size();
 }
 
-bool MeshRoom::isAlertLedOn(void) const
+unsigned int MeshRoom::replyQueueDepth(void) const
 {
-    return _alertLed;
+    return uxQueueMessagesWaiting(_replyQueue);
 }
 
-void MeshRoom::setAlertLed(bool onOff)
+const struct command_queue_stats &MeshRoom::getCommandQueueStats(void) const
 {
-    _alertLed = onOff;
-    gpio_put(ALERT_LED_PIN, onOff);
+    return _cmdqStats;
 }
 
-void MeshRoom::flipAlertLed(void)
+const struct message_arena_stats &MeshRoom::getArenaStats(void) const
 {
-    _alertLed = !_alertLed;
-    gpio_put(ALERT_LED_PIN, _alertLed);
+    return _arena.getStats();
 }
 
-void MeshRoom::flipOnboardLed(void)
+const RateLimiter &MeshRoom::rateLimiter(void) const
 {
-    PicoPlatform::get()->flipOnboardLed();
+    return _limiter;
 }
 
-float MeshRoom::getOnboardTempC(void) const
+const AuthIndex &MeshRoom::authIndex(void) const
 {
-    return PicoPlatform::get()->getOnboardTempC();
+    return _auth;
 }
 
-void MeshRoom::gotTextMessage(const meshtastic_MeshPacket &packet,
-                              const string &message)
+const struct dup_cache_stats &MeshRoom::getDupStats(void) const
 {
-    bool result = false;
-    SimpleClient::gotTextMessage(packet, message);
+    return _dups.getStats();
+}
 
-    result = handleTextMessage(packet, message);
-    if (result) {
-        return;
-    }
+const struct proto_stats &MeshRoom::getProtoStats(void) const
+{
+    return _protoStats;
 }
 
 void MeshRoom::gotTelemetry(const meshtastic_MeshPacket &packet,
                             const meshtastic_Telemetry &telemetry)
 {
+    struct room_event event;
+
     if (packet.from == whoami()) {
         SimpleClient::gotTelemetry(packet, telemetry);
+        if (telemetry.which_variant ==
+            meshtastic_Telemetry_environment_metrics_tag) {
+            memcpy(&_env, &telemetry.variant.environment_metrics,
+                   sizeof(_env));
+            _envTime = time(NULL);
+            bzero(&event, sizeof(event));
+            event.type = EVENT_ENV;
+            if (_env.has_temperature) {
+                event.u.env.valid |= EVENT_ENV_TEMP;
+                event.u.env.temperature = _env.temperature * 10.0f;
+            }
+            if (_env.has_relative_humidity) {
+                event.u.env.valid |= EVENT_ENV_HUMIDITY;
+                event.u.env.humidity = _env.relative_humidity * 10.0f;
+            }
+            if (_env.has_barometric_pressure) {
+                event.u.env.valid |= EVENT_ENV_PRESSURE;
+                event.u.env.pressure = _env.barometric_pressure * 10.0f;
+            }
+            _events.publish(event);
+        }
     } else {
         // Ignore telemetry from other nodes
     }
@@ -351,7 +1389,13 @@ void MeshRoom::gotTelemetry(const meshtastic_MeshPacket &packet,
 void MeshRoom::gotRouting(const meshtastic_MeshPacket &packet,
                           const meshtastic_Routing &routing)
 {
+    struct room_event event;
+
     SimpleClient::gotRouting(packet, routing);
+    event.type = EVENT_ROUTING;
+    event.u.route.from = packet.from;
+    event.u.route.hops = packet.hop_start - packet.hop_limit;
+    _events.publish(event);
     if ((routing.which_variant == meshtastic_Routing_error_reason_tag) &&
         (routing.error_reason == meshtastic_Routing_Error_NONE) &&
         (packet.from != packet.to)) {
@@ -364,7 +1408,13 @@ void MeshRoom::gotRouting(const meshtastic_MeshPacket &packet,
 void MeshRoom::gotTraceRoute(const meshtastic_MeshPacket &packet,
                              const meshtastic_RouteDiscovery &routeDiscovery)
 {
+    struct room_event event;
+
     SimpleClient::gotTraceRoute(packet, routeDiscovery);
+    event.type = EVENT_TRACEROUTE;
+    event.u.route.from = packet.from;
+    event.u.route.hops = routeDiscovery.route_count;
+    _events.publish(event);
     if ((routeDiscovery.route_count > 0) &&
         (routeDiscovery.route_back_count == 0)) {
         float rx_snr;
@@ -390,16 +1440,320 @@ void MeshRoom::gotTraceRoute(const meshtastic_MeshPacket &packet,
     }
 }
 
+/*
+ * Binary requests are accepted only as PKI-encrypted direct messages
+ * whose sender key matches an admin (or, unless adminOnly, a mate) from
+ * the lists HomeChat is configured with.
+ */
+bool MeshRoom::isAuthorized(const meshtastic_MeshPacket &packet,
+                            bool adminOnly)
+{
+    uint8_t roles = 0;
+
+    if ((packet.to != whoami()) || (packet.pki_encrypted == false) ||
+        (packet.public_key.size != 32)) {
+        return false;
+    }
+
+    roles = _auth.roles(packet.from, packet.public_key.bytes);
+
+    if (adminOnly) {
+        return (roles & AUTH_ROLE_ADMIN) != 0;
+    }
+
+    return (roles & (AUTH_ROLE_ADMIN | AUTH_ROLE_MATE)) != 0;
+}
+
+void MeshRoom::fillState(struct mr_state &state) const
+{
+    bzero(&state, sizeof(state));
+    if (tvOnOff()) {
+        state.flags |= MR_STATE_TV_POWER;
+    }
+    if (acOnOff()) {
+        state.flags |= MR_STATE_AC_POWER;
+    }
+    if (isAlertLedOn()) {
+        state.flags |= MR_STATE_ALERT_LED;
+    }
+    if (isMorsePlaying()) {
+        state.flags |= MR_STATE_MORSE;
+    }
+    state.tv_vol = tvVol();
+    state.tv_chan = tvChan();
+    state.ac_mode = acMode();
+    state.ac_temp = acTemp();
+    state.ac_fanspeed = acFanSpeed();
+    state.ac_fandir = acFanDir();
+    state.ir_pending = irPending();
+    state.board_temp = (int16_t) (getOnboardTempC() * 10.0f);
+    state.reset_count = getResetCount();
+    state.last_reset_secs = getLastResetSecsAgo();
+    state.uptime_secs = time_us_64() / 1000000;
+}
+
+void MeshRoom::fillEnv(struct mr_env &env) const
+{
+    bzero(&env, sizeof(env));
+    if (_envTime == 0) {
+        return;
+    }
+
+    if (_env.has_temperature) {
+        env.flags |= MR_ENV_TEMPERATURE;
+        env.temperature = (int16_t) (_env.temperature * 10.0f);
+    }
+    if (_env.has_relative_humidity) {
+        env.flags |= MR_ENV_HUMIDITY;
+        env.humidity = (uint16_t) (_env.relative_humidity * 10.0f);
+    }
+    if (_env.has_barometric_pressure) {
+        env.flags |= MR_ENV_PRESSURE;
+        env.pressure = (uint16_t) (_env.barometric_pressure * 10.0f);
+    }
+    env.age_secs = time(NULL) - _envTime;
+}
+
+/*
+ * Applies a state-changing binary-protocol request (TV, AC, BUZZ or
+ * RESET); shared by the binary protocol and the rules engine. Values are
+ * validated as a whole before anything is applied, so a rejected request
+ * changes nothing.
+ */
+uint8_t MeshRoom::applyRequest(uint8_t op, const uint8_t *body, size_t size)
+{
+    uint8_t status = MR_OK;
+    struct mr_tv_req tv;
+    struct mr_ac_req ac;
+    struct mr_buzz_req bz;
+
+    switch (op) {
+    case MR_OP_TV:
+        if (size != sizeof(tv)) {
+            status = MR_ERR_LENGTH;
+            break;
+        }
+        memcpy(&tv, body, sizeof(tv));
+        if (((tv.set & MR_TV_SET_VOL) && (tv.vol > 100)) ||
+            ((tv.set & MR_TV_SET_CHAN) && (tv.chan > 999))) {
+            status = MR_ERR_VALUE;
+            break;
+        }
+        if (tv.set & MR_TV_SET_POWER) {
+            tvOnOff(tv.power != 0);
+        }
+        if (tv.set & MR_TV_SET_VOL) {
+            tvVol(tv.vol);
+        }
+        if (tv.set & MR_TV_SET_CHAN) {
+            tvChan(tv.chan);
+        }
+        break;
+    case MR_OP_AC:
+        if (size != sizeof(ac)) {
+            status = MR_ERR_LENGTH;
+            break;
+        }
+        memcpy(&ac, body, sizeof(ac));
+        if (((ac.set & MR_AC_SET_MODE) && (ac.mode > AC_AUTO)) ||
+            ((ac.set & MR_AC_SET_TEMP) &&
+             ((ac.temp < 20) || (ac.temp > 30))) ||
+            ((ac.set & MR_AC_SET_FANSPEED) && (ac.fanspeed > 5)) ||
+            ((ac.set & MR_AC_SET_FANDIR) && (ac.fandir > 6))) {
+            status = MR_ERR_VALUE;
+            break;
+        }
+        // State first, so that a power-on frame carries the new state
+        if (ac.set & MR_AC_SET_MODE) {
+            acMode((enum AcMode) ac.mode);
+        }
+        if (ac.set & MR_AC_SET_TEMP) {
+            acTemp(ac.temp);
+        }
+        if (ac.set & MR_AC_SET_FANSPEED) {
+            acFanSpeed(ac.fanspeed);
+        }
+        if (ac.set & MR_AC_SET_FANDIR) {
+            acFanDir(ac.fandir);
+        }
+        if (ac.set & MR_AC_SET_POWER) {
+            acOnOff(ac.power != 0);
+        }
+        break;
+    case MR_OP_BUZZ:
+        if (size != sizeof(bz)) {
+            status = MR_ERR_LENGTH;
+            break;
+        }
+        memcpy(&bz, body, sizeof(bz));
+        if ((bz.ms == 0) || (bz.ms > 5000)) {
+            status = MR_ERR_VALUE;
+            break;
+        }
+        buzz(bz.ms);
+        break;
+    case MR_OP_RESET:
+        reset();
+        break;
+    default:
+        status = MR_ERR_OP;
+        break;
+    }
+
+    return status;
+}
+
+void MeshRoom::rule_action(const struct nvm_rule_entry &rule, void *arg)
+{
+    MeshRoom *meshroom = (MeshRoom *) arg;
+
+    meshroom->applyRequest(rule.op, rule.body,
+                           RulesEngine::bodySize(rule.op));
+}
+
+static inline uint16_t clamp16(uint32_t v)
+{
+    return (v > UINT16_MAX) ? UINT16_MAX : v;
+}
+
+void MeshRoom::fillLink(struct mr_link &link) const
+{
+    const SerialLink *links[2] = { &_serial0, &_serial1, };
+    const struct serial_link_stats *stats = NULL;
+
+    bzero(&link, sizeof(link));
+    for (unsigned int i = 0; i < 2; i++) {
+        stats = &links[i]->getStats();
+        link.uart[i].baud = links[i]->baud();
+        link.uart[i].rx_bytes = stats->rx.bytes;
+        link.uart[i].tx_bytes = stats->tx.bytes;
+        link.uart[i].rx_frames = stats->rx.frames;
+        link.uart[i].tx_frames = stats->tx.frames;
+        link.uart[i].rx_bps = stats->rx.bps;
+        link.uart[i].tx_bps = stats->tx.bps;
+        link.uart[i].line_errors = clamp16(stats->framing_errors +
+                                           stats->parity_errors +
+                                           stats->break_errors);
+        link.uart[i].overruns = clamp16(stats->overruns);
+        link.uart[i].tx_dropped = clamp16(stats->tx.dropped);
+        link.uart[i].ring_max = clamp16(stats->ring_max);
+    }
+
+    stats = &_serial1.getStats();
+    if (stats->process_calls > 0) {
+        link.process_us_avg = stats->process_us_total / stats->process_calls;
+    }
+    link.process_us_max = stats->process_us_max;
+}
+
+/*
+ * Runs on the command worker.
+ */
+void MeshRoom::handleBinary(const meshtastic_MeshPacket &packet)
+{
+    const uint8_t *buf = packet.decoded.payload.bytes;
+    size_t size = packet.decoded.payload.size;
+    struct mr_hdr hdr;
+    struct mr_rsp rsp;
+    size_t rsp_size = sizeof(rsp.hdr) + sizeof(rsp.status) +
+        sizeof(rsp.u.state);
+
+    if (size < sizeof(hdr)) {
+        _protoStats.errors++;
+        return;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    _protoStats.requests++;
+    if (isAuthorized(packet, hdr.op == MR_OP_RESET) == false) {
+        _protoStats.denied++;
+        return;
+    }
+
+    bzero(&rsp, sizeof(rsp));
+    rsp.hdr.version = MESHROOM_PROTO_VERSION;
+    rsp.hdr.op = hdr.op | MR_OP_RESPONSE;
+    rsp.hdr.seq = hdr.seq;
+    rsp.status = MR_OK;
+
+    if (hdr.version != MESHROOM_PROTO_VERSION) {
+        rsp.status = MR_ERR_VERSION;
+        goto done;
+    }
+
+    switch (hdr.op) {
+    case MR_OP_STATUS:
+        break;
+    case MR_OP_ENV:
+        fillEnv(rsp.u.env);
+        rsp_size = sizeof(rsp.hdr) + sizeof(rsp.status) + sizeof(rsp.u.env);
+        goto done;
+    case MR_OP_LINK:
+        fillLink(rsp.u.link);
+        rsp_size = sizeof(rsp.hdr) + sizeof(rsp.status) + sizeof(rsp.u.link);
+        goto done;
+    default:
+        rsp.status = applyRequest(hdr.op, buf + sizeof(hdr),
+                                  size - sizeof(hdr));
+        break;
+    }
+
+    fillState(rsp.u.state);
+
+done:
+
+    if (rsp.status != MR_OK) {
+        _protoStats.errors++;
+    }
+
+    if (postData(packet.from, packet.channel, &rsp, rsp_size)) {
+        _protoStats.responses++;
+    }
+}
+
+/*
+ * Copies the next whitespace-delimited word of s, starting at pos, into
+ * word in lowercase and advances pos past it.
+ */
+static bool next_word(const string &s, size_t &pos, pmr::string &word)
+{
+    size_t end;
+
+    word.clear();
+    pos = s.find_first_not_of(" \t\r\n", pos);
+    if (pos == string::npos) {
+        pos = s.size();
+        return false;
+    }
+
+    end = s.find_first_of(" \t\r\n", pos);
+    if (end == string::npos) {
+        end = s.size();
+    }
+
+    for (; pos < end; pos++) {
+        word.push_back(tolower((unsigned char) s[pos]));
+    }
+
+    return true;
+}
+
+static void append_uint(pmr::string &s, unsigned int value)
+{
+    char buf[12];
+
+    snprintf(buf, sizeof(buf), "%u", value);
+    s.append(buf);
+}
+
 string MeshRoom::handleUnknown(uint32_t node_num, string &message)
 {
     string reply;
-    string first_word;
-
-    (void)(node_num);
+    pmr::string first_word(&_arena);
+    size_t pos = 0;
 
-    first_word = message.substr(0, message.find(' '));
-    toLowercase(first_word);
-    message = message.substr(first_word.size());
+    next_word(message, pos, first_word);
+    message.erase(0, pos);
     trimWhitespace(message);
 
     if (first_word == "tv") {
@@ -412,6 +1766,8 @@ string MeshRoom::handleUnknown(uint32_t node_num, string &message)
         reply = handleBuzz(node_num, message);
     } else if (first_word == "morse") {
         reply = handleMorse(node_num, message);
+    } else if (first_word == "rule") {
+        reply = handleRule(node_num, message);
     }
 
     return reply;
@@ -444,24 +1800,156 @@ string MeshRoom::handleEnv(uint32_t node_num, string &message)
     return ss.str();
 }
 
+static bool parse_uint(const pmr::string &s, unsigned int &value)
+{
+    char *end = NULL;
+    unsigned long v;
+
+    if (s.empty()) {
+        return false;
+    }
+
+    v = strtoul(s.c_str(), &end, 10);
+    if ((end == NULL) || (*end != '\0')) {
+        return false;
+    }
+
+    value = v;
+
+    return true;
+}
+
+/*
+ * Applies "up", "down" or an absolute number to a setting; returns false
+ * on a syntax error.
+ */
+static bool parse_adjust(const pmr::string &arg, unsigned int current,
+                         unsigned int &value)
+{
+    if (arg == "up") {
+        value = current + 1;
+    } else if (arg == "down") {
+        value = (current > 0) ? current - 1 : 0;
+    } else if (parse_uint(arg, value) == false) {
+        return false;
+    }
+
+    return true;
+}
+
 string MeshRoom::handleTv(uint32_t node_num, string &message)
 {
-    string reply;
+    pmr::string reply(&_arena);
+    pmr::string cmd(&_arena), arg(&_arena);
+    size_t pos = 0;
+    unsigned int value = 0;
 
     (void)(node_num);
-    (void)(message);
 
-    return reply;
+    next_word(message, pos, cmd);
+    next_word(message, pos, arg);
+
+    if (cmd.empty()) {
+        reply.append("tv: ");
+        reply.append(tvOnOff() ? "on" : "off");
+        if (tvOnOff()) {
+            reply.push_back('\n');
+            reply.append("vol: ");
+            append_uint(reply, tvVol());
+            reply.push_back('\n');
+            reply.append("chan: ");
+            append_uint(reply, tvChan());
+        }
+    } else if ((cmd == "on") && arg.empty()) {
+        tvOnOff(true);
+        reply.append("turn tv on");
+    } else if ((cmd == "off") && arg.empty()) {
+        tvOnOff(false);
+        reply.append("turn tv off");
+    } else if ((cmd == "vol") && parse_adjust(arg, tvVol(), value)) {
+        tvVol(value);
+        reply.append("set tv vol to ");
+        append_uint(reply, tvVol());
+    } else if ((cmd == "chan") && parse_adjust(arg, tvChan(), value)) {
+        tvChan(value);
+        reply.append("set tv chan to ");
+        append_uint(reply, tvChan());
+    } else {
+        reply.append("syntax error!");
+    }
+
+    return string(reply.data(), reply.size());
 }
 
 string MeshRoom::handleAc(uint32_t node_num, string &message)
 {
-    string reply;
+    pmr::string reply(&_arena);
+    pmr::string cmd(&_arena), arg(&_arena);
+    size_t pos = 0;
+    unsigned int value = 0;
 
     (void)(node_num);
-    (void)(message);
 
-    return reply;
+    next_word(message, pos, cmd);
+    next_word(message, pos, arg);
+
+    if (cmd.empty()) {
+        reply.append("ac: ");
+        reply.append(acOnOff() ? "on" : "off");
+        reply.push_back('\n');
+        reply.append("mode: ");
+        reply.append(acModeStr());
+        if (acOnOff()) {
+            reply.push_back('\n');
+            reply.append("temp: ");
+            append_uint(reply, acTemp());
+            reply.push_back('\n');
+            reply.append("fanspeed: ");
+            append_uint(reply, acFanSpeed());
+            reply.push_back('\n');
+            reply.append("fandir: ");
+            append_uint(reply, acFanDir());
+        }
+    } else if ((cmd == "on") && arg.empty()) {
+        acOnOff(true);
+        reply.append("turn ac on");
+    } else if ((cmd == "off") && arg.empty()) {
+        acOnOff(false);
+        reply.append("turn ac off");
+    } else if ((cmd == "mode") && (arg == "ac")) {
+        acMode(AC_AC);
+        reply.append("set mode to ");
+        reply.append(acModeStr());
+    } else if ((cmd == "mode") && (arg == "heater")) {
+        acMode(AC_HEATER);
+        reply.append("set mode to ");
+        reply.append(acModeStr());
+    } else if ((cmd == "mode") && (arg == "dehumidifier")) {
+        acMode(AC_DEHUMIDIFIER);
+        reply.append("set mode to ");
+        reply.append(acModeStr());
+    } else if ((cmd == "mode") && (arg == "auto")) {
+        acMode(AC_AUTO);
+        reply.append("set mode to ");
+        reply.append(acModeStr());
+    } else if ((cmd == "temp") && parse_adjust(arg, acTemp(), value)) {
+        acTemp(value);
+        reply.append("set temp to ");
+        append_uint(reply, acTemp());
+    } else if ((cmd == "fanspeed") &&
+               parse_adjust(arg, acFanSpeed(), value)) {
+        acFanSpeed(value);
+        reply.append("set fanspeed to ");
+        append_uint(reply, acFanSpeed());
+    } else if ((cmd == "fandir") && parse_adjust(arg, acFanDir(), value)) {
+        acFanDir(value);
+        reply.append("set fandir to ");
+        append_uint(reply, acFanDir());
+    } else {
+        reply.append("syntax error!");
+    }
+
+    return string(reply.data(), reply.size());
 }
 
 string MeshRoom::handleReset(uint32_t node_num, string &message)
@@ -493,12 +1981,112 @@ string MeshRoom::handleMorse(uint32_t node_num, string &message)
     (void)(node_num);
     (void)(message);
 
-    addMorseText(message);
+    buzzMorseCode(message);
     reply = "buzzing morse code: '" + message + "'";
 
     return reply;
 }
 
+string MeshRoom::handleRule(uint32_t node_num, string &message)
+{
+    string reply;
+
+    /*
+     * Rules act on the room unattended, so only admins may edit them,
+     * and only from a PKI direct message signed with the admin's key:
+     * the node number alone can be spoofed on an auth channel.
+     */
+    if ((_textPacket == NULL) || (_textPacket->from != node_num) ||
+        (isAuthorized(*_textPacket, true) == false)) {
+        reply = "not authorized!";
+        goto done;
+    }
+
+    reply = ruleCommand(message);
+
+done:
+
+    return reply;
+}
+
+string MeshRoom::ruleCommand(const string &args)
+{
+    string reply;
+    string cmd, arg;
+    size_t pos;
+    unsigned int index = 0;
+    struct nvm_rule_entry rule;
+    char buf[64];
+    int ret;
+
+    pos = args.find(' ');
+    cmd = args.substr(0, pos);
+    if (pos != string::npos) {
+        arg = args.substr(pos + 1);
+        trimWhitespace(arg);
+    }
+    if (((cmd == "del") || (cmd == "enable") || (cmd == "disable")) &&
+        ((sscanf(arg.c_str(), "%u", &index) != 1) ||
+         (index >= _rules.count()))) {
+        reply = "no such rule!";
+        goto done;
+    }
+
+    if ((cmd == "") || (cmd == "list")) {
+        if (_rules.count() == 0) {
+            reply = "no rules";
+            goto done;
+        }
+        for (unsigned int i = 0; i < _rules.count(); i++) {
+            const struct rule_stats &stats = _rules.stats(i);
+
+            if (i > 0) {
+                reply += "\n";
+            }
+            snprintf(buf, sizeof(buf), "#%u ", i);
+            reply += buf;
+            reply += RulesEngine::format(_rules.rule(i));
+            snprintf(buf, sizeof(buf), " [%u/%u %uus/%uus]",
+                     stats.evals, stats.fires,
+                     stats.evals ?
+                     (unsigned int) (stats.eval_us_total / stats.evals) : 0,
+                     (unsigned int) stats.eval_us_max);
+            reply += buf;
+        }
+        goto done;
+    } else if (cmd == "add") {
+        if (RulesEngine::parse(arg, rule) == false) {
+            reply = "syntax error!";
+            goto done;
+        }
+        ret = _rules.add(rule);
+        if (ret < 0) {
+            reply = "rule table full!";
+            goto done;
+        }
+        snprintf(buf, sizeof(buf), "#%d ", ret);
+        reply = buf + RulesEngine::format(rule);
+    } else if (cmd == "del") {
+        _rules.remove(index);
+        reply = "deleted";
+    } else if ((cmd == "enable") || (cmd == "disable")) {
+        _rules.enable(index, cmd == "enable");
+        reply = cmd + "d";
+    } else if (cmd == "clear") {
+        _rules.clear();
+        reply = "cleared";
+    } else {
+        reply = "syntax error!";
+        goto done;
+    }
+
+    saveNvm();
+
+done:
+
+    return reply;
+}
+
 int MeshRoom::vprintf(const char *format, va_list ap) const
 {
     return consoles_vprintf(format, ap);
@@ -513,14 +2101,22 @@ bool MeshRoom::loadNvm(void)
     size_t size = 0;
     const struct nvm_header *header = NULL;
     const struct nvm_main_body *main_body = NULL;
+    size_t main_body_size = sizeof(struct nvm_main_body);
+    struct nvm_main_body body;
     const struct nvm_authchan_entry *authchans = NULL;
     const struct nvm_admin_entry *admins = NULL;
     const struct nvm_mate_entry *mates = NULL;
+    const struct nvm_rule_entry *rules = NULL;
     const struct nvm_footer *footer = NULL;
     unsigned int i;
 
     header = (const struct nvm_header *) (XIP_BASE + FLASH_TARGET_OFFSET);
-    if (header->magic != NVM_HEADER_MAGIC) {
+    if (header->magic == NVM_HEADER_MAGIC_V1) {
+        // Written before rules were added; load it without any
+        main_body_size = NVM_MAIN_BODY_V1_SIZE;
+    } else if (header->magic == NVM_HEADER_MAGIC_V2) {
+        main_body_size = NVM_MAIN_BODY_V2_SIZE;
+    } else if (header->magic != NVM_HEADER_MAGIC) {
         consoles_printf("Wrong header magic!\n");
         result = false;
         goto done;
@@ -528,12 +2124,15 @@ bool MeshRoom::loadNvm(void)
 
     main_body = (const struct nvm_main_body *)
         (((const uint8_t *) header) + sizeof(*header));
+    bzero(&body, sizeof(body));
+    memcpy(&body, main_body, main_body_size);
     size =
         sizeof(struct nvm_header) +
-        sizeof(struct nvm_main_body) +
-        (main_body->n_authchans * sizeof(struct nvm_authchan_entry)) +
-        (main_body->n_admins * sizeof(struct nvm_admin_entry)) +
-        (main_body->n_mates * sizeof(struct nvm_mate_entry)) +
+        main_body_size +
+        (body.n_authchans * sizeof(struct nvm_authchan_entry)) +
+        (body.n_admins * sizeof(struct nvm_admin_entry)) +
+        (body.n_mates * sizeof(struct nvm_mate_entry)) +
+        (body.n_rules * sizeof(struct nvm_rule_entry)) +
         sizeof(struct nvm_footer);
     if (size > FLASH_TARGET_SIZE) {
         consoles_printf("Too big size=%zu!\n", size);
@@ -541,34 +2140,43 @@ bool MeshRoom::loadNvm(void)
         goto done;
     }
     authchans = (const struct nvm_authchan_entry *)
-        (((uint8_t *) main_body) + sizeof(*main_body));
+        (((uint8_t *) main_body) + main_body_size);
     admins = (const struct nvm_admin_entry *)
         (((uint8_t *) authchans) +
-         (sizeof(struct nvm_authchan_entry) * main_body->n_authchans));
+         (sizeof(struct nvm_authchan_entry) * body.n_authchans));
     mates = (const struct nvm_mate_entry *)
         (((uint8_t *) admins) +
-         (sizeof(struct nvm_admin_entry) * main_body->n_admins));
-    footer = (const struct nvm_footer *)
+         (sizeof(struct nvm_admin_entry) * body.n_admins));
+    rules = (const struct nvm_rule_entry *)
         (((uint8_t *) mates) +
-         (sizeof(struct nvm_mate_entry) * main_body->n_mates));
+         (sizeof(struct nvm_mate_entry) * body.n_mates));
+    footer = (const struct nvm_footer *)
+        (((uint8_t *) rules) +
+         (sizeof(struct nvm_rule_entry) * body.n_rules));
     if (footer->magic != NVM_FOOTER_MAGIC) {
         consoles_printf("Wrong footer magic!\n");
         result = false;
         goto done;
     }
-    memcpy(&_main_body, main_body, sizeof(struct nvm_main_body));
+    memcpy(&_main_body, &body, sizeof(struct nvm_main_body));
     _nvm_authchans.clear();
-    for (i = 0; i < main_body->n_authchans; i++) {
+    for (i = 0; i < body.n_authchans; i++) {
         _nvm_authchans.push_back(authchans[i]);
     }
     _nvm_admins.clear();
-    for (i = 0; i < main_body->n_admins; i++) {
+    for (i = 0; i < body.n_admins; i++) {
         _nvm_admins.push_back(admins[i]);
     }
     _nvm_mates.clear();
-    for (i = 0; i < main_body->n_mates; i++) {
+    for (i = 0; i < body.n_mates; i++) {
         _nvm_mates.push_back(mates[i]);
     }
+    _rules.clear();
+    for (i = 0; i < body.n_rules; i++) {
+        if (_rules.add(rules[i]) < 0) {
+            consoles_printf("Skipped invalid rule #%u!\n", i);
+        }
+    }
 
     result = true;
 
@@ -600,13 +2208,21 @@ bool MeshRoom::saveNvm(void)
     struct nvm_authchan_entry *authchans = NULL;
     struct nvm_admin_entry *admins = NULL;
     struct nvm_mate_entry *mates = NULL;
+    struct nvm_rule_entry *rules = NULL;
     struct nvm_footer *footer = NULL;
     unsigned int i;
     struct nvm_write_params params;
 
+    // Both the shell and the command worker (rule edits) save
+    xSemaphoreTake(_nvmLock, portMAX_DELAY);
+
+    // The shell edits the rosters in place and saves them
+    _auth.rebuild(nvmAdmins(), nvmMates());
+
     _main_body.n_authchans = nvmAuthchans().size();
     _main_body.n_admins = nvmAdmins().size();
     _main_body.n_mates = nvmMates().size();
+    _main_body.n_rules = _rules.count();
 
     size =
         sizeof(struct nvm_header) +
@@ -614,6 +2230,7 @@ bool MeshRoom::saveNvm(void)
         (sizeof(struct nvm_authchan_entry) * _main_body.n_authchans) +
         (sizeof(struct nvm_admin_entry) * _main_body.n_admins) +
         (sizeof(struct nvm_mate_entry) * _main_body.n_mates) +
+        (sizeof(struct nvm_rule_entry) * _main_body.n_rules) +
         sizeof(struct nvm_footer);
 
     buf = (uint8_t *) pvPortMalloc(size);
@@ -649,9 +2266,15 @@ bool MeshRoom::saveNvm(void)
         memcpy(&mates[i], &nvmMates()[i],
                sizeof(struct nvm_mate_entry));
     }
-    footer = (struct nvm_footer *)
+    rules = (struct nvm_rule_entry *)
         (((uint8_t *) mates) +
          (sizeof(struct nvm_mate_entry) * _main_body.n_mates));
+    for (i = 0; i < _main_body.n_rules; i++) {
+        memcpy(&rules[i], &_rules.rule(i), sizeof(struct nvm_rule_entry));
+    }
+    footer = (struct nvm_footer *)
+        (((uint8_t *) rules) +
+         (sizeof(struct nvm_rule_entry) * _main_body.n_rules));
     footer->magic = NVM_FOOTER_MAGIC;
     footer->crc32 = 0;
 
@@ -669,6 +2292,8 @@ done:
         vPortFree(buf);
     }
 
+    xSemaphoreGive(_nvmLock);
+
     return result;
 }
 
@@ -677,6 +2302,7 @@ bool MeshRoom::applyNvmToHomeChat(void)
     bool result = true;
 
 
+    _auth.rebuild(nvmAdmins(), nvmMates());
     clearAuthchansAdminsMates();
 
     for (vector<struct nvm_authchan_entry>::const_iterator it =
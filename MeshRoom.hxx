@@ -7,13 +7,32 @@
 #ifndef MESHROOM_HXX
 #define MESHROOM_HXX
 
+#include <stddef.h>
 #include <FreeRTOS.h>
 #include <semphr.h>
+#include <queue.h>
 #include <vector>
 #include <SimpleClient.hxx>
 #include <HomeChat.hxx>
 #include <BaseNvm.hxx>
 #include <MorseBuzzer.hxx>
+#include <MorsePlayer.hxx>
+#include <ActuatorScheduler.hxx>
+#include <IrQueue.hxx>
+#include <MessageArena.hxx>
+#include <SpscRing.hxx>
+#include <TxScheduler.hxx>
+#include <ReplyFramer.hxx>
+#include <meshroom_proto.h>
+#include <RulesEngine.hxx>
+#include <AdcSampler.hxx>
+#include <ButtonCapture.hxx>
+#include <EventBus.hxx>
+#include <CommandBench.hxx>
+#include <SerialLink.hxx>
+#include <DupCache.hxx>
+#include <RateLimiter.hxx>
+#include <AuthIndex.hxx>
 
 #define PUSHBUTTON_PIN   13
 #define OUTRESET_PIN     14
@@ -21,13 +40,15 @@
 #define IR_BLAST_PIN     17
 #define ALERT_LED_PIN    16
 
-#define PUSHBUTTON_DURATION_THRESHOLD_US 1500000
+#define OUTRESET_PULSE_MS                500
 
 using namespace std;
 
 struct nvm_header {
     uint32_t magic;
-#define NVM_HEADER_MAGIC 0x6a87f421
+#define NVM_HEADER_MAGIC     0x6a87f423
+#define NVM_HEADER_MAGIC_V2  0x6a87f422  // no serial1 baud rate
+#define NVM_HEADER_MAGIC_V1  0x6a87f421  // no rules
 } __attribute__((packed));
 
 struct nvm_main_body {
@@ -39,8 +60,13 @@ struct nvm_main_body {
     uint32_t n_authchans;
     uint32_t n_admins;
     uint32_t n_mates;
+    uint32_t n_rules;
+    uint32_t serial1_baud;               // 0 for the default
 } __attribute__((packed));
 
+#define NVM_MAIN_BODY_V1_SIZE  offsetof(struct nvm_main_body, n_rules)
+#define NVM_MAIN_BODY_V2_SIZE  offsetof(struct nvm_main_body, serial1_baud)
+
 struct nvm_footer {
     uint32_t magic;
 #define NVM_FOOTER_MAGIC 0xe8148afd
@@ -48,9 +74,55 @@ struct nvm_footer {
 } __attribute__((packed));
 
 
-struct button_event {
+#define MESHROOM_COMMAND_QUEUE_DEPTH 8
+#define MESHROOM_REPLY_QUEUE_DEPTH   8
+#define MESHROOM_REPLY_WAIT_MS       3000
+#define MESHROOM_TEXT_MAX            meshtastic_Constants_DATA_PAYLOAD_LEN
+
+struct mesh_command {
+    meshtastic_MeshPacket packet;
+    char message[MESHROOM_TEXT_MAX + 1];
+    uint64_t ts;
+};
+
+struct mesh_reply {
+    uint32_t dest;
+    uint8_t channel;
+    uint16_t portnum;
+    uint16_t size;
+    bool chunk;
+    uint32_t delay_ms;
+    char message[MESHROOM_TEXT_MAX + 1];
     uint64_t ts;
-    uint64_t tdur;
+};
+
+// Each field has a single writer: meshtastic_task (M) or the worker (W)
+struct command_queue_stats {
+    unsigned int enqueued;               // M
+    unsigned int dropped;                // M
+    unsigned int truncated;              // M
+    unsigned int rate_limited;           // M
+    unsigned int processed;              // W
+    unsigned int depth_max;              // M
+    uint64_t wait_us_total;              // W
+    uint32_t wait_us_max;                // W
+    uint64_t exec_us_total;              // W
+    uint32_t exec_us_max;                // W
+    unsigned int replies_queued;         // W
+    unsigned int replies_dropped;        // W
+    unsigned int replies_truncated;      // W
+    unsigned int replies_scheduled;      // M
+    unsigned int replies_rejected;       // M
+    unsigned int reply_depth_max;        // W
+    uint64_t reply_wait_us_total;        // M
+    uint32_t reply_wait_us_max;          // M
+};
+
+struct proto_stats {
+    unsigned int requests;
+    unsigned int responses;
+    unsigned int denied;
+    unsigned int errors;
 };
 
 /*
@@ -79,7 +151,14 @@ public:
         AC_AUTO,
     };
 
-    bool getButtonEvent(struct button_event &event, bool clearOld = false);
+    void setButtonTask(TaskHandle_t task);
+    void runButton(void);
+    const ButtonCapture &buttonCapture(void) const;
+    EventBus &events(void);
+
+    bool runBench(enum CommandBench::Mode mode, unsigned int iterations,
+                  uint32_t seed, TickType_t timeout);
+    const struct command_bench_result &benchResult(void) const;
 
     void acOnOff(bool onOff);
     bool acOnOff(void) const;
@@ -92,27 +171,81 @@ public:
     unsigned int acFanSpeed(void) const;
     void acFanDir(unsigned int dir);
     unsigned int acFanDir(void) const;
+    uint32_t acStateFrame(void) const;
+
+    unsigned int irPending(void) const;
+    const struct ir_queue_stats &getIrQueueStats(void) const;
 
-    void reset(void);
+    void reset(actuator_done_t done = NULL, void *arg = NULL);
     unsigned int getResetCount(void) const;
     time_t getLastReset(void) const;
     unsigned int getLastResetSecsAgo(void) const;
+    unsigned int radioIdleSecs(void) const;
 
-    void buzz(unsigned int ms = 500);
+    void buzz(unsigned int ms = 500,
+              actuator_done_t done = NULL, void *arg = NULL);
     void buzzMorseCode(const string &text, bool clearPrevious = false);
+    bool isMorsePlaying(void) const;
 
     bool isAlertLedOn(void) const;
     void setAlertLed(bool onOff);
     void flipAlertLed(void);
+    void blinkAlertLed(unsigned int count,
+                       unsigned int onMs = 100, unsigned int offMs = 100,
+                       actuator_done_t done = NULL, void *arg = NULL);
 
     void flipOnboardLed(void);
 
     float getOnboardTempC(void) const;
+    AdcSampler &adcSampler(void);
+
+    void setCommandWorker(TaskHandle_t task);
+    void runCommandWorker(void);
+    unsigned int processReplies(void);
+    void requestWantConfig(void);
+    void requestHeartbeat(void);
+    TickType_t txNextDeadline(void);
+    unsigned int txPending(void) const;
+    void setTxDutyCycle(unsigned int pct);
+    unsigned int txDutyCycle(void) const;
+    uint32_t txBudgetMs(void) const;
+    const struct tx_stats &getTxStats(void) const;
+    void setReplyCompact(bool compact);
+    bool replyCompact(void) const;
+    const struct reply_frame_stats &getReplyFrameStats(void) const;
+    unsigned int commandQueueDepth(void) const;
+    unsigned int replyQueueDepth(void) const;
+    const struct command_queue_stats &getCommandQueueStats(void) const;
+    const struct message_arena_stats &getArenaStats(void) const;
+    const struct proto_stats &getProtoStats(void) const;
+    const struct dup_cache_stats &getDupStats(void) const;
+    const RateLimiter &rateLimiter(void) const;
+    const AuthIndex &authIndex(void) const;
+
+    bool lockClient(TickType_t wait = portMAX_DELAY);
+    void unlockClient(void);
+
+    void startSerialLink(void);
+    void pollSerialLink(void);
+    bool setSerialBaud(unsigned int baud);
+    SerialLink &serialLink(unsigned int index = 1);
+    PacketFilter &packetFilter(void);
+    uint32_t configDownloadMs(void) const;
+    void setLinkTelemetry(unsigned int secs);
+    unsigned int linkTelemetry(void) const;
+
+    string ruleCommand(const string &args);
+
+    // Extend SimpleClient
+
+    virtual bool textMessage(uint32_t dest, uint8_t channel,
+                             const string &message);
 
 protected:
 
     // Extend SimpleClient
 
+    virtual void gotPacket(const meshtastic_MeshPacket &packet);
     virtual void gotTextMessage(const meshtastic_MeshPacket &packet,
                                 const string &message);
     virtual void gotTelemetry(const meshtastic_MeshPacket &packet,
@@ -131,11 +264,16 @@ protected:
     virtual string handleStatus(uint32_t node_num, string &message);
     virtual string handleTv(uint32_t node_num, string &message);
     virtual string handleAc(uint32_t node_num, string &message);
+    virtual string handleRule(uint32_t node_num, string &message);
     virtual string handleReset(uint32_t node_num, string &message);
     virtual string handleBuzz(uint32_t node_num, string &message);
     virtual string handleMorse(uint32_t node_num, string &message);
     virtual int vprintf(const char *format, va_list ap) const;
 
+protected:
+
+    virtual bool irTransmit(enum IrQueue::Kind kind, uint32_t value);
+
 public:
 
     // Extend BaseNVM
@@ -161,22 +299,122 @@ protected:
 
 private:
 
+    struct appliances {
+        bool tvOnOff;
+        unsigned int tvVol;
+        unsigned int tvChan;
+        bool acOnOff;
+        AcMode acMode;
+        unsigned int acTemp;
+        unsigned int acFanSpeed;
+        unsigned int acFanDir;
+    };
+
     static void gpio_callback(uint gpio, uint32_t events);
+    static void button_gesture(enum ButtonGesture gesture, uint64_t tdur,
+                               void *arg);
+    static void morse_done(void *arg);
+    static bool packet_drop(const struct packet_peek &peek, void *arg);
+    static bool reply_chunk(const char *chunk,
+                            unsigned int index, unsigned int count,
+                            void *arg);
+
+    bool postReply(uint32_t dest, uint8_t channel, const char *message,
+                   bool chunk, uint32_t delayMs);
+    bool postData(uint32_t dest, uint8_t channel,
+                  const void *buf, size_t size);
+    void scheduleReplies(void);
+    void queueCommand(const meshtastic_MeshPacket &packet,
+                      const string &message);
+    static enum RateLimiter::Class commandClass(
+        const meshtastic_MeshPacket &packet, const string &message);
+
+    bool isAuthorized(const meshtastic_MeshPacket &packet,
+                      bool adminOnly);
+    void handleBinary(const meshtastic_MeshPacket &packet);
+    uint8_t applyRequest(uint8_t op, const uint8_t *body, size_t size);
+    void fillState(struct mr_state &state) const;
+    void fillEnv(struct mr_env &env) const;
+    void fillLink(struct mr_link &link) const;
+    static void rule_action(const struct nvm_rule_entry &rule, void *arg);
+
+    static string bench_handler(string &message, void *arg);
+    void serviceBench(void);
+    bool benchCall(void) const;
+    struct appliances &appliances(void);
+    const struct appliances &appliances(void) const;
+
+    void queueIr(enum IrQueue::Kind kind, uint32_t value);
+    void runIrQueue(void);
 
     struct nvm_main_body _main_body;
 
-    vector<struct button_event> _buttonEvents;
-    bool _tvOnOff;
-    unsigned int _tvVol;
-    unsigned int _tvChan;
-    bool _acOnOff;
-    AcMode _acMode;
-    unsigned int _acTemp;
-    unsigned int _acFanSpeed;
-    unsigned int _acFanDir;
+    struct appliances _appliances;
+    struct appliances _benchAppliances; // What bench commands act on
     unsigned int _resetCount;
     time_t _lastReset;
     bool _alertLed;
+    TaskHandle_t _commandWorker;
+    int _workerEvents;
+    const meshtastic_MeshPacket *_textPacket; // Being handled by the worker
+    SpscRing<struct mesh_command, MESHROOM_COMMAND_QUEUE_DEPTH> _commandRing;
+    QueueHandle_t _replyQueue;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    uint8_t _replyQueueStorage[MESHROOM_REPLY_QUEUE_DEPTH *
+                               sizeof(struct mesh_reply)];
+    StaticQueue_t _replyQueueBuffer;
+#endif
+    struct command_queue_stats _cmdqStats;
+    struct proto_stats _protoStats;
+    meshtastic_EnvironmentMetrics _env;
+    time_t _envTime;
+    MessageArena _arena;
+    DupCache _dups;
+    RateLimiter _limiter;
+    AuthIndex _auth;
+    TxScheduler _tx;
+    volatile unsigned int _txDutyPending; // 0 when none
+    volatile int _compactPending;        // -1 when none
+    RulesEngine _rules;
+    AdcSampler _adc;
+    ButtonCapture _button;
+    EventBus _events;
+    CommandBench _bench;
+    PacketFilter _filter;
+    SerialLink _serial0;
+    SerialLink _serial1;
+    uint64_t _configStartUs;
+    uint32_t _configMs;
+    volatile unsigned int _serialBaudPending; // 0 when none
+    unsigned int _linkTelemetrySecs;
+    time_t _linkTelemetryLast;
+    time_t _lastFiltered;                // Last frame the filter dropped
+    volatile bool _benchPending;
+    enum CommandBench::Mode _benchMode;
+    unsigned int _benchIterations;
+    uint32_t _benchSeed;
+    bool _dryRun;
+    SemaphoreHandle_t _benchDone;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    StaticSemaphore_t _benchDoneBuffer;
+#endif
+    SemaphoreHandle_t _nvmLock;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    StaticSemaphore_t _nvmLockBuffer;
+#endif
+    SemaphoreHandle_t _clientLock;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    StaticSemaphore_t _clientLockBuffer;
+#endif
+    ReplyFramer _framer;
+    IrQueue _irQueue;
+    ActuatorScheduler _actuators;
+    int _buzzerActuator;
+    int _resetActuator;
+    int _alertLedActuator;
+#if defined(MESHROOM_MORSE_ALARM)
+    MorsePlayer _morsePlayer;
+#endif
 
 };
 
@@ -15,6 +15,7 @@
 #include <FreeRTOS.h>
 #include <task.h>
 #include <pico-plat.h>
+#include <meshroom.h>
 #include <PicoPlatform.hxx>
 #include <libmeshtastic.h>
 #include <MeshRoom.hxx>
@@ -32,6 +33,19 @@ MeshRoomShell::MeshRoomShell(shared_ptr<SimpleClient> client)
     _help_list.push_back("buzz");
     _help_list.push_back("morse");
     _help_list.push_back("reset");
+    _help_list.push_back("cmdq");
+    _help_list.push_back("heap");
+    _help_list.push_back("affinity");
+    _help_list.push_back("cpu");
+    _help_list.push_back("tx");
+    _help_list.push_back("rule");
+    _help_list.push_back("adc");
+    _help_list.push_back("button");
+    _help_list.push_back("events");
+    _help_list.push_back("bench");
+    _help_list.push_back("serial");
+
+    _outLen = 0;
 }
 
 MeshRoomShell::~MeshRoomShell()
@@ -39,7 +53,23 @@ MeshRoomShell::~MeshRoomShell()
 
 }
 
-int MeshRoomShell::tx_write(const uint8_t *buf, size_t size)
+int MeshRoomShell::process(void)
+{
+    int ret = 0;
+
+    ret = SimpleShell::process();
+    flush();
+
+    return ret;
+}
+
+void MeshRoomShell::showWelcome(void)
+{
+    SimpleShell::showWelcome();
+    flush();
+}
+
+int MeshRoomShell::console_write(const uint8_t *buf, size_t size)
 {
     int ret = 0;
     int console_id = (int) _ctx;
@@ -55,21 +85,103 @@ int MeshRoomShell::tx_write(const uint8_t *buf, size_t size)
     return ret;
 }
 
+/*
+ * The console may accept less than asked for while its FIFO is full;
+ * wait for it to make room, but give up on a console that nobody is
+ * reading (e.g. USB with the host port closed).
+ */
+void MeshRoomShell::drain(const uint8_t *buf, size_t size)
+{
+    TickType_t t0 = xTaskGetTickCount();
+    int ret;
+
+    while (size > 0) {
+        ret = console_write(buf, size);
+        if (ret < 0) {
+            break;
+        } else if (ret == 0) {
+            if ((xTaskGetTickCount() - t0) >=
+                pdMS_TO_TICKS(SHELL_FLUSH_TIMEOUT_MS)) {
+                break;
+            }
+            vTaskDelay(1);
+            continue;
+        }
+
+        if ((size_t) ret > size) {
+            ret = size;
+        }
+        buf += ret;
+        size -= ret;
+        t0 = xTaskGetTickCount();
+    }
+}
+
+void MeshRoomShell::flush(void)
+{
+    if (_outLen > 0) {
+        drain((const uint8_t *) _out, _outLen);
+        _outLen = 0;
+    }
+}
+
+int MeshRoomShell::tx_write(const uint8_t *buf, size_t size)
+{
+    if (size > (sizeof(_out) - _outLen)) {
+        flush();
+    }
+
+    if (size >= sizeof(_out)) {
+        drain(buf, size);
+    } else {
+        memcpy(_out + _outLen, buf, size);
+        _outLen += size;
+    }
+
+    return size;
+}
+
 int MeshRoomShell::printf(const char *format, ...)
 {
     int ret = 0;
     va_list ap;
-    int console_id = (int) _ctx;
+    char *s = NULL;
 
     va_start(ap, format);
-    if (console_id == 1) {
-        ret = usbcdc_vprintf(format, ap);
-    } else if (console_id == 2) {
-        ret = serial0_vprintf(format, ap);
-    } else {
+    ret = vsnprintf(_out + _outLen, sizeof(_out) - _outLen, format, ap);
+    va_end(ap);
+    if (ret < 0) {
+        goto done;
+    }
+
+    if ((size_t) ret < (sizeof(_out) - _outLen)) {
+        _outLen += ret;
+        goto done;
+    }
+
+    // Didn't fit: flush what was there before and try again
+    flush();
+    if ((size_t) ret < sizeof(_out)) {
+        va_start(ap, format);
+        vsnprintf(_out, sizeof(_out), format, ap);
+        va_end(ap);
+        _outLen = ret;
+        goto done;
+    }
+
+    // Larger than the whole buffer
+    s = (char *) malloc(ret + 1);
+    if (s == NULL) {
         ret = -1;
+        goto done;
     }
+    va_start(ap, format);
+    vsnprintf(s, ret + 1, format, ap);
     va_end(ap);
+    drain((const uint8_t *) s, ret);
+    free(s);
+
+done:
 
     return ret;
 }
@@ -95,6 +207,9 @@ int MeshRoomShell::rx_read(uint8_t *buf, size_t size)
     int ret = 0;
     int console_id = (int) _ctx;
 
+    // Whatever the command asked for must be seen before it waits on input
+    flush();
+
     if (console_id == 1) {
         ret = usbcdc_read(buf, size);
     } else if (console_id == 2) {
@@ -114,13 +229,14 @@ int MeshRoomShell::system(int argc, char **argv)
     unsigned int total_heap = &__StackLimit  - &__bss_end__;
     unsigned int used_heap = m.uordblks;
     unsigned int free_heap = total_heap - used_heap;
-    char cTaskListBuffer[512];
 
     SimpleShell::system(argc, argv);
     this->printf("  Platform: %s\n", PicoPlatform::get()->getName().c_str());
     this->printf("Total Heap: %8u bytes\n", total_heap);
     this->printf(" Free Heap: %8u bytes\n", free_heap);
     this->printf(" Used Heap: %8u bytes\n", used_heap);
+    this->printf("RTOS  Heap: %8u bytes\n", configTOTAL_HEAP_SIZE);
+    this->printf(" Free RTOS: %8u bytes\n", xPortGetFreeHeapSize());
     this->printf("Board Temp:     %.1fC\n", meshroom->getOnboardTempC());
     if ((argc == 2) && (strcmp(argv[1], "-v") == 0)) {
         this->printf("clk_ref:  %lu Hz\n", clock_get_hz(clk_ref));
@@ -129,16 +245,40 @@ int MeshRoomShell::system(int argc, char **argv)
         this->printf("clk_adc:  %lu Hz\n", clock_get_hz(clk_adc));
         this->printf("clk_peri: %lu Hz\n", clock_get_hz(clk_peri));
     }
-    bzero(cTaskListBuffer, sizeof(cTaskListBuffer));
-    vTaskListTasks(cTaskListBuffer, sizeof(cTaskListBuffer));
     this->printf("  FreeRTOS:\n");
-    this->printf("Name        State  Priority  StackRem   Task#   CPU Affn\n");
-    this->printf("--------------------------------------------------------\n");
-    this->printf("%s", cTaskListBuffer);
+    this->printf("Name         S  Prio  Base  Affn  Stack   Task#"
+                 "      Runtime  Core%%\n");
+    this->printf("----------------------------------------------"
+                 "--------------------\n");
+    if (task_info_foreach(MeshRoomShell::task_row, this) < 0) {
+        this->printf("out of memory!\n");
+        ret = -1;
+    }
 
     return ret;
 }
 
+void MeshRoomShell::task_row(const struct task_info *info, void *arg)
+{
+    MeshRoomShell *shell = (MeshRoomShell *) arg;
+    unsigned long pct = 0;
+
+    if (info->total_runtime > 0) {
+        pct = info->runtime * 100 / info->total_runtime;
+    }
+
+    shell->printf("%-12s %c %5u %5u  0x%lx %6u %7u %12llu %5lu%%\n",
+                  info->name,
+                  info->state,
+                  info->priority,
+                  info->base_priority,
+                  info->affinity,
+                  (unsigned int) info->stack_free,
+                  info->number,
+                  (unsigned long long) info->runtime,
+                  pct);
+}
+
 int MeshRoomShell::reboot(int argc, char **argv)
 {
     (void)(argc);
@@ -147,6 +287,7 @@ int MeshRoomShell::reboot(int argc, char **argv)
     this->printf("Disconnect from meshtastic\n");
     meshroom->sendDisconnect();
     this->printf("Rebooting ...\n");
+    flush();
     PicoPlatform::get()->reboot();
 
     return 0;
@@ -167,6 +308,7 @@ int MeshRoomShell::bootsel(int argc, char **argv)
 
     meshroom->sendDisconnect();
     this->printf("Rebooting to BOOTSEL mode ...\n");
+    flush();
     PicoPlatform::get()->bootsel();
 
     return 0;
@@ -189,6 +331,17 @@ int MeshRoomShell::ir(int argc, char **argv)
             this->printf(" panasonic_ac ");
         }
         this->printf("\n");
+    } else if ((argc == 2) && strcmp(argv[1], "stats") == 0) {
+        const struct ir_queue_stats &stats = meshroom->getIrQueueStats();
+
+        this->printf("      pending: %u\n", meshroom->irPending());
+        this->printf("     requests: %u\n", stats.requests);
+        this->printf("transmissions: %u\n", stats.transmissions);
+        this->printf("       failed: %u\n", stats.failed);
+        this->printf("       merged: %u\n", stats.merged);
+        this->printf("   superseded: %u\n", stats.superseded);
+        this->printf("        saved: %u\n",
+                     stats.merged + stats.superseded);
     } else if ((argc == 3) && strcmp(argv[1], "add") == 0) {
         if (strstr(argv[2], "bravia") != NULL) {
             ir_flags |= MESHROOM_IR_SONY_BRAVIA;
@@ -434,7 +587,7 @@ int MeshRoomShell::morse(int argc, char **argv)
         text += argv[i];
     }
 
-    meshroom->addMorseText(text);
+    meshroom->buzzMorseCode(text);
 
     return 0;
 }
@@ -465,6 +618,784 @@ int MeshRoomShell::reset(int argc, char **argv)
     return ret;
 }
 
+int MeshRoomShell::cmdq(int argc, char **argv)
+{
+    int ret = 0;
+    const struct command_queue_stats &stats =
+        meshroom->getCommandQueueStats();
+    const struct message_arena_stats &arena = meshroom->getArenaStats();
+    const struct proto_stats &proto = meshroom->getProtoStats();
+    const struct dup_cache_stats &dups = meshroom->getDupStats();
+    const struct rate_limit_stats &limits =
+        meshroom->rateLimiter().getStats();
+    const struct auth_index_stats &auth = meshroom->authIndex().getStats();
+
+    if (argc != 1) {
+        this->printf("syntax error!\n");
+        ret = -1;
+        goto done;
+    }
+
+    this->printf("commands:\n");
+    this->printf("     depth: %u/%u (max %u)\n",
+                 meshroom->commandQueueDepth(),
+                 MESHROOM_COMMAND_QUEUE_DEPTH, stats.depth_max);
+    this->printf("  enqueued: %u\n", stats.enqueued);
+    this->printf("   dropped: %u\n", stats.dropped);
+    this->printf(" truncated: %u\n", stats.truncated);
+    this->printf("   limited: %u\n", stats.rate_limited);
+    this->printf(" processed: %u\n", stats.processed);
+    if (stats.processed > 0) {
+        this->printf("      wait: avg %lu us, max %lu us\n",
+                     (unsigned long) (stats.wait_us_total / stats.processed),
+                     (unsigned long) stats.wait_us_max);
+        this->printf("      exec: avg %lu us, max %lu us\n",
+                     (unsigned long) (stats.exec_us_total / stats.processed),
+                     (unsigned long) stats.exec_us_max);
+    }
+    this->printf("replies:\n");
+    this->printf("     depth: %u/%u (max %u)\n",
+                 meshroom->replyQueueDepth(),
+                 MESHROOM_REPLY_QUEUE_DEPTH, stats.reply_depth_max);
+    this->printf("    queued: %u\n", stats.replies_queued);
+    this->printf("   dropped: %u\n", stats.replies_dropped);
+    this->printf(" truncated: %u\n", stats.replies_truncated);
+    this->printf(" scheduled: %u\n", stats.replies_scheduled);
+    this->printf("  rejected: %u\n", stats.replies_rejected);
+    if ((stats.replies_scheduled + stats.replies_rejected) > 0) {
+        this->printf("      wait: avg %lu us, max %lu us\n",
+                     (unsigned long) (stats.reply_wait_us_total /
+                                      (stats.replies_scheduled +
+                                       stats.replies_rejected)),
+                     (unsigned long) stats.reply_wait_us_max);
+    }
+    this->printf("binary:\n");
+    this->printf("  requests: %u\n", proto.requests);
+    this->printf(" responses: %u\n", proto.responses);
+    this->printf("    denied: %u\n", proto.denied);
+    this->printf("    errors: %u\n", proto.errors);
+    this->printf("rate limit:\n");
+    for (unsigned int i = 0; i < 2; i++) {
+        this->printf("%10s: %u admitted, %u rejected (%u globally)\n",
+                     RateLimiter::classStr(i),
+                     limits.classes[i].admitted, limits.classes[i].rejected,
+                     limits.classes[i].global);
+    }
+    this->printf("     nodes: %u/%u (%u evicted)\n",
+                 meshroom->rateLimiter().nodes(), RATE_LIMIT_NODES,
+                 limits.evictions);
+    for (unsigned int i = 0; i < meshroom->rateLimiter().nodes(); i++) {
+        const struct rate_limit_node &node = meshroom->rateLimiter().node(i);
+
+        if (node.rejected > 0) {
+            this->printf("  %08lx: %u rejected\n",
+                         (unsigned long) node.node_num, node.rejected);
+        }
+    }
+    this->printf("auth index:\n");
+    this->printf("     nodes: %u in %u slots (%u rebuilds)\n",
+                 meshroom->authIndex().nodes(), meshroom->authIndex().slots(),
+                 auth.rebuilds);
+    this->printf("   lookups: %u\n", auth.lookups);
+    this->printf("    probes: avg %u.%02u, max %u\n",
+                 (auth.lookups > 0) ? (auth.probes / auth.lookups) : 0,
+                 (auth.lookups > 0) ?
+                 ((auth.probes * 100 / auth.lookups) % 100) : 0,
+                 auth.probe_max);
+    this->printf("duplicates:\n");
+    this->printf("   lookups: %u\n", dups.lookups);
+    this->printf("      hits: %u (%u.%u%%)\n", dups.hits,
+                 (dups.lookups > 0) ? (dups.hits * 100 / dups.lookups) : 0,
+                 (dups.lookups > 0) ?
+                 ((dups.hits * 1000 / dups.lookups) % 10) : 0);
+    this->printf("   expired: %u\n", dups.expired);
+    this->printf(" evictions: %u\n", dups.evictions);
+    this->printf("arena:\n");
+    this->printf("      high: %u/%u\n",
+                 (unsigned int) arena.high_water, MESSAGE_ARENA_SIZE);
+    this->printf("    allocs: %u\n", arena.allocs);
+    this->printf("    reuses: %u\n", arena.reuses);
+    this->printf(" fallbacks: %u\n", arena.fallbacks);
+    this->printf("  releases: %u\n", arena.releases);
+    this->printf("    pinned: %u\n", arena.pinned);
+
+done:
+
+    return ret;
+}
+
+int MeshRoomShell::heap(int argc, char **argv)
+{
+    int ret = 0;
+    extern char __StackLimit, __bss_end__;
+    struct mallinfo m = mallinfo();
+    HeapStats_t hs;
+    struct heap_task_stats stats[HEAP_TRACE_MAX_TASKS];
+    unsigned int n;
+
+    if ((argc == 2) && (strcmp(argv[1], "reset") == 0)) {
+        heap_trace_reset();
+        goto done;
+    } else if (argc != 1) {
+        this->printf("syntax error!\n");
+        ret = -1;
+        goto done;
+    }
+
+    vPortGetHeapStats(&hs);
+    this->printf("pool:     %8u bytes\n", configTOTAL_HEAP_SIZE);
+    this->printf("free:     %8u bytes\n", hs.xAvailableHeapSpaceInBytes);
+    this->printf("used:     %8u bytes\n",
+                 configTOTAL_HEAP_SIZE - hs.xAvailableHeapSpaceInBytes);
+    this->printf("peak:     %8u bytes\n",
+                 configTOTAL_HEAP_SIZE - hs.xMinimumEverFreeBytesRemaining);
+    this->printf("largest:  %8u bytes\n",
+                 hs.xSizeOfLargestFreeBlockInBytes);
+    this->printf("smallest: %8u bytes\n",
+                 hs.xSizeOfSmallestFreeBlockInBytes);
+    this->printf("fragments:%8u\n", hs.xNumberOfFreeBlocks);
+    this->printf("allocs:   %8u\n", hs.xNumberOfSuccessfulAllocations);
+    this->printf("frees:    %8u\n", hs.xNumberOfSuccessfulFrees);
+    this->printf("newlib:   %8u/%u bytes\n",
+                 m.uordblks, (unsigned int) (&__StackLimit - &__bss_end__));
+
+    n = heap_trace_task_stats(stats, HEAP_TRACE_MAX_TASKS);
+    this->printf("Task          Allocs    Frees Fail   AllocBytes    FreeBytes"
+                 "    Live    Peak\n");
+    this->printf("--------------------------------------------------------"
+                 "------------------\n");
+    for (unsigned int i = 0; i < n; i++) {
+        this->printf("%-12s %7u %8u %4u %12u %12u %7u %7u\n",
+                     stats[i].name,
+                     stats[i].allocs,
+                     stats[i].frees,
+                     stats[i].failures,
+                     stats[i].alloc_bytes,
+                     stats[i].free_bytes,
+                     stats[i].cur_bytes,
+                     stats[i].peak_bytes);
+    }
+    if (heap_trace_untracked() > 0) {
+        this->printf("untracked: %u blocks\n", heap_trace_untracked());
+    }
+
+done:
+
+    return ret;
+}
+
+#define CPU_TASK_SLACK         4
+#define CPU_DEFAULT_WINDOW_MS  1000
+
+struct cpu_count {
+    unsigned int number;
+    uint64_t runtime;
+};
+
+struct cpu_window {
+    MeshRoomShell *shell;
+    struct cpu_count *before;            // Counters at the start
+    unsigned int max;
+    unsigned int n;
+    uint64_t t0;
+    uint64_t elapsed;
+};
+
+int MeshRoomShell::affinity(int argc, char **argv)
+{
+    int ret = 0;
+#if defined(configUSE_CORE_AFFINITY) && (configNUMBER_OF_CORES > 1)
+    TaskHandle_t handle = NULL;
+    unsigned long mask;
+    char *end = NULL;
+
+    if (argc == 1) {
+        this->printf("Task         Prio  Mask\n");
+        this->printf("-----------------------\n");
+        if (task_info_foreach(MeshRoomShell::affinity_row, this) < 0) {
+            this->printf("out of memory!\n");
+            ret = -1;
+        }
+    } else if (argc == 3) {
+        mask = strtoul(argv[2], &end, 0);
+        if ((end == NULL) || (*end != '\0') || (mask == 0) ||
+            (mask & ~((1UL << configNUMBER_OF_CORES) - 1))) {
+            this->printf("invalid mask '%s'!\n", argv[2]);
+            ret = -1;
+            goto done;
+        }
+
+        handle = xTaskGetHandle(argv[1]);
+        if (handle == NULL) {
+            this->printf("no task named '%s'!\n", argv[1]);
+            ret = -1;
+            goto done;
+        }
+
+        vTaskCoreAffinitySet(handle, mask);
+        this->printf("%s: 0x%lx\n", argv[1], mask);
+    } else {
+        this->printf("syntax error!\n");
+        ret = -1;
+    }
+
+done:
+#else
+    (void)(argc);
+    (void)(argv);
+
+    this->printf("core affinity not supported!\n");
+    ret = -1;
+#endif
+
+    return ret;
+}
+
+void MeshRoomShell::affinity_row(const struct task_info *info, void *arg)
+{
+    MeshRoomShell *shell = (MeshRoomShell *) arg;
+
+    shell->printf("%-12s %4u   0x%lx\n",
+                  info->name, info->priority, info->affinity);
+}
+
+/*
+ * Samples the run time counters over a window and reports the load on
+ * each core (from its idle task) and the share taken by each task. Only
+ * the starting counters are kept, on the heap and sized for the tasks
+ * that exist, so the shell stack use does not grow with their number.
+ */
+int MeshRoomShell::cpu(int argc, char **argv)
+{
+    int ret = 0;
+    struct cpu_window window;
+    configRUN_TIME_COUNTER_TYPE idle0[configNUMBER_OF_CORES];
+    configRUN_TIME_COUNTER_TYPE idle1[configNUMBER_OF_CORES];
+    configRUN_TIME_COUNTER_TYPE delta;
+    unsigned long window_ms = CPU_DEFAULT_WINDOW_MS;
+    char *end = NULL;
+
+    bzero(&window, sizeof(window));
+    window.shell = this;
+
+    if (argc == 2) {
+        window_ms = strtoul(argv[1], &end, 10);
+        if ((end == NULL) || (*end != '\0') ||
+            (window_ms == 0) || (window_ms > 10000)) {
+            this->printf("invalid window '%s'!\n", argv[1]);
+            ret = -1;
+            goto done;
+        }
+    } else if (argc != 1) {
+        this->printf("syntax error!\n");
+        ret = -1;
+        goto done;
+    }
+
+    // Only the counters are kept across the window, on the heap
+    window.max = uxTaskGetNumberOfTasks() + CPU_TASK_SLACK;
+    window.before = (struct cpu_count *)
+        pvPortMalloc(window.max * sizeof(struct cpu_count));
+    if (window.before == NULL) {
+        this->printf("out of memory!\n");
+        ret = -1;
+        goto done;
+    }
+
+    for (unsigned int c = 0; c < configNUMBER_OF_CORES; c++) {
+        idle0[c] = ulTaskGetRunTimeCounter(xTaskGetIdleTaskHandleForCore(c));
+    }
+    if (task_info_foreach(MeshRoomShell::cpu_sample, &window) < 0) {
+        this->printf("out of memory!\n");
+        ret = -1;
+        goto done;
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(window_ms));
+
+    for (unsigned int c = 0; c < configNUMBER_OF_CORES; c++) {
+        idle1[c] = ulTaskGetRunTimeCounter(xTaskGetIdleTaskHandleForCore(c));
+    }
+    window.elapsed = portGET_RUN_TIME_COUNTER_VALUE() - window.t0;
+    if (window.elapsed == 0) {
+        goto done;
+    }
+
+    for (unsigned int c = 0; c < configNUMBER_OF_CORES; c++) {
+        delta = idle1[c] - idle0[c];
+        if (delta > window.elapsed) {
+            delta = window.elapsed;
+        }
+        this->printf("core%u: %3lu%% busy\n", c,
+                     (unsigned long) (100 - (delta * 100 / window.elapsed)));
+    }
+
+    this->printf("Task         Mask    Time(us)   Core%%\n");
+    this->printf("-------------------------------------\n");
+    if (task_info_foreach(MeshRoomShell::cpu_row, &window) < 0) {
+        this->printf("out of memory!\n");
+        ret = -1;
+    }
+
+done:
+
+    vPortFree(window.before);
+
+    return ret;
+}
+
+void MeshRoomShell::cpu_sample(const struct task_info *info, void *arg)
+{
+    struct cpu_window *window = (struct cpu_window *) arg;
+
+    window->t0 = info->total_runtime;
+    if (window->n < window->max) {
+        window->before[window->n].number = info->number;
+        window->before[window->n].runtime = info->runtime;
+        window->n++;
+    }
+}
+
+void MeshRoomShell::cpu_row(const struct task_info *info, void *arg)
+{
+    struct cpu_window *window = (struct cpu_window *) arg;
+    uint64_t delta = info->runtime;
+
+    for (unsigned int i = 0; i < window->n; i++) {
+        if (window->before[i].number == info->number) {
+            delta -= window->before[i].runtime;
+            break;
+        }
+    }
+
+    window->shell->printf("%-12s 0x%lx %11lu %6lu%%\n",
+                          info->name, info->affinity,
+                          (unsigned long) delta,
+                          (unsigned long) (delta * 100 / window->elapsed));
+}
+
+int MeshRoomShell::tx(int argc, char **argv)
+{
+    int ret = 0;
+    const struct tx_stats &stats = meshroom->getTxStats();
+    const struct reply_frame_stats &frames = meshroom->getReplyFrameStats();
+    unsigned long pct;
+    char *end = NULL;
+
+    if ((argc == 3) && (strcmp(argv[1], "compact") == 0) &&
+        ((strcmp(argv[2], "on") == 0) || (strcmp(argv[2], "off") == 0))) {
+        meshroom->setReplyCompact(strcmp(argv[2], "on") == 0);
+    } else if ((argc == 3) && (strcmp(argv[1], "duty") == 0)) {
+        pct = strtoul(argv[2], &end, 10);
+        if ((end == NULL) || (*end != '\0') || (pct < 1) || (pct > 100)) {
+            this->printf("invalid duty cycle '%s'!\n", argv[2]);
+            ret = -1;
+            goto done;
+        }
+        meshroom->setTxDutyCycle(pct);
+    } else if (argc != 1) {
+        this->printf("syntax error!\n");
+        ret = -1;
+        goto done;
+    }
+
+    this->printf("      duty: %u%%\n", meshroom->txDutyCycle());
+    this->printf("    budget: %lu/%u ms\n",
+                 (unsigned long) meshroom->txBudgetMs(),
+                 TX_AIRTIME_BURST_MS);
+    this->printf("   airtime: %lu ms\n",
+                 (unsigned long) (stats.airtime_us / 1000));
+    this->printf("   pending: %u/%u (max %u)\n",
+                 meshroom->txPending(), TX_QUEUE_DEPTH, stats.depth_max);
+    this->printf("    queued: %u\n", stats.queued);
+    this->printf("    merged: %u\n", stats.merged);
+    this->printf("   dropped: %u\n", stats.dropped);
+    this->printf("  deferred: %u\n", stats.deferred);
+    this->printf("      sent: %u\n", stats.sent);
+    this->printf("    failed: %u\n", stats.failed);
+    this->printf("heartbeats: %u\n", stats.heartbeats);
+    this->printf("   configs: %u\n", stats.want_configs);
+    if (stats.sent > 0) {
+        this->printf("   latency: avg %lu us, max %lu us\n",
+                     (unsigned long) (stats.latency_us_total / stats.sent),
+                     (unsigned long) stats.latency_us_max);
+    }
+    this->printf("   compact: %s\n", meshroom->replyCompact() ? "on" : "off");
+    this->printf("   replies: %u (%u framed, %u truncated)\n",
+                 frames.replies, frames.framed, frames.truncated);
+    this->printf("   packets: %u plain, %u framed\n",
+                 frames.packets_plain, frames.packets);
+    this->printf("     bytes: %u in, %u out\n",
+                 frames.bytes_in, frames.bytes_out);
+
+done:
+
+    return ret;
+}
+
+int MeshRoomShell::rule(int argc, char **argv)
+{
+    string args;
+    string reply;
+
+    for (int i = 1; i < argc; i++) {
+        if (i > 1) {
+            args += " ";
+        }
+        args += argv[i];
+    }
+
+    reply = meshroom->ruleCommand(args);
+    this->printf("%s\n", reply.c_str());
+
+    return 0;
+}
+
+int MeshRoomShell::adc(int argc, char **argv)
+{
+    int ret = 0;
+    AdcSampler &sampler = meshroom->adcSampler();
+    const struct adc_sampler_stats &stats = sampler.getStats();
+    unsigned long rate;
+    char *end = NULL;
+
+    if ((argc == 2) && (strcmp(argv[1], "reset") == 0)) {
+        sampler.resetStats();
+        goto done;
+    } else if ((argc == 2) && (strcmp(argv[1], "stop") == 0)) {
+        sampler.stop();
+        goto done;
+    } else if ((argc >= 2) && (argc <= 3) &&
+               (strcmp(argv[1], "start") == 0)) {
+        rate = ADC_SAMPLER_RATE_HZ;
+        if (argc == 3) {
+            rate = strtoul(argv[2], &end, 10);
+            if ((end == NULL) || (*end != '\0') ||
+                (rate < ADC_SAMPLER_RATE_MIN) ||
+                (rate > ADC_SAMPLER_RATE_MAX)) {
+                this->printf("invalid rate '%s' (%u-%u Hz)!\n", argv[2],
+                             ADC_SAMPLER_RATE_MIN, ADC_SAMPLER_RATE_MAX);
+                ret = -1;
+                goto done;
+            }
+        }
+        sampler.stop();
+        if (sampler.start(ADC_SAMPLER_MASK, rate) == false) {
+            this->printf("failed to start sampler!\n");
+            ret = -1;
+        }
+        goto done;
+    } else if (argc != 1) {
+        this->printf("syntax error!\n");
+        ret = -1;
+        goto done;
+    }
+
+    if (sampler.isRunning() == false) {
+        this->printf("stopped\n");
+        goto done;
+    }
+
+    this->printf("   rate: %u Hz (measured %u Hz)\n",
+                 sampler.rateHz(), sampler.measuredRateHz());
+    this->printf("samples: %lu (%lu errors)\n",
+                 (unsigned long) stats.samples, (unsigned long) stats.errors);
+    this->printf("   laps: %lu (%u samples each)\n",
+                 (unsigned long) stats.laps, ADC_SAMPLER_RING);
+    if (stats.laps > 0) {
+        this->printf("    isr: avg %lu us, max %lu us\n",
+                     (unsigned long) (stats.isr_us_total / stats.laps),
+                     (unsigned long) stats.isr_us_max);
+    }
+    this->printf("   temp: %.2fC\n", sampler.tempC());
+    this->printf("Input    Raw   Volts  Noise   Min   Max   Samples\n");
+    this->printf("------------------------------------------------\n");
+    for (unsigned int i = 0; i < ADC_SAMPLER_INPUTS; i++) {
+        const struct adc_input_stats &in = sampler.inputStats(i);
+
+        if ((sampler.mask() & (1 << i)) == 0) {
+            continue;
+        }
+        this->printf("%-6s %5u %7.3f %6.2f %5u %5u %9lu\n",
+                     (i == ADC_SAMPLER_TEMP) ? "temp" :
+                     (i == 0) ? "adc0" : (i == 1) ? "adc1" :
+                     (i == 2) ? "adc2" : "adc3",
+                     sampler.raw(i), sampler.volts(i), sampler.noise(i),
+                     in.min, in.max, (unsigned long) in.samples);
+    }
+
+done:
+
+    return ret;
+}
+
+int MeshRoomShell::button(int argc, char **argv)
+{
+    const ButtonCapture &capture = meshroom->buttonCapture();
+    const struct button_capture_stats &stats = capture.getStats();
+
+    (void)(argc);
+    (void)(argv);
+
+    this->printf("capture: %s\n", capture.isCapturing() ? "pio" : "gpio irq");
+    this->printf("   irqs: %u\n", stats.irqs);
+    this->printf("  edges: %u\n", stats.edges);
+    for (int i = 0; i < BUTTON_GESTURE_MAX; i++) {
+        this->printf("%7s: %u\n",
+                     ButtonCapture::gestureStr((enum ButtonGesture) i),
+                     stats.gestures[i]);
+    }
+
+    return 0;
+}
+
+int MeshRoomShell::events(int argc, char **argv)
+{
+    EventBus &bus = meshroom->events();
+    const struct event_bus_stats &stats = bus.getStats();
+    TaskHandle_t task;
+    uint32_t mask;
+
+    (void)(argc);
+    (void)(argv);
+
+    for (int i = 0; i < EVENT_TYPE_MAX; i++) {
+        this->printf("%10s: %u\n", EventBus::typeStr(i), stats.published[i]);
+    }
+    this->printf("   unheard: %u\n", stats.unheard);
+
+    this->printf("Task         Mask Pending Delivered Dropped Max\n");
+    this->printf("---------------------------------------------\n");
+    for (int i = 0; i < EVENT_BUS_MAX_SUBSCRIBERS; i++) {
+        const struct event_subscriber_stats &sub = bus.subscriberStats(i);
+
+        if (bus.subscriber(i, task, mask) == false) {
+            continue;
+        }
+        this->printf("%-12s 0x%02lx %7u %9u %7u %3u\n",
+                     pcTaskGetName(task), (unsigned long) mask,
+                     bus.pending(i), sub.delivered, sub.dropped,
+                     sub.depth_max);
+    }
+
+    return 0;
+}
+
+int MeshRoomShell::bench(int argc, char **argv)
+{
+    int ret = 0;
+    const struct command_bench_result &result = meshroom->benchResult();
+    unsigned int mode;
+    unsigned long iterations = 1000;
+    unsigned long seed = time_us_32();
+    char *end = NULL;
+
+    if (argc > 4) {
+        this->printf("syntax error!\n");
+        ret = -1;
+        goto done;
+    }
+
+    if (argc >= 2) {
+        for (mode = 0; mode < CommandBench::BENCH_MODE_MAX; mode++) {
+            if (strcmp(argv[1], CommandBench::modeStr(mode)) == 0) {
+                break;
+            }
+        }
+        if (mode == CommandBench::BENCH_MODE_MAX) {
+            this->printf("unknown mode '%s'!\n", argv[1]);
+            ret = -1;
+            goto done;
+        }
+        if (argc >= 3) {
+            iterations = strtoul(argv[2], &end, 10);
+            if ((end == NULL) || (*end != '\0') || (iterations == 0) ||
+                (iterations > BENCH_MAX_ITERATIONS)) {
+                this->printf("invalid count '%s' (1-%u)!\n", argv[2],
+                             BENCH_MAX_ITERATIONS);
+                ret = -1;
+                goto done;
+            }
+        }
+        if (argc == 4) {
+            seed = strtoul(argv[3], &end, 0);
+            if ((end == NULL) || (*end != '\0')) {
+                this->printf("invalid seed '%s'!\n", argv[3]);
+                ret = -1;
+                goto done;
+            }
+        }
+        if (meshroom->runBench((enum CommandBench::Mode) mode, iterations,
+                               seed, pdMS_TO_TICKS(60000)) == false) {
+            this->printf("benchmark did not complete!\n");
+            ret = -1;
+            goto done;
+        }
+    }
+
+    if (result.commands == 0) {
+        this->printf("no results\n");
+        goto done;
+    }
+
+    this->printf("      mode: %s (seed 0x%08lx)\n",
+                 CommandBench::modeStr(result.mode),
+                 (unsigned long) result.seed);
+    this->printf("  commands: %u (%u replied)\n",
+                 result.commands, result.replies);
+    this->printf("      rate: %lu cmd/s\n",
+                 (unsigned long) ((result.elapsed_us > 0) ?
+                                  ((uint64_t) result.commands * 1000000 /
+                                   result.elapsed_us) : 0));
+    this->printf("   latency: p50 %lu us, p99 %lu us, max %lu us\n",
+                 (unsigned long) result.p50_us,
+                 (unsigned long) result.p99_us,
+                 (unsigned long) result.max_us);
+    this->printf("    allocs: %u.%02u heap, %u.%02u arena per command"
+                 " (%u fallbacks)\n",
+                 result.allocs / result.commands,
+                 (result.allocs * 100 / result.commands) % 100,
+                 result.arena_allocs / result.commands,
+                 (result.arena_allocs * 100 / result.commands) % 100,
+                 result.arena_fallbacks);
+    this->printf("exceptions: %u\n", result.exceptions);
+    if (result.exceptions > 0) {
+        this->printf("  first on: '%s'\n", result.failure);
+    }
+
+done:
+
+    return ret;
+}
+
+void MeshRoomShell::serial_link(unsigned int index)
+{
+    SerialLink &link = meshroom->serialLink(index);
+    const struct serial_link_stats &stats = link.getStats();
+
+    this->printf("serial%u: %u baud%s", index, link.baud(),
+                 link.onProbation() ? " on probation" : "");
+    if (index == 1) {
+        this->printf(" (preferred %u, fallback %u, %lu fallbacks,"
+                     " %lu retries)", link.preferredBaud(),
+                     link.fallbackBaud(), (unsigned long) stats.fallbacks,
+                     (unsigned long) stats.retries);
+    }
+    this->printf("\n");
+    this->printf("        Bytes   Frames  Bad Dropped     bps    Peak\n");
+    this->printf("rx %10lu %8lu %4lu %7lu %7lu %7lu\n",
+                 (unsigned long) stats.rx.bytes,
+                 (unsigned long) stats.rx.frames,
+                 (unsigned long) stats.rx.bad_frames,
+                 (unsigned long) stats.overruns,
+                 (unsigned long) stats.rx.bps,
+                 (unsigned long) stats.rx.peak_bps);
+    this->printf("tx %10lu %8lu %4lu %7lu %7lu %7lu\n",
+                 (unsigned long) stats.tx.bytes,
+                 (unsigned long) stats.tx.frames,
+                 (unsigned long) stats.tx.bad_frames,
+                 (unsigned long) stats.tx.dropped,
+                 (unsigned long) stats.tx.bps,
+                 (unsigned long) stats.tx.peak_bps);
+    this->printf("errors: %lu framing, %lu parity, %lu break, %lu overrun,"
+                 " %lu fifo full\n",
+                 (unsigned long) stats.framing_errors,
+                 (unsigned long) stats.parity_errors,
+                 (unsigned long) stats.break_errors,
+                 (unsigned long) stats.overruns,
+                 (unsigned long) stats.fifo_full);
+    this->printf("ring: max %lu, reads at", (unsigned long) stats.ring_max);
+    for (unsigned int i = 0; i < SERIAL_LINK_HIST_BUCKETS; i++) {
+        if (i == 0) {
+            this->printf(" 0:");
+        } else if (i == (SERIAL_LINK_HIST_BUCKETS - 1)) {
+            this->printf(" %u+:", 1U << (i - 1));
+        } else {
+            this->printf(" %u:", 1U << (i - 1));
+        }
+        this->printf("%lu", (unsigned long) stats.ring_hist[i]);
+    }
+    this->printf("\n");
+    if (stats.process_calls > 0) {
+        this->printf("process: %lu calls, avg %lu us, max %lu us\n",
+                     (unsigned long) stats.process_calls,
+                     (unsigned long) (stats.process_us_total /
+                                      stats.process_calls),
+                     (unsigned long) stats.process_us_max);
+    }
+}
+
+int MeshRoomShell::serial(int argc, char **argv)
+{
+    int ret = 0;
+    const struct packet_filter_stats &filter =
+        meshroom->packetFilter().getStats();
+    unsigned long value;
+    char *end = NULL;
+
+    if ((argc == 2) && (strcmp(argv[1], "reset") == 0)) {
+        meshroom->serialLink(0).resetStats();
+        meshroom->serialLink(1).resetStats();
+        meshroom->packetFilter().resetStats();
+        goto done;
+    } else if ((argc == 3) && (strcmp(argv[1], "baud") == 0)) {
+        value = strtoul(argv[2], &end, 10);
+        if ((end == NULL) || (*end != '\0') ||
+            (SerialLink::isValidBaud(value) == false)) {
+            this->printf("invalid baud rate '%s'!\n", argv[2]);
+            ret = -1;
+            goto done;
+        }
+        // The radio's serial module must be set to the same rate
+        meshroom->setSerialBaud(value);
+        this->printf("serial1: switching to %lu baud\n", value);
+        goto done;
+    } else if ((argc == 3) && (strcmp(argv[1], "filter") == 0) &&
+               ((strcmp(argv[2], "on") == 0) ||
+                (strcmp(argv[2], "off") == 0))) {
+        meshroom->packetFilter().setEnabled(strcmp(argv[2], "on") == 0);
+    } else if ((argc == 3) && (strcmp(argv[1], "telemetry") == 0)) {
+        if (strcmp(argv[2], "off") == 0) {
+            value = 0;
+        } else {
+            value = strtoul(argv[2], &end, 10);
+            if ((end == NULL) || (*end != '\0') ||
+                (value < 60) || (value > 86400)) {
+                this->printf("invalid interval '%s'!\n", argv[2]);
+                ret = -1;
+                goto done;
+            }
+        }
+        meshroom->setLinkTelemetry(value);
+    } else if (argc != 1) {
+        this->printf("syntax error!\n");
+        ret = -1;
+        goto done;
+    }
+
+    serial_link(1);
+    this->printf("filter: %s, %lu frames, %lu packets, %lu dropped"
+                 " (%lu bytes), %lu undecided\n",
+                 meshroom->packetFilter().isEnabled() ? "on" : "off",
+                 (unsigned long) filter.frames,
+                 (unsigned long) filter.packets,
+                 (unsigned long) filter.dropped,
+                 (unsigned long) filter.dropped_bytes,
+                 (unsigned long) filter.undecided);
+    serial_link(0);
+    this->printf("config download: %lu ms\n",
+                 (unsigned long) meshroom->configDownloadMs());
+    if (meshroom->linkTelemetry() > 0) {
+        this->printf("telemetry: every %u s\n", meshroom->linkTelemetry());
+    } else {
+        this->printf("telemetry: off\n");
+    }
+
+done:
+
+    return ret;
+}
+
 int MeshRoomShell::unknown_command(int argc, char **argv)
 {
     int ret = 0;
@@ -483,6 +1414,28 @@ int MeshRoomShell::unknown_command(int argc, char **argv)
         ret = this->morse(argc, argv);
     } else if (strcmp(argv[0], "reset") == 0) {
         ret = this->reset(argc, argv);
+    } else if (strcmp(argv[0], "cmdq") == 0) {
+        ret = this->cmdq(argc, argv);
+    } else if (strcmp(argv[0], "heap") == 0) {
+        ret = this->heap(argc, argv);
+    } else if (strcmp(argv[0], "affinity") == 0) {
+        ret = this->affinity(argc, argv);
+    } else if (strcmp(argv[0], "cpu") == 0) {
+        ret = this->cpu(argc, argv);
+    } else if (strcmp(argv[0], "tx") == 0) {
+        ret = this->tx(argc, argv);
+    } else if (strcmp(argv[0], "rule") == 0) {
+        ret = this->rule(argc, argv);
+    } else if (strcmp(argv[0], "adc") == 0) {
+        ret = this->adc(argc, argv);
+    } else if (strcmp(argv[0], "button") == 0) {
+        ret = this->button(argc, argv);
+    } else if (strcmp(argv[0], "events") == 0) {
+        ret = this->events(argc, argv);
+    } else if (strcmp(argv[0], "bench") == 0) {
+        ret = this->bench(argc, argv);
+    } else if (strcmp(argv[0], "serial") == 0) {
+        ret = this->serial(argc, argv);
     } else {
         this->printf("Unknown command '%s'!\n", argv[0]);
         ret = -1;
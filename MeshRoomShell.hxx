@@ -8,9 +8,19 @@
 #define MESHROOMSHELL_HXX
 
 #include <SimpleShell.hxx>
+#include <meshroom.h>
+
+#define SHELL_OUTPUT_BUFFER_SIZE  1024
+#define SHELL_FLUSH_TIMEOUT_MS    500
 
 using namespace std;
 
+/*
+ * Output is collected in a per-shell buffer and written to the console
+ * in large chunks: whenever the buffer fills up, before reading input
+ * and once after every call to process(), so that a command's output
+ * leaves in one burst instead of many small writes.
+ */
 class MeshRoomShell : public SimpleShell {
 
 public:
@@ -18,6 +28,10 @@ public:
     MeshRoomShell(shared_ptr<SimpleClient> client = NULL);
     ~MeshRoomShell();
 
+    int process(void);
+    void showWelcome(void);
+    void flush(void);
+
 protected:
 
     virtual int tx_write(const uint8_t *buf, size_t size);
@@ -35,8 +49,33 @@ protected:
     virtual int buzz(int argc, char **argv);
     virtual int morse(int argc, char **argv);
     virtual int reset(int argc, char **argv);
+    virtual int cmdq(int argc, char **argv);
+    virtual int heap(int argc, char **argv);
+    virtual int affinity(int argc, char **argv);
+    virtual int cpu(int argc, char **argv);
+    virtual int tx(int argc, char **argv);
+    virtual int rule(int argc, char **argv);
+    virtual int adc(int argc, char **argv);
+    virtual int button(int argc, char **argv);
+    virtual int events(int argc, char **argv);
+    virtual int bench(int argc, char **argv);
+    virtual int serial(int argc, char **argv);
     virtual int unknown_command(int argc, char **argv);
 
+private:
+
+    static void task_row(const struct task_info *info, void *arg);
+    static void affinity_row(const struct task_info *info, void *arg);
+    static void cpu_sample(const struct task_info *info, void *arg);
+    static void cpu_row(const struct task_info *info, void *arg);
+
+    void serial_link(unsigned int index);
+    int console_write(const uint8_t *buf, size_t size);
+    void drain(const uint8_t *buf, size_t size);
+
+    char _out[SHELL_OUTPUT_BUFFER_SIZE];
+    size_t _outLen;
+
 };
 
 #endif
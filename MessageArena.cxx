@@ -0,0 +1,148 @@
+/*
+ * MessageArena.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <strings.h>
+#include <MessageArena.hxx>
+
+MessageArena::MessageArena(pmr::memory_resource *upstream)
+    : _upstream(upstream)
+{
+    _bump = 0;
+    bzero(_free, sizeof(_free));
+    _outstanding = 0;
+    bzero(&_stats, sizeof(_stats));
+}
+
+MessageArena::~MessageArena()
+{
+
+}
+
+unsigned int MessageArena::sizeClass(size_t bytes)
+{
+    unsigned int cls = 0;
+    size_t size = MESSAGE_ARENA_MIN_CLASS;
+
+    while (size < bytes) {
+        size <<= 1;
+        cls++;
+    }
+
+    return cls;
+}
+
+bool MessageArena::owns(const void *p) const
+{
+    return ((const uint8_t *) p >= _buf) &&
+        ((const uint8_t *) p < (_buf + sizeof(_buf)));
+}
+
+void *MessageArena::do_allocate(size_t bytes, size_t alignment)
+{
+    void *p = NULL;
+    unsigned int cls;
+    size_t size;
+
+    if ((bytes > MESSAGE_ARENA_MAX_CLASS) ||
+        (alignment > alignof(max_align_t))) {
+        goto fallback;
+    }
+
+    cls = sizeClass(bytes);
+    size = MESSAGE_ARENA_MIN_CLASS << cls;
+
+    if (_free[cls] != NULL) {
+        p = _free[cls];
+        _free[cls] = _free[cls]->next;
+        _stats.reuses++;
+    } else if ((_bump + size) <= sizeof(_buf)) {
+        // Classes are powers of two, so the bump pointer stays aligned
+        p = &_buf[_bump];
+        _bump += size;
+        if (_bump > _stats.high_water) {
+            _stats.high_water = _bump;
+        }
+    } else {
+        goto fallback;
+    }
+
+    _stats.allocs++;
+    _outstanding++;
+
+    return p;
+
+fallback:
+
+    _stats.fallbacks++;
+
+    return _upstream->allocate(bytes, alignment);
+}
+
+void MessageArena::do_deallocate(void *p, size_t bytes, size_t alignment)
+{
+    struct free_block *block = NULL;
+    unsigned int cls;
+
+    if (owns(p) == false) {
+        _upstream->deallocate(p, bytes, alignment);
+        return;
+    }
+
+    cls = sizeClass(bytes);
+    block = (struct free_block *) p;
+    block->next = _free[cls];
+    _free[cls] = block;
+    _outstanding--;
+}
+
+bool MessageArena::do_is_equal(const pmr::memory_resource &other)
+    const noexcept
+{
+    return this == &other;
+}
+
+/*
+ * Returns false, and keeps the arena intact, if an object allocated from
+ * it is still alive.
+ */
+bool MessageArena::release(void)
+{
+    if (_outstanding != 0) {
+        _stats.pinned++;
+        return false;
+    }
+
+    _bump = 0;
+    bzero(_free, sizeof(_free));
+    _stats.releases++;
+
+    return true;
+}
+
+size_t MessageArena::used(void) const
+{
+    return _bump;
+}
+
+unsigned int MessageArena::outstanding(void) const
+{
+    return _outstanding;
+}
+
+const struct message_arena_stats &MessageArena::getStats(void) const
+{
+    return _stats;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,86 @@
+/*
+ * MessageArena.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef MESSAGEARENA_HXX
+#define MESSAGEARENA_HXX
+
+#include <stdint.h>
+#include <memory_resource>
+
+#define MESSAGE_ARENA_SIZE       4096
+#define MESSAGE_ARENA_CLASSES    5
+#define MESSAGE_ARENA_MIN_CLASS  16
+#define MESSAGE_ARENA_MAX_CLASS  (MESSAGE_ARENA_MIN_CLASS << \
+                                  (MESSAGE_ARENA_CLASSES - 1))
+
+using namespace std;
+
+struct message_arena_stats {
+    unsigned int allocs;
+    unsigned int reuses;
+    unsigned int fallbacks;
+    unsigned int releases;
+    unsigned int pinned;
+    size_t high_water;
+};
+
+/*
+ * A std::pmr memory resource for the objects created while handling one
+ * message. Small requests are rounded up to a power-of-two size class
+ * and carved from a fixed buffer with a bump pointer; freed blocks go on
+ * a per-class free list for reuse within the same message. release()
+ * drops everything in O(1) once the message has been handled. Requests
+ * that are too large, or that do not fit, go to the upstream resource.
+ */
+class MessageArena : public pmr::memory_resource {
+
+public:
+
+    MessageArena(pmr::memory_resource *upstream =
+                 pmr::new_delete_resource());
+    virtual ~MessageArena();
+
+    bool release(void);
+    size_t used(void) const;
+    unsigned int outstanding(void) const;
+    const struct message_arena_stats &getStats(void) const;
+
+protected:
+
+    virtual void *do_allocate(size_t bytes, size_t alignment);
+    virtual void do_deallocate(void *p, size_t bytes, size_t alignment);
+    virtual bool do_is_equal(const pmr::memory_resource &other)
+        const noexcept;
+
+private:
+
+    static unsigned int sizeClass(size_t bytes);
+    bool owns(const void *p) const;
+
+    struct free_block {
+        struct free_block *next;
+    };
+
+    alignas(max_align_t) uint8_t _buf[MESSAGE_ARENA_SIZE];
+    size_t _bump;
+    struct free_block *_free[MESSAGE_ARENA_CLASSES];
+    unsigned int _outstanding;
+    pmr::memory_resource *_upstream;
+    struct message_arena_stats _stats;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
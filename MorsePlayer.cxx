@@ -0,0 +1,253 @@
+/*
+ * MorsePlayer.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <ctype.h>
+#include <pico/stdlib.h>
+#include <MorsePlayer.hxx>
+
+static const char *morse_letters[] = {
+    ".-",   "-...", "-.-.", "-..",  ".",    "..-.", "--.",  "....",
+    "..",   ".---", "-.-",  ".-..", "--",   "-.",   "---",  ".--.",
+    "--.-", ".-.",  "...",  "-",    "..-",  "...-", ".--",  "-..-",
+    "-.--", "--..",
+};
+
+static const char *morse_digits[] = {
+    "-----", ".----", "..---", "...--", "....-",
+    ".....", "-....", "--...", "---..", "----.",
+};
+
+static const struct {
+    char c;
+    const char *code;
+} morse_punctuations[] = {
+    { '.',  ".-.-.-", },
+    { ',',  "--..--", },
+    { '?',  "..--..", },
+    { '\'', ".----.", },
+    { '!',  "-.-.--", },
+    { '/',  "-..-.",  },
+    { '(',  "-.--.",  },
+    { ')',  "-.--.-", },
+    { ':',  "---...", },
+    { '=',  "-...-",  },
+    { '+',  ".-.-.",  },
+    { '-',  "-....-", },
+    { '"',  ".-..-.", },
+    { '@',  ".--.-.", },
+};
+
+MorsePlayer::MorsePlayer(unsigned int pin, unsigned int unitUs)
+    : _pin(pin), _unitUs(unitUs)
+{
+    _head = 0;
+    _tail = 0;
+    _playing = false;
+    _overruns = 0;
+    _done = NULL;
+    _doneArg = NULL;
+    critical_section_init(&_lock);
+}
+
+MorsePlayer::~MorsePlayer()
+{
+
+}
+
+const char *MorsePlayer::lookup(char c)
+{
+    const char *code = NULL;
+
+    c = toupper(c);
+    if ((c >= 'A') && (c <= 'Z')) {
+        code = morse_letters[c - 'A'];
+    } else if ((c >= '0') && (c <= '9')) {
+        code = morse_digits[c - '0'];
+    } else {
+        for (unsigned int i = 0; i < count_of(morse_punctuations); i++) {
+            if (morse_punctuations[i].c == c) {
+                code = morse_punctuations[i].code;
+                break;
+            }
+        }
+    }
+
+    return code;
+}
+
+bool MorsePlayer::push(int32_t us)
+{
+    unsigned int next = (_tail + 1) % MORSE_PLAYER_SCHEDULE_SIZE;
+
+    if (next == _head) {
+        return false;
+    }
+
+    _schedule[_tail] = us;
+    _tail = next;
+
+    return true;
+}
+
+bool MorsePlayer::addText(const string &text)
+{
+    bool result = true;
+    bool start = false;
+    int32_t unit = _unitUs;
+    int32_t gap = 0;
+
+    critical_section_enter_blocking(&_lock);
+
+    for (string::const_iterator it = text.begin(); it != text.end(); it++) {
+        const char *code = NULL;
+
+        if (isspace(*it)) {
+            if (gap < (7 * unit)) {
+                gap = 7 * unit;
+            }
+            continue;
+        }
+
+        code = lookup(*it);
+        if (code == NULL) {
+            continue;
+        }
+
+        for (; *code != '\0'; code++) {
+            if ((gap > 0) && (push(-gap) == false)) {
+                result = false;
+                goto done;
+            }
+            if (push((*code == '-') ? (3 * unit) : unit) == false) {
+                result = false;
+                goto done;
+            }
+            gap = unit;
+        }
+
+        gap = 3 * unit;
+    }
+
+    if ((gap > 0) && (push(-gap) == false)) {
+        result = false;
+    }
+
+done:
+
+    if (result == false) {
+        _overruns++;
+    }
+
+    if ((_head != _tail) && (_playing == false)) {
+        _playing = true;
+        start = true;
+    }
+
+    critical_section_exit(&_lock);
+
+    if (start && (add_alarm_in_us(1, alarm_callback, this, true) < 0)) {
+        critical_section_enter_blocking(&_lock);
+        _playing = false;
+        critical_section_exit(&_lock);
+        result = false;
+    }
+
+    return result;
+}
+
+void MorsePlayer::clear(void)
+{
+    critical_section_enter_blocking(&_lock);
+    _head = _tail;
+    gpio_put(_pin, false);
+    critical_section_exit(&_lock);
+}
+
+bool MorsePlayer::isEmpty(void) const
+{
+    return (_head == _tail) && (_playing == false);
+}
+
+void MorsePlayer::setDone(morse_done_t done, void *arg)
+{
+    _done = done;
+    _doneArg = arg;
+}
+
+void MorsePlayer::setUnitUs(unsigned int unitUs)
+{
+    if (unitUs > 0) {
+        _unitUs = unitUs;
+    }
+}
+
+unsigned int MorsePlayer::unitUs(void) const
+{
+    return _unitUs;
+}
+
+unsigned int MorsePlayer::scheduled(void) const
+{
+    return (_tail + MORSE_PLAYER_SCHEDULE_SIZE - _head) %
+        MORSE_PLAYER_SCHEDULE_SIZE;
+}
+
+unsigned int MorsePlayer::overruns(void) const
+{
+    return _overruns;
+}
+
+int64_t MorsePlayer::alarm_callback(alarm_id_t id, void *user_data)
+{
+    MorsePlayer *player = (MorsePlayer *) user_data;
+
+    (void)(id);
+
+    return player->step();
+}
+
+/*
+ * Runs in the alarm IRQ. Returning a negative value re-arms the alarm
+ * relative to when it was due, so symbol timing does not drift with IRQ
+ * latency.
+ */
+int64_t MorsePlayer::step(void)
+{
+    int64_t next = 0;
+    int32_t us = 0;
+    bool finished = false;
+
+    critical_section_enter_blocking(&_lock);
+
+    if (_head == _tail) {
+        gpio_put(_pin, false);
+        finished = _playing;
+        _playing = false;
+    } else {
+        us = _schedule[_head];
+        _head = (_head + 1) % MORSE_PLAYER_SCHEDULE_SIZE;
+        gpio_put(_pin, us > 0);
+        next = (us > 0) ? -((int64_t) us) : (int64_t) us;
+    }
+
+    critical_section_exit(&_lock);
+
+    if (finished && _done) {
+        _done(_doneArg);
+    }
+
+    return next;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,83 @@
+/*
+ * MorsePlayer.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef MORSEPLAYER_HXX
+#define MORSEPLAYER_HXX
+
+#include <stdint.h>
+#include <pico/time.h>
+#include <pico/critical_section.h>
+#include <string>
+
+#define MORSE_PLAYER_SCHEDULE_SIZE 256
+#define MORSE_PLAYER_DEFAULT_UNIT_US 100000
+
+using namespace std;
+
+typedef void (*morse_done_t)(void *arg);
+
+/*
+ * Compiles text into an on/off duration schedule and plays it back on a
+ * GPIO from a hardware alarm, so no task has to sleep between symbols.
+ * Each schedule entry is a duration in microseconds: positive means the
+ * pin is driven high, negative means it is driven low.
+ */
+class MorsePlayer {
+
+public:
+
+    MorsePlayer(unsigned int pin,
+                unsigned int unitUs = MORSE_PLAYER_DEFAULT_UNIT_US);
+    ~MorsePlayer();
+
+    bool addText(const string &text);
+    void clear(void);
+    bool isEmpty(void) const;
+
+    // Called from the alarm IRQ when playback runs out
+    void setDone(morse_done_t done, void *arg);
+
+    void setUnitUs(unsigned int unitUs);
+    unsigned int unitUs(void) const;
+
+    unsigned int scheduled(void) const;
+    unsigned int overruns(void) const;
+
+private:
+
+    static const char *lookup(char c);
+    static int64_t alarm_callback(alarm_id_t id, void *user_data);
+
+    int64_t step(void);
+    bool push(int32_t us);
+
+    unsigned int _pin;
+    unsigned int _unitUs;
+
+    int32_t _schedule[MORSE_PLAYER_SCHEDULE_SIZE];
+    volatile unsigned int _head;
+    volatile unsigned int _tail;
+    volatile bool _playing;
+    critical_section_t _lock;
+
+    unsigned int _overruns;
+
+    morse_done_t _done;
+    void *_doneArg;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,376 @@
+/*
+ * PacketFilter.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <pico/stdlib.h>
+#include <SerialLink.hxx>
+#include <PacketFilter.hxx>
+
+enum {
+    FILTER_OUTSIDE,
+    FILTER_START2,
+    FILTER_LEN_MSB,
+    FILTER_LEN_LSB,
+    FILTER_PEEK,
+    FILTER_PASS,
+    FILTER_DROP,
+};
+
+// Protobuf wire types
+#define WT_VARINT   0
+#define WT_FIXED64  1
+#define WT_LEN      2
+#define WT_FIXED32  5
+
+// FromRadio
+#define FROMRADIO_ID          1
+#define FROMRADIO_PACKET      2
+
+// MeshPacket
+#define MESHPACKET_FROM       1
+#define MESHPACKET_TO         2
+#define MESHPACKET_CHANNEL    3
+#define MESHPACKET_DECODED    4
+#define MESHPACKET_ENCRYPTED  5
+
+// Data
+#define DATA_PORTNUM          1
+
+static bool get_varint(const uint8_t *p, size_t n, size_t &pos, uint64_t &v)
+{
+    v = 0;
+    for (unsigned int shift = 0; (pos < n) && (shift < 64); shift += 7) {
+        v |= (uint64_t) (p[pos] & 0x7f) << shift;
+        if ((p[pos++] & 0x80) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static inline uint32_t get_fixed32(const uint8_t *p)
+{
+    return
+        ((uint32_t) p[0]) |
+        ((uint32_t) p[1] << 8) |
+        ((uint32_t) p[2] << 16) |
+        ((uint32_t) p[3] << 24);
+}
+
+PacketFilter::PacketFilter()
+{
+    _drop = NULL;
+    _dropArg = NULL;
+    _enabled = true;
+    _state = FILTER_OUTSIDE;
+    _len = 0;
+    _left = 0;
+    _held = 0;
+    _head = 0;
+    _count = 0;
+    bzero(&_stats, sizeof(_stats));
+}
+
+PacketFilter::~PacketFilter()
+{
+
+}
+
+void PacketFilter::setDrop(packet_drop_t drop, void *arg)
+{
+    _drop = drop;
+    _dropArg = arg;
+}
+
+void PacketFilter::setEnabled(bool enabled)
+{
+    _enabled = enabled;
+}
+
+bool PacketFilter::isEnabled(void) const
+{
+    return _enabled;
+}
+
+/*
+ * Nothing is written past what the MeshPacket needs, so n < total just
+ * means more bytes are on their way.
+ */
+#define NEED_MORE()  return (n < total) ? PEEK_MORE : PEEK_PASS
+
+enum PacketFilter::Peek PacketFilter::peekPacket(const uint8_t *p, size_t n,
+                                                 size_t total,
+                                                 struct packet_peek &peek)
+{
+    size_t pos = 0;
+    uint64_t tag, v;
+
+    for (;;) {
+        if (pos >= n) {
+            NEED_MORE();
+        }
+        if (get_varint(p, n, pos, tag) == false) {
+            NEED_MORE();
+        }
+
+        switch (tag >> 3) {
+        case MESHPACKET_FROM:
+        case MESHPACKET_TO:
+            if ((tag & 0x7) != WT_FIXED32) {
+                return PEEK_PASS;
+            }
+            if ((pos + 4) > n) {
+                NEED_MORE();
+            }
+            if ((tag >> 3) == MESHPACKET_FROM) {
+                peek.from = get_fixed32(p + pos);
+            } else {
+                peek.to = get_fixed32(p + pos);
+            }
+            pos += 4;
+            continue;
+        case MESHPACKET_CHANNEL:
+            if ((tag & 0x7) != WT_VARINT) {
+                return PEEK_PASS;
+            }
+            if (get_varint(p, n, pos, v) == false) {
+                NEED_MORE();
+            }
+            peek.channel = v;
+            continue;
+        case MESHPACKET_DECODED:
+            if ((tag & 0x7) != WT_LEN) {
+                return PEEK_PASS;
+            }
+            if (get_varint(p, n, pos, v) == false) {
+                NEED_MORE();
+            }
+            // portnum is left out when it is 0
+            if (v == 0) {
+                peek.portnum = 0;
+                return PEEK_PACKET;
+            }
+            if (get_varint(p, n, pos, tag) == false) {
+                NEED_MORE();
+            }
+            if ((tag >> 3) != DATA_PORTNUM) {
+                peek.portnum = 0;
+                return PEEK_PACKET;
+            }
+            if (get_varint(p, n, pos, v) == false) {
+                NEED_MORE();
+            }
+            peek.portnum = v;
+            return PEEK_PACKET;
+        case MESHPACKET_ENCRYPTED:
+        default:
+            // Not decoded by the radio, or not in the expected order
+            return PEEK_PASS;
+        }
+    }
+}
+
+enum PacketFilter::Peek PacketFilter::peekFromRadio(const uint8_t *p,
+                                                    size_t n, size_t total,
+                                                    struct packet_peek &peek)
+{
+    size_t pos = 0;
+    uint64_t tag, v;
+
+    bzero(&peek, sizeof(peek));
+
+    for (;;) {
+        if (pos >= n) {
+            NEED_MORE();
+        }
+        if (get_varint(p, n, pos, tag) == false) {
+            NEED_MORE();
+        }
+
+        if (tag == ((FROMRADIO_ID << 3) | WT_VARINT)) {
+            if (get_varint(p, n, pos, v) == false) {
+                NEED_MORE();
+            }
+        } else if (tag == ((FROMRADIO_PACKET << 3) | WT_LEN)) {
+            if (get_varint(p, n, pos, v) == false) {
+                NEED_MORE();
+            }
+            if (v > (total - pos)) {
+                return PEEK_PASS;
+            }
+            return peekPacket(p + pos, ((n - pos) < v) ? (n - pos) : v, v,
+                              peek);
+        } else {
+            return PEEK_PASS;
+        }
+    }
+}
+
+#undef NEED_MORE
+
+size_t PacketFilter::room(void) const
+{
+    size_t used = _count + PACKET_FILTER_HOLD;
+
+    return (used < PACKET_FILTER_OUT) ? (PACKET_FILTER_OUT - used) : 0;
+}
+
+void PacketFilter::push(const uint8_t *buf, size_t size)
+{
+    for (size_t i = 0; (i < size) && (_count < PACKET_FILTER_OUT); i++) {
+        _out[(_head + _count) & (PACKET_FILTER_OUT - 1)] = buf[i];
+        _count++;
+    }
+}
+
+void PacketFilter::release(void)
+{
+    push(_hold, _held);
+    _held = 0;
+}
+
+void PacketFilter::decide(void)
+{
+    struct packet_peek peek;
+    size_t got = _held - 4;
+    enum Peek result;
+    bool drop = false;
+
+    result = peekFromRadio(_hold + 4, got, _len, peek);
+    if ((result == PEEK_MORE) &&
+        (got < _len) && (got < PACKET_FILTER_PEEK)) {
+        return;
+    }
+
+    if (result == PEEK_PACKET) {
+        _stats.packets++;
+        drop = (_drop != NULL) && _drop(peek, _dropArg);
+    } else if (result == PEEK_MORE) {
+        _stats.undecided++;
+    }
+
+    _left = _len - got;
+    if (drop) {
+        _stats.dropped++;
+        _stats.dropped_bytes += 4 + _len;
+        _held = 0;
+        _state = (_left > 0) ? FILTER_DROP : FILTER_OUTSIDE;
+    } else {
+        release();
+        _state = (_left > 0) ? FILTER_PASS : FILTER_OUTSIDE;
+    }
+}
+
+/*
+ * Callers keep size within room() so that nothing has to be dropped
+ * for lack of space.
+ */
+void PacketFilter::feed(const uint8_t *buf, size_t size)
+{
+    size_t i = 0, n;
+
+    while (i < size) {
+        switch (_state) {
+        case FILTER_OUTSIDE:
+            if (_enabled && (buf[i] == SERIAL_LINK_START1)) {
+                _hold[0] = buf[i];
+                _held = 1;
+                _state = FILTER_START2;
+            } else {
+                push(&buf[i], 1);
+            }
+            break;
+        case FILTER_START2:
+            if (buf[i] != SERIAL_LINK_START2) {
+                // Look at this byte again as the possible start
+                release();
+                _state = FILTER_OUTSIDE;
+                continue;
+            }
+            _hold[_held++] = buf[i];
+            _state = FILTER_LEN_MSB;
+            break;
+        case FILTER_LEN_MSB:
+            _hold[_held++] = buf[i];
+            _len = buf[i] << 8;
+            _state = FILTER_LEN_LSB;
+            break;
+        case FILTER_LEN_LSB:
+            _hold[_held++] = buf[i];
+            _len |= buf[i];
+            if ((_len == 0) || (_len > SERIAL_LINK_FRAME_MAX)) {
+                release();
+                _state = FILTER_OUTSIDE;
+            } else {
+                _stats.frames++;
+                _state = FILTER_PEEK;
+            }
+            break;
+        case FILTER_PEEK:
+            _hold[_held++] = buf[i];
+            decide();
+            break;
+        case FILTER_PASS:
+        case FILTER_DROP:
+            n = size - i;
+            if (n > _left) {
+                n = _left;
+            }
+            if (_state == FILTER_PASS) {
+                push(&buf[i], n);
+            }
+            _left -= n;
+            i += n;
+            if (_left == 0) {
+                _state = FILTER_OUTSIDE;
+            }
+            continue;
+        default:
+            _state = FILTER_OUTSIDE;
+            break;
+        }
+
+        i++;
+    }
+}
+
+size_t PacketFilter::pending(void) const
+{
+    return _count;
+}
+
+size_t PacketFilter::read(uint8_t *buf, size_t size)
+{
+    size_t n = 0;
+
+    while ((n < size) && (_count > 0)) {
+        buf[n++] = _out[_head];
+        _head = (_head + 1) & (PACKET_FILTER_OUT - 1);
+        _count--;
+    }
+
+    return n;
+}
+
+const struct packet_filter_stats &PacketFilter::getStats(void) const
+{
+    return _stats;
+}
+
+void PacketFilter::resetStats(void)
+{
+    bzero(&_stats, sizeof(_stats));
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
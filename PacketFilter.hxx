@@ -0,0 +1,107 @@
+/*
+ * PacketFilter.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef PACKETFILTER_HXX
+#define PACKETFILTER_HXX
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PACKET_FILTER_PEEK      48       // Header bytes held for a decision
+#define PACKET_FILTER_OUT_BITS  8
+#define PACKET_FILTER_OUT       (1 << PACKET_FILTER_OUT_BITS)
+#define PACKET_FILTER_HOLD      (4 + PACKET_FILTER_PEEK)
+#define PACKET_FILTER_CHUNK     64       // Read from the driver at a time
+
+struct packet_peek {
+    uint32_t from;
+    uint32_t to;
+    uint8_t channel;
+    uint16_t portnum;
+};
+
+struct packet_filter_stats {
+    uint32_t frames;
+    uint32_t packets;                    // Frames carrying a MeshPacket
+    uint32_t dropped;
+    uint32_t dropped_bytes;
+    uint32_t undecided;                  // Passed without finding portnum
+};
+
+typedef bool (*packet_drop_t)(const struct packet_peek &peek, void *arg);
+
+/*
+ * Sits between the serial driver and libmeshtastic and drops whole
+ * FromRadio frames before they are decoded. The first bytes of each
+ * frame are held back and scanned as raw protobuf for the MeshPacket's
+ * from, to, channel and portnum; nanopb writes fields in order, so
+ * these come before the payload. The callback decides on that alone,
+ * and the rest of the frame is then either passed through as it
+ * arrives or skipped without being copied. Bytes outside frames (the
+ * radio's debug log) and every other FromRadio variant pass unchanged.
+ */
+class PacketFilter {
+
+public:
+
+    PacketFilter();
+    ~PacketFilter();
+
+    void setDrop(packet_drop_t drop, void *arg);
+    void setEnabled(bool enabled);
+    bool isEnabled(void) const;
+
+    size_t room(void) const;
+    void feed(const uint8_t *buf, size_t size);
+    size_t pending(void) const;
+    size_t read(uint8_t *buf, size_t size);
+
+    const struct packet_filter_stats &getStats(void) const;
+    void resetStats(void);
+
+private:
+
+    enum Peek {
+        PEEK_MORE,
+        PEEK_PASS,
+        PEEK_PACKET,
+    };
+
+    static enum Peek peekFromRadio(const uint8_t *p, size_t n, size_t total,
+                                   struct packet_peek &peek);
+    static enum Peek peekPacket(const uint8_t *p, size_t n, size_t total,
+                                struct packet_peek &peek);
+
+    void push(const uint8_t *buf, size_t size);
+    void release(void);
+    void decide(void);
+
+    packet_drop_t _drop;
+    void *_dropArg;
+    bool _enabled;
+    uint8_t _state;
+    uint16_t _len;
+    uint16_t _left;                      // Of the frame after the hold
+    uint8_t _hold[PACKET_FILTER_HOLD];
+    size_t _held;
+    uint8_t _out[PACKET_FILTER_OUT];
+    size_t _head;
+    size_t _count;
+    struct packet_filter_stats _stats;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
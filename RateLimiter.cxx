@@ -0,0 +1,185 @@
+/*
+ * RateLimiter.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <pico/stdlib.h>
+#include <RateLimiter.hxx>
+
+#define TOKEN  256
+
+static const uint16_t bursts[2] = {
+    RATE_LIMIT_QUERY_BURST * TOKEN,
+    RATE_LIMIT_ACTION_BURST * TOKEN,
+};
+
+static const uint32_t periods[2] = {
+    RATE_LIMIT_QUERY_MS,
+    RATE_LIMIT_ACTION_MS,
+};
+
+static const uint16_t global_bursts[2] = {
+    RATE_LIMIT_GLOBAL_QUERY_BURST * TOKEN,
+    RATE_LIMIT_GLOBAL_ACTION_BURST * TOKEN,
+};
+
+static const uint32_t global_periods[2] = {
+    RATE_LIMIT_GLOBAL_QUERY_MS,
+    RATE_LIMIT_GLOBAL_ACTION_MS,
+};
+
+RateLimiter::RateLimiter()
+{
+    clear();
+    bzero(&_stats, sizeof(_stats));
+}
+
+RateLimiter::~RateLimiter()
+{
+
+}
+
+void RateLimiter::clear(void)
+{
+    uint32_t now = time_us_64() / 1000;
+
+    bzero(_nodes, sizeof(_nodes));
+    _count = 0;
+    for (unsigned int cls = 0; cls < 2; cls++) {
+        _globalTokens[cls] = global_bursts[cls];
+        _globalRefillMs[cls] = now;
+    }
+}
+
+struct rate_limit_node *RateLimiter::lookup(uint32_t node_num, uint32_t now)
+{
+    struct rate_limit_node *node = NULL;
+    unsigned int oldest = 0;
+
+    for (unsigned int i = 0; i < _count; i++) {
+        if (_nodes[i].node_num == node_num) {
+            return &_nodes[i];
+        }
+        if ((now - _nodes[i].last_ms) > (now - _nodes[oldest].last_ms)) {
+            oldest = i;
+        }
+    }
+
+    if (_count < RATE_LIMIT_NODES) {
+        node = &_nodes[_count++];
+    } else {
+        node = &_nodes[oldest];
+        _stats.evictions++;
+    }
+
+    bzero(node, sizeof(*node));
+    node->node_num = node_num;
+    for (unsigned int cls = 0; cls < 2; cls++) {
+        node->tokens[cls] = bursts[cls];
+        node->refill_ms[cls] = now;
+    }
+
+    return node;
+}
+
+void RateLimiter::refill(uint16_t &tokens, uint32_t &refill_ms,
+                         uint16_t burst, uint32_t period, uint32_t now)
+{
+    uint32_t elapsed = now - refill_ms;
+    uint32_t added;
+
+    added = (uint64_t) elapsed * TOKEN / period;
+    if (added == 0) {
+        return;
+    }
+
+    // Only advance by the time the added tokens account for
+    refill_ms += (uint64_t) added * period / TOKEN;
+    added += tokens;
+    tokens = (added > burst) ? burst : added;
+}
+
+bool RateLimiter::admit(uint32_t node_num, enum Class cls, bool trusted)
+{
+    uint32_t now = time_us_64() / 1000;
+    struct rate_limit_node *node = lookup(node_num, now);
+    bool result = false;
+
+    node->last_ms = now;
+    refill(node->tokens[cls], node->refill_ms[cls], bursts[cls],
+           periods[cls], now);
+    refill(_globalTokens[cls], _globalRefillMs[cls], global_bursts[cls],
+           global_periods[cls], now);
+
+    // A command the global bucket refuses costs the sender nothing
+    if (node->tokens[cls] < TOKEN) {
+        // Over its own budget
+    } else if (trusted) {
+        node->tokens[cls] -= TOKEN;
+        _stats.classes[cls].admitted++;
+        result = true;
+    } else if (_globalTokens[cls] < TOKEN) {
+        _stats.classes[cls].global++;
+    } else {
+        node->tokens[cls] -= TOKEN;
+        _globalTokens[cls] -= TOKEN;
+        _stats.classes[cls].admitted++;
+        result = true;
+    }
+
+    if (result == false) {
+        node->rejected++;
+        _stats.classes[cls].rejected++;
+    }
+
+    return result;
+}
+
+unsigned int RateLimiter::nodes(void) const
+{
+    return _count;
+}
+
+const struct rate_limit_node &RateLimiter::node(unsigned int index) const
+{
+    return _nodes[index % RATE_LIMIT_NODES];
+}
+
+const struct rate_limit_stats &RateLimiter::getStats(void) const
+{
+    return _stats;
+}
+
+void RateLimiter::resetStats(void)
+{
+    bzero(&_stats, sizeof(_stats));
+}
+
+const char *RateLimiter::classStr(unsigned int cls)
+{
+    const char *s = "unknown";
+
+    switch (cls) {
+    case RATE_QUERY:
+        s = "query";
+        break;
+    case RATE_ACTION:
+        s = "action";
+        break;
+    default:
+        break;
+    }
+
+    return s;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,101 @@
+/*
+ * RateLimiter.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef RATELIMITER_HXX
+#define RATELIMITER_HXX
+
+#include <stdint.h>
+
+#define RATE_LIMIT_NODES          16
+
+// Burst size and the interval at which one token comes back
+#define RATE_LIMIT_QUERY_BURST    8
+#define RATE_LIMIT_QUERY_MS       3000
+#define RATE_LIMIT_ACTION_BURST   4
+#define RATE_LIMIT_ACTION_MS      15000
+
+// Shared by all senders, so rotating node numbers buys nothing
+#define RATE_LIMIT_GLOBAL_QUERY_BURST   16
+#define RATE_LIMIT_GLOBAL_QUERY_MS      500
+#define RATE_LIMIT_GLOBAL_ACTION_BURST  8
+#define RATE_LIMIT_GLOBAL_ACTION_MS     5000
+
+struct rate_class_stats {
+    unsigned int admitted;
+    unsigned int rejected;
+    unsigned int global;                 // Of the rejected, by the global
+};
+
+struct rate_limit_stats {
+    struct rate_class_stats classes[2];
+    unsigned int evictions;
+};
+
+struct rate_limit_node {
+    uint32_t node_num;
+    uint32_t last_ms;
+    uint16_t tokens[2];                  // In 1/256 of a token
+    uint32_t refill_ms[2];
+    unsigned int rejected;
+};
+
+/*
+ * Token buckets per sender, one for cheap queries and one for actions
+ * that drive hardware or write flash, in a fixed table of the most
+ * recently seen nodes. A node's buckets start full; when the table is
+ * full the least recently seen node makes room. Since a forged sender
+ * gets a fresh burst that way, every command from a sender that is not
+ * a verified roster member must also take a token from a global bucket
+ * of its class; admins and mates only answer to their own buckets, so a
+ * flood cannot lock them out.
+ */
+class RateLimiter {
+
+public:
+
+    enum Class {
+        RATE_QUERY,
+        RATE_ACTION,
+    };
+
+    RateLimiter();
+    ~RateLimiter();
+
+    bool admit(uint32_t node_num, enum Class cls, bool trusted = false);
+    void clear(void);
+
+    unsigned int nodes(void) const;
+    const struct rate_limit_node &node(unsigned int index) const;
+    const struct rate_limit_stats &getStats(void) const;
+    void resetStats(void);
+
+    static const char *classStr(unsigned int cls);
+
+private:
+
+    struct rate_limit_node *lookup(uint32_t node_num, uint32_t now);
+    static void refill(uint16_t &tokens, uint32_t &refill_ms,
+                       uint16_t burst, uint32_t period, uint32_t now);
+
+    struct rate_limit_node _nodes[RATE_LIMIT_NODES];
+    uint16_t _globalTokens[2];
+    uint32_t _globalRefillMs[2];
+    unsigned int _count;
+    struct rate_limit_stats _stats;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,234 @@
+/*
+ * ReplyFramer.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <ReplyFramer.hxx>
+
+// Room for the "[i/n] " prefix with single-digit counts
+#define REPLY_FRAME_PREFIX_LEN  6
+
+// Ends the last chunk of a reply that needed more than the maximum
+#define REPLY_FRAME_MORE        "..."
+
+static const struct {
+    const char *word;
+    const char *abbr;
+} dictionary[] = {
+    { "temperature", "temp", },
+    { "humidity", "hum", },
+    { "pressure", "pres", },
+    { "voltage", "volt", },
+    { "battery", "batt", },
+    { "channel", "ch", },
+    { "fanspeed", "fan", },
+    { "operational", "ok", },
+    { "minutes", "min", },
+    { "seconds", "s", },
+    { "hours", "h", },
+};
+
+ReplyFramer::ReplyFramer(size_t limit)
+{
+    _limit = limit;
+    _compact = false;
+    bzero(&_stats, sizeof(_stats));
+}
+
+ReplyFramer::~ReplyFramer()
+{
+
+}
+
+/*
+ * Whole-word dictionary substitution; also squeezes runs of blanks and
+ * drops blanks at the end of lines.
+ */
+string ReplyFramer::compactText(const string &text)
+{
+    string out;
+    size_t i = 0, j;
+    bool matched;
+
+    out.reserve(text.size());
+
+    while (i < text.size()) {
+        if (isalpha((unsigned char) text[i]) &&
+            ((i == 0) || !isalnum((unsigned char) text[i - 1]))) {
+            for (j = i; (j < text.size()) &&
+                     isalpha((unsigned char) text[j]); j++);
+
+            matched = false;
+            for (size_t k = 0; k < sizeof(dictionary) / sizeof(dictionary[0]);
+                 k++) {
+                if ((strlen(dictionary[k].word) == (j - i)) &&
+                    (strncasecmp(&text[i], dictionary[k].word, j - i) == 0)) {
+                    out.append(dictionary[k].abbr);
+                    matched = true;
+                    break;
+                }
+            }
+            if (matched == false) {
+                out.append(text, i, j - i);
+            }
+            i = j;
+        } else if ((text[i] == ' ') || (text[i] == '\t')) {
+            for (j = i; (j < text.size()) &&
+                     ((text[j] == ' ') || (text[j] == '\t')); j++);
+            if ((j < text.size()) && (text[j] != '\n') && !out.empty() &&
+                (out.back() != '\n')) {
+                out.push_back(' ');
+            }
+            i = j;
+        } else {
+            out.push_back(text[i]);
+            i++;
+        }
+    }
+
+    return out;
+}
+
+/*
+ * Greedily packs whole lines into chunks of at most budget bytes; a
+ * single line that is too long is broken at its last blank that fits,
+ * or hard at the budget. Returns the number of chunks needed, which may
+ * exceed max (only the first max are recorded).
+ */
+unsigned int ReplyFramer::split(const string &text, size_t budget,
+                                size_t *starts, size_t *ends,
+                                unsigned int max) const
+{
+    unsigned int n = 0;
+    size_t pos = 0, end, nl, sp;
+
+    while (pos < text.size()) {
+        end = pos + budget;
+        if (end >= text.size()) {
+            end = text.size();
+        } else {
+            nl = text.rfind('\n', end);
+            if ((nl != string::npos) && (nl > pos)) {
+                end = nl;
+            } else {
+                sp = text.rfind(' ', end);
+                if ((sp != string::npos) && (sp > pos)) {
+                    end = sp;
+                }
+            }
+        }
+
+        if (n < max) {
+            starts[n] = pos;
+            ends[n] = end;
+        }
+        n++;
+
+        pos = end;
+        while ((pos < text.size()) &&
+               ((text[pos] == '\n') || (text[pos] == ' '))) {
+            pos++;
+        }
+    }
+
+    return n;
+}
+
+unsigned int ReplyFramer::frame(const string &message, reply_chunk_t emit,
+                                void *arg)
+{
+    string text = _compact ? compactText(message) : message;
+    size_t starts[REPLY_FRAME_MAX_CHUNKS];
+    size_t ends[REPLY_FRAME_MAX_CHUNKS];
+    char buf[REPLY_FRAME_MAX + 1];
+    unsigned int n, sent = 0;
+    size_t len, bytes = 0;
+    bool truncated = false;
+
+    if (text.size() <= _limit) {
+        n = 1;
+        if (emit(text.c_str(), 0, 1, arg)) {
+            sent++;
+            bytes = text.size();
+        }
+        goto done;
+    }
+
+    n = split(text, _limit - REPLY_FRAME_PREFIX_LEN,
+              starts, ends, REPLY_FRAME_MAX_CHUNKS);
+    if (n > REPLY_FRAME_MAX_CHUNKS) {
+        n = REPLY_FRAME_MAX_CHUNKS;
+        truncated = true;
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+        len = snprintf(buf, sizeof(buf), "[%u/%u] ", i + 1, n);
+        memcpy(&buf[len], &text[starts[i]], ends[i] - starts[i]);
+        len += ends[i] - starts[i];
+        buf[len] = '\0';
+
+        if (truncated && (i == (n - 1))) {
+            if (len > (_limit - (sizeof(REPLY_FRAME_MORE) - 1))) {
+                len = _limit - (sizeof(REPLY_FRAME_MORE) - 1);
+            }
+            memcpy(&buf[len], REPLY_FRAME_MORE, sizeof(REPLY_FRAME_MORE));
+            len += sizeof(REPLY_FRAME_MORE) - 1;
+        }
+
+        if (emit(buf, i, n, arg) == false) {
+            break;
+        }
+        sent++;
+        bytes += len;
+    }
+
+done:
+
+    taskENTER_CRITICAL();
+    _stats.replies++;
+    if (n > 1) {
+        _stats.framed++;
+    }
+    if (truncated) {
+        _stats.truncated++;
+    }
+    _stats.packets_plain += (message.size() + _limit - 1) / _limit;
+    _stats.packets += sent;
+    _stats.bytes_in += message.size();
+    _stats.bytes_out += bytes;
+    taskEXIT_CRITICAL();
+
+    return sent;
+}
+
+void ReplyFramer::setCompact(bool compact)
+{
+    _compact = compact;
+}
+
+bool ReplyFramer::compact(void) const
+{
+    return _compact;
+}
+
+const struct reply_frame_stats &ReplyFramer::getStats(void) const
+{
+    return _stats;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
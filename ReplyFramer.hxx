@@ -0,0 +1,80 @@
+/*
+ * ReplyFramer.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef REPLYFRAMER_HXX
+#define REPLYFRAMER_HXX
+
+#include <string>
+#include <libmeshtastic.h>
+
+#define REPLY_FRAME_MAX         meshtastic_Constants_DATA_PAYLOAD_LEN
+#define REPLY_FRAME_MAX_CHUNKS  6
+#define REPLY_FRAME_GAP_MS      1500
+
+using namespace std;
+
+struct reply_frame_stats {
+    unsigned int replies;
+    unsigned int framed;
+    unsigned int truncated;
+    unsigned int packets_plain;
+    unsigned int packets;
+    unsigned int bytes_in;
+    unsigned int bytes_out;
+};
+
+typedef bool (*reply_chunk_t)(const char *chunk,
+                              unsigned int index, unsigned int count,
+                              void *arg);
+
+/*
+ * Splits a reply that does not fit one text payload into at most
+ * REPLY_FRAME_MAX_CHUNKS numbered chunks ("[1/3] ..."), breaking at line
+ * boundaries where possible. With compaction on, whole-word
+ * abbreviations from a fixed dictionary are applied and runs of blanks
+ * are squeezed first, so that fewer packets are needed. The chunks are
+ * handed to the emit callback in order; a reply that needs more chunks
+ * than that is cut short and its last chunk ends in "...".
+ */
+class ReplyFramer {
+
+public:
+
+    ReplyFramer(size_t limit = REPLY_FRAME_MAX);
+    ~ReplyFramer();
+
+    unsigned int frame(const string &message, reply_chunk_t emit, void *arg);
+
+    void setCompact(bool compact);
+    bool compact(void) const;
+
+    const struct reply_frame_stats &getStats(void) const;
+
+    static string compactText(const string &text);
+
+private:
+
+    unsigned int split(const string &text, size_t budget,
+                       size_t *starts, size_t *ends,
+                       unsigned int max) const;
+
+    size_t _limit;
+    bool _compact;
+    struct reply_frame_stats _stats;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
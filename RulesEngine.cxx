@@ -0,0 +1,704 @@
+/*
+ * RulesEngine.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sstream>
+#include <vector>
+#include <pico/time.h>
+#include <task.h>
+#include <RulesEngine.hxx>
+
+static const char *input_names[RulesEngine::RULE_IN_MAX] = {
+    "temp",
+    "humidity",
+    "pressure",
+    "button",
+};
+
+static const char *cmp_names[RulesEngine::RULE_CMP_MAX] = {
+    ">",
+    ">=",
+    "<",
+    "<=",
+    "==",
+};
+
+static const char *mode_names[] = {
+    "ac",
+    "heater",
+    "dehumidifier",
+    "auto",
+};
+
+RulesEngine::RulesEngine()
+{
+    bzero(_rules, sizeof(_rules));
+    bzero(_stats, sizeof(_stats));
+    bzero(_state, sizeof(_state));
+    _n = 0;
+    bzero(_values, sizeof(_values));
+    bzero(_valid, sizeof(_valid));
+    _dirty = 0;
+    bzero(_inputRules, sizeof(_inputRules));
+    _action = NULL;
+    _actionArg = NULL;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    _lock = xSemaphoreCreateMutexStatic(&_lockBuffer);
+#else
+    _lock = xSemaphoreCreateMutex();
+#endif
+}
+
+RulesEngine::~RulesEngine()
+{
+
+}
+
+void RulesEngine::setAction(rule_action_t action, void *arg)
+{
+    _action = action;
+    _actionArg = arg;
+}
+
+/*
+ * Rebuilds the input -> rules index and resets the evaluation state;
+ * rule changes are rare, evaluation is not.
+ */
+void RulesEngine::reindex(void)
+{
+    taskENTER_CRITICAL();
+    bzero(_inputRules, sizeof(_inputRules));
+    for (unsigned int i = 0; i < _n; i++) {
+        if (_rules[i].flags & RULE_ENABLED) {
+            _inputRules[_rules[i].input] |= (1 << i);
+            _dirty |= (1 << _rules[i].input);
+        }
+    }
+    bzero(_state, sizeof(_state));
+    taskEXIT_CRITICAL();
+}
+
+int RulesEngine::add(const struct nvm_rule_entry &rule)
+{
+    int ret = 0;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    if ((_n >= RULES_MAX) || (rule.input >= RULE_IN_MAX) ||
+        (rule.cmp >= RULE_CMP_MAX) || (bodySize(rule.op) == (size_t) -1)) {
+        ret = -1;
+        goto done;
+    }
+
+    _rules[_n] = rule;
+    bzero(&_stats[_n], sizeof(_stats[_n]));
+    ret = _n;
+    _n++;
+    reindex();
+
+done:
+
+    xSemaphoreGive(_lock);
+
+    return ret;
+}
+
+bool RulesEngine::remove(unsigned int index)
+{
+    bool result = false;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    if (index >= _n) {
+        goto done;
+    }
+
+    for (unsigned int i = index; (i + 1) < _n; i++) {
+        _rules[i] = _rules[i + 1];
+        _stats[i] = _stats[i + 1];
+    }
+    _n--;
+    reindex();
+
+    result = true;
+
+done:
+
+    xSemaphoreGive(_lock);
+
+    return result;
+}
+
+bool RulesEngine::enable(unsigned int index, bool enabled)
+{
+    bool result = false;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    if (index >= _n) {
+        goto done;
+    }
+
+    if (enabled) {
+        _rules[index].flags |= RULE_ENABLED;
+    } else {
+        _rules[index].flags &= ~RULE_ENABLED;
+    }
+    reindex();
+
+    result = true;
+
+done:
+
+    xSemaphoreGive(_lock);
+
+    return result;
+}
+
+void RulesEngine::clear(void)
+{
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    _n = 0;
+    reindex();
+    xSemaphoreGive(_lock);
+}
+
+unsigned int RulesEngine::count(void) const
+{
+    return _n;
+}
+
+const struct nvm_rule_entry &RulesEngine::rule(unsigned int index) const
+{
+    return _rules[index];
+}
+
+const struct rule_stats &RulesEngine::stats(unsigned int index) const
+{
+    return _stats[index];
+}
+
+void RulesEngine::update(enum Input input, int32_t value)
+{
+    if ((input < 0) || (input >= RULE_IN_MAX)) {
+        return;
+    }
+
+    taskENTER_CRITICAL();
+    _values[input] = value;
+    _valid[input] = true;
+    _dirty |= (1 << input);
+    taskEXIT_CRITICAL();
+}
+
+static bool compare(uint8_t cmp, int32_t value, int32_t threshold)
+{
+    bool result = false;
+
+    switch (cmp) {
+    case RulesEngine::RULE_CMP_GT:
+        result = value > threshold;
+        break;
+    case RulesEngine::RULE_CMP_GE:
+        result = value >= threshold;
+        break;
+    case RulesEngine::RULE_CMP_LT:
+        result = value < threshold;
+        break;
+    case RulesEngine::RULE_CMP_LE:
+        result = value <= threshold;
+        break;
+    case RulesEngine::RULE_CMP_EQ:
+        result = value == threshold;
+        break;
+    default:
+        break;
+    }
+
+    return result;
+}
+
+void RulesEngine::evaluate(unsigned int i, uint32_t now)
+{
+    const struct nvm_rule_entry *rule = &_rules[i];
+    uint64_t t0 = time_us_64();
+    uint32_t elapsed;
+    bool cond;
+
+    cond = _valid[rule->input] &&
+        compare(rule->cmp, _values[rule->input], rule->threshold);
+    if (cond == false) {
+        _state[i].fired = false;
+    } else if (_state[i].cond == false) {
+        _state[i].since = now;
+    }
+    _state[i].cond = cond;
+
+    if (cond && (_state[i].fired == false) &&
+        ((now - _state[i].since) >= rule->hold_secs)) {
+        _state[i].fired = true;
+        _stats[i].fires++;
+        if (_action) {
+            _action(*rule, _actionArg);
+        }
+    }
+
+    elapsed = time_us_64() - t0;
+    _stats[i].evals++;
+    _stats[i].eval_us_total += elapsed;
+    if (elapsed > _stats[i].eval_us_max) {
+        _stats[i].eval_us_max = elapsed;
+    }
+}
+
+void RulesEngine::run(void)
+{
+    uint32_t now = time_us_64() / 1000000;
+    uint32_t dirty, mask = 0;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+
+    taskENTER_CRITICAL();
+    dirty = _dirty;
+    _dirty = 0;
+    taskEXIT_CRITICAL();
+
+    for (unsigned int in = 0; in < RULE_IN_MAX; in++) {
+        if (dirty & (1 << in)) {
+            mask |= _inputRules[in];
+        }
+    }
+
+    for (unsigned int i = 0; i < _n; i++) {
+        if (_state[i].cond && (_state[i].fired == false) &&
+            ((now - _state[i].since) >= _rules[i].hold_secs)) {
+            mask |= (1 << i);
+        }
+    }
+
+    for (unsigned int i = 0; i < _n; i++) {
+        if (mask & (1 << i)) {
+            evaluate(i, now);
+        }
+    }
+
+    // A button press is an event, not a level: re-arm for the next one
+    if (dirty & (1 << RULE_IN_BUTTON)) {
+        taskENTER_CRITICAL();
+        if ((_dirty & (1 << RULE_IN_BUTTON)) == 0) {
+            _values[RULE_IN_BUTTON] = 0;
+            _dirty |= (1 << RULE_IN_BUTTON);
+        }
+        taskEXIT_CRITICAL();
+    }
+
+    xSemaphoreGive(_lock);
+}
+
+TickType_t RulesEngine::nextDeadline(void) const
+{
+    uint32_t now = time_us_64() / 1000000;
+    uint32_t wait, elapsed;
+    uint32_t secs = UINT32_MAX;
+    TickType_t ticks;
+
+    if (_dirty) {
+        return 0;
+    }
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    for (unsigned int i = 0; i < _n; i++) {
+        if ((_state[i].cond == false) || _state[i].fired) {
+            continue;
+        }
+
+        elapsed = now - _state[i].since;
+        wait = (elapsed >= _rules[i].hold_secs) ?
+            0 : (_rules[i].hold_secs - elapsed);
+        if (wait < secs) {
+            secs = wait;
+        }
+    }
+    xSemaphoreGive(_lock);
+
+    if (secs == UINT32_MAX) {
+        return portMAX_DELAY;
+    }
+
+    ticks = pdMS_TO_TICKS(secs * 1000);
+
+    return ticks;
+}
+
+size_t RulesEngine::bodySize(uint8_t op)
+{
+    size_t size = (size_t) -1;
+
+    switch (op) {
+    case MR_OP_TV:
+        size = sizeof(struct mr_tv_req);
+        break;
+    case MR_OP_AC:
+        size = sizeof(struct mr_ac_req);
+        break;
+    case MR_OP_BUZZ:
+        size = sizeof(struct mr_buzz_req);
+        break;
+    case MR_OP_RESET:
+        size = 0;
+        break;
+    default:
+        break;
+    }
+
+    return size;
+}
+
+static bool parse_tenths(const string &s, int32_t &value)
+{
+    char *end = NULL;
+    double v;
+
+    v = strtod(s.c_str(), &end);
+    if (s.empty() || (end == NULL) || (*end != '\0')) {
+        return false;
+    }
+
+    value = (int32_t) ((v * 10.0) + ((v < 0) ? -0.5 : 0.5));
+
+    return true;
+}
+
+static bool parse_number(const string &s, unsigned long &value)
+{
+    char *end = NULL;
+
+    value = strtoul(s.c_str(), &end, 10);
+
+    return !s.empty() && (end != NULL) && (*end == '\0');
+}
+
+static const struct {
+    const char *name;
+    unsigned long scale;
+} units[] = {
+    { "s", 1, }, { "sec", 1, }, { "secs", 1, },
+    { "m", 60, }, { "min", 60, }, { "mins", 60, },
+    { "h", 3600, }, { "hr", 3600, }, { "hrs", 3600, },
+};
+
+static bool parse_unit(const string &s, unsigned long &scale)
+{
+    for (unsigned int k = 0; k < sizeof(units) / sizeof(units[0]); k++) {
+        if (s == units[k].name) {
+            scale = units[k].scale;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * A count with an optional unit, either attached ("10m", "10min") or as
+ * the next token ("10 min"), in which case *used is bumped.
+ */
+static bool parse_secs(const string &s, const string *next,
+                       unsigned long &secs, unsigned int *used)
+{
+    size_t k = s.find_first_not_of("0123456789");
+    unsigned long scale = 1;
+
+    if (k == 0) {
+        return false;
+    } else if (k != string::npos) {
+        if (parse_unit(s.substr(k), scale) == false) {
+            return false;
+        }
+    } else if ((next != NULL) && parse_unit(*next, scale)) {
+        (*used)++;
+    }
+
+    if (parse_number(s.substr(0, k), secs) == false) {
+        return false;
+    }
+    secs *= scale;
+
+    return secs <= 0xffff;
+}
+
+/*
+ * [if] [env] <temp|humidity|pressure|button> <cmp> <value>
+ * [for <n>[ ][s|m|min|h]] [then] <action>, where action is one of
+ *   ac [on|off] [mode <ac|heater|dehumidifier|auto>] [temp <n>]
+ *      [fanspeed <n>] [fandir <n>]
+ *   tv [on|off] [vol <n>] [chan <n>]
+ *   buzz <ms>
+ *   reset
+ * Commas and colons are treated as blanks, so "if env temp > 28 for 10 min
+ * then ac on, mode ac, temp 25" and "temp > 28 for 10m: ac on mode ac
+ * temp 25" are the same rule; button values are the press duration in
+ * seconds.
+ */
+bool RulesEngine::parse(const string &text, struct nvm_rule_entry &rule)
+{
+    string s = text;
+    istringstream iss;
+    vector<string> tok;
+    string t;
+    unsigned int i = 0;
+    unsigned int k;
+    int32_t threshold;
+    unsigned long n;
+    struct mr_tv_req tv;
+    struct mr_ac_req ac;
+    struct mr_buzz_req bz;
+
+    for (k = 0; k < s.size(); k++) {
+        if ((s[k] == ',') || (s[k] == ':')) {
+            s[k] = ' ';
+        } else {
+            s[k] = tolower((unsigned char) s[k]);
+        }
+    }
+    iss.str(s);
+    while (iss >> t) {
+        tok.push_back(t);
+    }
+
+    bzero(&rule, sizeof(rule));
+    rule.flags = RULE_ENABLED;
+
+    if ((i < tok.size()) && (tok[i] == "if")) {
+        i++;
+    }
+    if ((i < tok.size()) && (tok[i] == "env")) {
+        i++;
+    }
+
+    if ((i + 3) > tok.size()) {
+        return false;
+    }
+
+    for (k = 0; k < RULE_IN_MAX; k++) {
+        if (tok[i] == input_names[k]) {
+            break;
+        }
+    }
+    if (k == RULE_IN_MAX) {
+        return false;
+    }
+    rule.input = k;
+    i++;
+
+    if (tok[i] == "=") {
+        tok[i] = "==";
+    }
+    for (k = 0; k < RULE_CMP_MAX; k++) {
+        if (tok[i] == cmp_names[k]) {
+            break;
+        }
+    }
+    if (k == RULE_CMP_MAX) {
+        return false;
+    }
+    rule.cmp = k;
+    i++;
+
+    if ((parse_tenths(tok[i], threshold) == false) ||
+        (threshold < INT16_MIN) || (threshold > INT16_MAX)) {
+        return false;
+    }
+    rule.threshold = threshold;
+    i++;
+
+    if ((i < tok.size()) && (tok[i] == "for")) {
+        k = 2;
+        if (((i + 1) >= tok.size()) ||
+            !parse_secs(tok[i + 1],
+                        ((i + 2) < tok.size()) ? &tok[i + 2] : NULL,
+                        n, &k)) {
+            return false;
+        }
+        rule.hold_secs = n;
+        i += k;
+    }
+
+    if ((i < tok.size()) && (tok[i] == "then")) {
+        i++;
+    }
+
+    if (i >= tok.size()) {
+        return false;
+    }
+
+    if (tok[i] == "ac") {
+        bzero(&ac, sizeof(ac));
+        for (i++; i < tok.size(); i++) {
+            if (tok[i] == "on") {
+                ac.set |= MR_AC_SET_POWER;
+                ac.power = 1;
+            } else if (tok[i] == "off") {
+                ac.set |= MR_AC_SET_POWER;
+                ac.power = 0;
+            } else if (((i + 1) < tok.size()) && (tok[i] == "mode")) {
+                i++;
+                for (k = 0; k < sizeof(mode_names) / sizeof(mode_names[0]);
+                     k++) {
+                    if (tok[i] == mode_names[k]) {
+                        break;
+                    }
+                }
+                if (k == sizeof(mode_names) / sizeof(mode_names[0])) {
+                    return false;
+                }
+                ac.set |= MR_AC_SET_MODE;
+                ac.mode = k;
+            } else if (((i + 1) < tok.size()) && (tok[i] == "temp") &&
+                       parse_number(tok[i + 1], n) && (n >= 20) && (n <= 30)) {
+                i++;
+                ac.set |= MR_AC_SET_TEMP;
+                ac.temp = n;
+            } else if (((i + 1) < tok.size()) && (tok[i] == "fanspeed") &&
+                       parse_number(tok[i + 1], n) && (n <= 5)) {
+                i++;
+                ac.set |= MR_AC_SET_FANSPEED;
+                ac.fanspeed = n;
+            } else if (((i + 1) < tok.size()) && (tok[i] == "fandir") &&
+                       parse_number(tok[i + 1], n) && (n <= 6)) {
+                i++;
+                ac.set |= MR_AC_SET_FANDIR;
+                ac.fandir = n;
+            } else {
+                return false;
+            }
+        }
+        if (ac.set == 0) {
+            return false;
+        }
+        rule.op = MR_OP_AC;
+        memcpy(rule.body, &ac, sizeof(ac));
+    } else if (tok[i] == "tv") {
+        bzero(&tv, sizeof(tv));
+        for (i++; i < tok.size(); i++) {
+            if (tok[i] == "on") {
+                tv.set |= MR_TV_SET_POWER;
+                tv.power = 1;
+            } else if (tok[i] == "off") {
+                tv.set |= MR_TV_SET_POWER;
+                tv.power = 0;
+            } else if (((i + 1) < tok.size()) && (tok[i] == "vol") &&
+                       parse_number(tok[i + 1], n) && (n <= 100)) {
+                i++;
+                tv.set |= MR_TV_SET_VOL;
+                tv.vol = n;
+            } else if (((i + 1) < tok.size()) && (tok[i] == "chan") &&
+                       parse_number(tok[i + 1], n) && (n <= 999)) {
+                i++;
+                tv.set |= MR_TV_SET_CHAN;
+                tv.chan = n;
+            } else {
+                return false;
+            }
+        }
+        if (tv.set == 0) {
+            return false;
+        }
+        rule.op = MR_OP_TV;
+        memcpy(rule.body, &tv, sizeof(tv));
+    } else if ((tok[i] == "buzz") && ((i + 2) == tok.size()) &&
+               parse_number(tok[i + 1], n) && (n > 0) && (n <= 5000)) {
+        bz.ms = n;
+        rule.op = MR_OP_BUZZ;
+        memcpy(rule.body, &bz, sizeof(bz));
+    } else if ((tok[i] == "reset") && ((i + 1) == tok.size())) {
+        rule.op = MR_OP_RESET;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+string RulesEngine::format(const struct nvm_rule_entry &rule)
+{
+    stringstream ss;
+    struct mr_tv_req tv;
+    struct mr_ac_req ac;
+    struct mr_buzz_req bz;
+    int32_t t = rule.threshold;
+
+    ss << ((rule.input < RULE_IN_MAX) ? input_names[rule.input] : "?")
+       << " " << ((rule.cmp < RULE_CMP_MAX) ? cmp_names[rule.cmp] : "?")
+       << " " << ((t < 0) ? "-" : "") << (abs(t) / 10) << "." << (abs(t) % 10);
+    if (rule.hold_secs) {
+        ss << " for " << rule.hold_secs << "s";
+    }
+    ss << ":";
+
+    switch (rule.op) {
+    case MR_OP_AC:
+        memcpy(&ac, rule.body, sizeof(ac));
+        ss << " ac";
+        if (ac.set & MR_AC_SET_POWER) {
+            ss << (ac.power ? " on" : " off");
+        }
+        if ((ac.set & MR_AC_SET_MODE) &&
+            (ac.mode < sizeof(mode_names) / sizeof(mode_names[0]))) {
+            ss << " mode " << mode_names[ac.mode];
+        }
+        if (ac.set & MR_AC_SET_TEMP) {
+            ss << " temp " << (unsigned int) ac.temp;
+        }
+        if (ac.set & MR_AC_SET_FANSPEED) {
+            ss << " fanspeed " << (unsigned int) ac.fanspeed;
+        }
+        if (ac.set & MR_AC_SET_FANDIR) {
+            ss << " fandir " << (unsigned int) ac.fandir;
+        }
+        break;
+    case MR_OP_TV:
+        memcpy(&tv, rule.body, sizeof(tv));
+        ss << " tv";
+        if (tv.set & MR_TV_SET_POWER) {
+            ss << (tv.power ? " on" : " off");
+        }
+        if (tv.set & MR_TV_SET_VOL) {
+            ss << " vol " << (unsigned int) tv.vol;
+        }
+        if (tv.set & MR_TV_SET_CHAN) {
+            ss << " chan " << (unsigned int) tv.chan;
+        }
+        break;
+    case MR_OP_BUZZ:
+        memcpy(&bz, rule.body, sizeof(bz));
+        ss << " buzz " << (unsigned int) bz.ms;
+        break;
+    case MR_OP_RESET:
+        ss << " reset";
+        break;
+    default:
+        ss << " ?";
+        break;
+    }
+
+    if ((rule.flags & RULE_ENABLED) == 0) {
+        ss << " (disabled)";
+    }
+
+    return ss.str();
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
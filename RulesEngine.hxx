@@ -0,0 +1,135 @@
+/*
+ * RulesEngine.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef RULESENGINE_HXX
+#define RULESENGINE_HXX
+
+#include <string>
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include <meshroom_proto.h>
+
+#define RULES_MAX            16
+#define RULE_BODY_MAX        7
+
+using namespace std;
+
+/*
+ * One automation rule as stored in the NVM: when input cmp threshold
+ * has held for hold_secs, apply a binary-protocol request (op and body,
+ * see meshroom_proto.h) locally. A rule fires once per transition and
+ * re-arms when its condition turns false.
+ */
+struct nvm_rule_entry {
+    uint8_t input;
+    uint8_t cmp;
+    int16_t threshold;      /* 0.1 units of the input */
+    uint16_t hold_secs;
+    uint8_t flags;
+#define RULE_ENABLED 0x01
+    uint8_t op;
+    uint8_t body[RULE_BODY_MAX];
+} __attribute__((packed));
+
+struct rule_stats {
+    unsigned int evals;
+    unsigned int fires;
+    uint32_t eval_us_total;
+    uint32_t eval_us_max;
+};
+
+typedef void (*rule_action_t)(const struct nvm_rule_entry &rule, void *arg);
+
+/*
+ * Evaluates rules incrementally: producers report input changes with
+ * update() from any task, and run() (on the command worker) evaluates
+ * only the rules that read a changed input or whose hold timer has
+ * expired. Nothing is polled; nextDeadline() tells the worker when the
+ * next hold timer expires.
+ */
+class RulesEngine {
+
+public:
+
+    enum Input {
+        RULE_IN_TEMP,
+        RULE_IN_HUMIDITY,
+        RULE_IN_PRESSURE,
+        RULE_IN_BUTTON,
+        RULE_IN_MAX,
+    };
+
+    enum Cmp {
+        RULE_CMP_GT,
+        RULE_CMP_GE,
+        RULE_CMP_LT,
+        RULE_CMP_LE,
+        RULE_CMP_EQ,
+        RULE_CMP_MAX,
+    };
+
+    RulesEngine();
+    ~RulesEngine();
+
+    void setAction(rule_action_t action, void *arg);
+
+    int add(const struct nvm_rule_entry &rule);
+    bool remove(unsigned int index);
+    bool enable(unsigned int index, bool enabled);
+    void clear(void);
+    unsigned int count(void) const;
+    const struct nvm_rule_entry &rule(unsigned int index) const;
+    const struct rule_stats &stats(unsigned int index) const;
+
+    void update(enum Input input, int32_t value);
+    void run(void);
+    TickType_t nextDeadline(void) const;
+
+    static bool parse(const string &text, struct nvm_rule_entry &rule);
+    static string format(const struct nvm_rule_entry &rule);
+    static size_t bodySize(uint8_t op);
+
+private:
+
+    void reindex(void);
+    void evaluate(unsigned int i, uint32_t now);
+
+    struct nvm_rule_entry _rules[RULES_MAX];
+    struct rule_stats _stats[RULES_MAX];
+    struct {
+        bool cond;
+        bool fired;
+        uint32_t since;
+    } _state[RULES_MAX];
+    unsigned int _n;
+
+    int32_t _values[RULE_IN_MAX];
+    bool _valid[RULE_IN_MAX];
+    volatile uint32_t _dirty;
+    uint32_t _inputRules[RULE_IN_MAX];
+
+    rule_action_t _action;
+    void *_actionArg;
+
+    // Serializes rule edits (shell, chat) with run() (command worker)
+    SemaphoreHandle_t _lock;
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    StaticSemaphore_t _lockBuffer;
+#endif
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,491 @@
+/*
+ * SerialLink.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <pico/stdlib.h>
+#include <hardware/uart.h>
+#include <pico-plat.h>
+#include <SerialLink.hxx>
+
+#define UART_LINE_ERRORS                        \
+    (UART_UARTRIS_OERIS_BITS |                  \
+     UART_UARTRIS_BERIS_BITS |                  \
+     UART_UARTRIS_PERIS_BITS |                  \
+     UART_UARTRIS_FERIS_BITS)
+
+enum {
+    FRAME_START1,
+    FRAME_START2,
+    FRAME_LEN_MSB,
+    FRAME_LEN_LSB,
+    FRAME_PAYLOAD,
+};
+
+static SerialLink *links[2] = { NULL, NULL, };
+
+static const unsigned int bauds[] = {
+    115200, 230400, 460800, 921600,
+};
+
+SerialLink::SerialLink(uart_inst_t *uart, unsigned int fallbackBaud)
+{
+    _uart = uart;
+    _filter = NULL;
+    _baud = fallbackBaud;
+    _preferredBaud = fallbackBaud;
+    _fallbackBaud = fallbackBaud;
+    _probation = false;
+    _retrying = false;
+    _rateChanged = false;
+    _probationUs = 0;
+    _probationErrors = 0;
+    _probationFrames = 0;
+    bzero(&_rxParser, sizeof(_rxParser));
+    bzero(&_txParser, sizeof(_txParser));
+    _rateUs = 0;
+    _rateRxBytes = 0;
+    _rateTxBytes = 0;
+    bzero(&_stats, sizeof(_stats));
+
+    links[uart_get_index(uart) & 1] = this;
+}
+
+SerialLink::~SerialLink()
+{
+    links[uart_get_index(_uart) & 1] = NULL;
+}
+
+void SerialLink::switchBaud(unsigned int baud)
+{
+    uart_tx_wait_blocking(_uart);
+    uart_set_baudrate(_uart, baud);
+    _baud = baud;
+    _probationUs = time_us_64();
+    _probationErrors = 0;
+    _probationFrames = 0;
+    bzero(&_rxParser, sizeof(_rxParser));
+}
+
+/*
+ * Makes baud the preferred rate. Neither line errors nor silence count
+ * against it until graceMs have passed.
+ */
+bool SerialLink::setBaud(unsigned int baud, uint32_t graceMs)
+{
+    bool result = false;
+
+    if (isValidBaud(baud) == false) {
+        goto done;
+    }
+
+    switchBaud(baud);
+    _preferredBaud = baud;
+    _probation = (baud != _fallbackBaud);
+    _probationUs += graceMs * 1000ULL;
+    _retrying = false;
+    _rateChanged = false;
+
+    result = true;
+
+done:
+
+    return result;
+}
+
+unsigned int SerialLink::baud(void) const
+{
+    return _baud;
+}
+
+unsigned int SerialLink::preferredBaud(void) const
+{
+    return _preferredBaud;
+}
+
+unsigned int SerialLink::fallbackBaud(void) const
+{
+    return _fallbackBaud;
+}
+
+bool SerialLink::onProbation(void) const
+{
+    return _probation;
+}
+
+// Reports a fallback or a retry once
+bool SerialLink::rateChanged(void)
+{
+    bool result = _rateChanged;
+
+    _rateChanged = false;
+
+    return result;
+}
+
+void SerialLink::parse(struct frame_parser &parser,
+                       const uint8_t *buf, size_t size,
+                       struct serial_link_dir_stats &stats)
+{
+    size_t n;
+
+    while (size > 0) {
+        switch (parser.state) {
+        case FRAME_START1:
+            // Anything between frames is the radio's debug log
+            if (*buf == SERIAL_LINK_START1) {
+                parser.state = FRAME_START2;
+            }
+            break;
+        case FRAME_START2:
+            if (*buf == SERIAL_LINK_START2) {
+                parser.state = FRAME_LEN_MSB;
+            } else if (*buf != SERIAL_LINK_START1) {
+                parser.state = FRAME_START1;
+            }
+            break;
+        case FRAME_LEN_MSB:
+            parser.len = *buf << 8;
+            parser.state = FRAME_LEN_LSB;
+            break;
+        case FRAME_LEN_LSB:
+            parser.len |= *buf;
+            parser.got = 0;
+            if (parser.len > SERIAL_LINK_FRAME_MAX) {
+                stats.bad_frames++;
+                parser.state = FRAME_START1;
+            } else if (parser.len == 0) {
+                stats.frames++;
+                parser.state = FRAME_START1;
+            } else {
+                parser.state = FRAME_PAYLOAD;
+            }
+            break;
+        case FRAME_PAYLOAD:
+            n = parser.len - parser.got;
+            if (n > size) {
+                n = size;
+            }
+            parser.got += n;
+            if (parser.got >= parser.len) {
+                stats.frames++;
+                parser.state = FRAME_START1;
+            }
+            buf += n;
+            size -= n;
+            continue;
+        default:
+            parser.state = FRAME_START1;
+            break;
+        }
+
+        buf++;
+        size--;
+    }
+}
+
+/*
+ * pending is what the driver's ring held before the read; the
+ * histogram buckets are powers of two.
+ */
+void SerialLink::rx(const uint8_t *buf, size_t size, int pending)
+{
+    uint32_t frames = _stats.rx.frames;
+    unsigned int bucket = 0;
+
+    if (pending > 0) {
+        if ((uint32_t) pending > _stats.ring_max) {
+            _stats.ring_max = pending;
+        }
+        bucket = 32 - __builtin_clz(pending);
+        if (bucket >= SERIAL_LINK_HIST_BUCKETS) {
+            bucket = SERIAL_LINK_HIST_BUCKETS - 1;
+        }
+    }
+    _stats.ring_hist[bucket]++;
+
+    if (size > 0) {
+        _stats.rx.bytes += size;
+        parse(_rxParser, buf, size, _stats.rx);
+        _probationFrames += _stats.rx.frames - frames;
+    }
+}
+
+/*
+ * buf may be NULL when only the count is known (formatted output).
+ */
+void SerialLink::tx(const uint8_t *buf, size_t size, int accepted)
+{
+    if (accepted < 0) {
+        accepted = 0;
+    }
+    if ((size_t) accepted > size) {
+        accepted = size;
+    }
+
+    _stats.tx.bytes += accepted;
+    _stats.tx.dropped += size - accepted;
+    if (buf != NULL) {
+        parse(_txParser, buf, accepted, _stats.tx);
+    }
+}
+
+void SerialLink::setFilter(PacketFilter *filter)
+{
+    _filter = filter;
+}
+
+PacketFilter *SerialLink::filter(void) const
+{
+    return _filter;
+}
+
+void SerialLink::processed(uint32_t us)
+{
+    _stats.process_calls++;
+    _stats.process_us_total += us;
+    if (us > _stats.process_us_max) {
+        _stats.process_us_max = us;
+    }
+}
+
+void SerialLink::fallback(void)
+{
+    switchBaud(_fallbackBaud);
+    _probation = false;
+    _retrying = true;
+    _rateChanged = true;
+    _stats.fallbacks++;
+}
+
+void SerialLink::retry(void)
+{
+    switchBaud(_preferredBaud);
+    _probation = true;
+    _retrying = false;
+    _rateChanged = true;
+    _stats.retries++;
+}
+
+/*
+ * The raw interrupt status latches line errors whether or not they
+ * are enabled as interrupts; each poll counts and clears them, so
+ * errors arriving between two polls are counted once.
+ */
+void SerialLink::poll(void)
+{
+    uart_hw_t *hw = uart_get_hw(_uart);
+    uint32_t ris = hw->ris & UART_LINE_ERRORS;
+    uint64_t now = time_us_64();
+    bool counting = (now >= _probationUs);
+    uint64_t elapsed;
+
+    if (ris) {
+        hw->icr = ris;
+        if (ris & UART_UARTRIS_FERIS_BITS) {
+            _stats.framing_errors++;
+        }
+        if (ris & UART_UARTRIS_PERIS_BITS) {
+            _stats.parity_errors++;
+        }
+        if (ris & UART_UARTRIS_BERIS_BITS) {
+            _stats.break_errors++;
+        }
+        if (ris & UART_UARTRIS_OERIS_BITS) {
+            _stats.overruns++;
+        }
+        if (counting &&
+            (ris & (UART_UARTRIS_FERIS_BITS | UART_UARTRIS_BERIS_BITS))) {
+            _probationErrors++;
+        }
+    }
+
+    if (hw->fr & UART_UARTFR_RXFF_BITS) {
+        _stats.fifo_full++;
+    }
+
+    if (_probation) {
+        if (_probationFrames >= SERIAL_LINK_CONFIRM_FRAMES) {
+            _probation = false;
+        } else if (_probationErrors >= SERIAL_LINK_FALLBACK_ERRORS) {
+            fallback();
+        } else if (counting && ((now - _probationUs) >=
+                                (SERIAL_LINK_PROBATION_MS * 1000ULL))) {
+            fallback();
+        }
+    } else if (_retrying) {
+        // The radio answers on the fallback rate: it is really set to it
+        if (_probationFrames >= SERIAL_LINK_CONFIRM_FRAMES) {
+            _retrying = false;
+        } else if ((now - _probationUs) >=
+                   (SERIAL_LINK_PROBATION_MS * 1000ULL)) {
+            retry();
+        }
+    }
+
+    elapsed = now - _rateUs;
+    if (elapsed >= (SERIAL_LINK_RATE_MS * 1000ULL)) {
+        if (_rateUs != 0) {
+            _stats.rx.bps = (uint64_t) (_stats.rx.bytes - _rateRxBytes) *
+                8 * 1000000 / elapsed;
+            _stats.tx.bps = (uint64_t) (_stats.tx.bytes - _rateTxBytes) *
+                8 * 1000000 / elapsed;
+            if (_stats.rx.bps > _stats.rx.peak_bps) {
+                _stats.rx.peak_bps = _stats.rx.bps;
+            }
+            if (_stats.tx.bps > _stats.tx.peak_bps) {
+                _stats.tx.peak_bps = _stats.tx.bps;
+            }
+        }
+        _rateUs = now;
+        _rateRxBytes = _stats.rx.bytes;
+        _rateTxBytes = _stats.tx.bytes;
+    }
+}
+
+const struct serial_link_stats &SerialLink::getStats(void) const
+{
+    return _stats;
+}
+
+void SerialLink::resetStats(void)
+{
+    bzero(&_stats, sizeof(_stats));
+    _rateUs = 0;
+}
+
+bool SerialLink::isValidBaud(unsigned int baud)
+{
+    for (unsigned int i = 0; i < count_of(bauds); i++) {
+        if (bauds[i] == baud) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+SerialLink *SerialLink::get(unsigned int index)
+{
+    return (index < 2) ? links[index] : NULL;
+}
+
+/*
+ * Linked with --wrap so that every read and write on serial0 and
+ * serial1, including the ones made by libmeshtastic, passes through
+ * here. Output formatted inside pico-plat (serial0_printf) is not seen.
+ */
+extern "C" int __real_serial0_read(uint8_t *buf, size_t size);
+extern "C" int __real_serial0_write(const uint8_t *buf, size_t size);
+extern "C" int __real_serial0_vprintf(const char *format, va_list ap);
+extern "C" int __real_serial1_rx_ready(void);
+extern "C" int __real_serial1_read(uint8_t *buf, size_t size);
+extern "C" int __real_serial1_write(const uint8_t *buf, size_t size);
+
+extern "C" int __wrap_serial0_read(uint8_t *buf, size_t size)
+{
+    int pending = serial0_rx_ready();
+    int ret = __real_serial0_read(buf, size);
+
+    if (links[0] != NULL) {
+        links[0]->rx(buf, (ret > 0) ? ret : 0, pending);
+    }
+
+    return ret;
+}
+
+extern "C" int __wrap_serial0_write(const uint8_t *buf, size_t size)
+{
+    int ret = __real_serial0_write(buf, size);
+
+    if (links[0] != NULL) {
+        links[0]->tx(buf, size, ret);
+    }
+
+    return ret;
+}
+
+extern "C" int __wrap_serial0_vprintf(const char *format, va_list ap)
+{
+    int ret = __real_serial0_vprintf(format, ap);
+
+    if ((ret > 0) && (links[0] != NULL)) {
+        links[0]->tx(NULL, ret, ret);
+    }
+
+    return ret;
+}
+
+// Bytes held by the filter are still waiting to be read
+extern "C" int __wrap_serial1_rx_ready(void)
+{
+    int ret = __real_serial1_rx_ready();
+
+    if ((ret >= 0) && (links[1] != NULL) && (links[1]->filter() != NULL)) {
+        ret += links[1]->filter()->pending();
+    }
+
+    return ret;
+}
+
+/*
+ * With a filter, the driver is read in small chunks that go through
+ * the filter first; the caller gets what the filter lets out.
+ */
+extern "C" int __wrap_serial1_read(uint8_t *buf, size_t size)
+{
+    SerialLink *link = links[1];
+    PacketFilter *filter = (link != NULL) ? link->filter() : NULL;
+    uint8_t chunk[PACKET_FILTER_CHUNK];
+    int pending = __real_serial1_rx_ready();
+    int ret;
+    size_t n;
+
+    if (filter == NULL) {
+        ret = __real_serial1_read(buf, size);
+        if (link != NULL) {
+            link->rx(buf, (ret > 0) ? ret : 0, pending);
+        }
+        goto done;
+    }
+
+    n = filter->room();
+    if (n > sizeof(chunk)) {
+        n = sizeof(chunk);
+    }
+    if ((filter->pending() < size) && (n > 0) && (pending > 0)) {
+        ret = __real_serial1_read(chunk, n);
+        if (ret < 0) {
+            goto done;
+        }
+        link->rx(chunk, ret, pending);
+        filter->feed(chunk, ret);
+    }
+    ret = filter->read(buf, size);
+
+done:
+
+    return ret;
+}
+
+extern "C" int __wrap_serial1_write(const uint8_t *buf, size_t size)
+{
+    int ret = __real_serial1_write(buf, size);
+
+    if (links[1] != NULL) {
+        links[1]->tx(buf, size, ret);
+    }
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,141 @@
+/*
+ * SerialLink.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef SERIALLINK_HXX
+#define SERIALLINK_HXX
+
+#include <stdint.h>
+#include <stddef.h>
+#include <hardware/uart.h>
+#include <PacketFilter.hxx>
+
+#define SERIAL_LINK_DEFAULT_BAUD     115200
+#define SERIAL_LINK_FALLBACK_ERRORS  8   // Line errors while on probation
+#define SERIAL_LINK_CONFIRM_FRAMES   4   // Good frames to keep a new rate
+#define SERIAL_LINK_PROBATION_MS     15000
+#define SERIAL_LINK_BOOT_MS          30000  // Radio coming out of reset
+#define SERIAL_LINK_RATE_MS          1000
+#define SERIAL_LINK_HIST_BUCKETS     10  // 0, 1, 2-3, 4-7, ... 256+
+
+// Meshtastic stream framing: 0x94 0xc3 <len msb> <len lsb> <protobuf>
+#define SERIAL_LINK_START1           0x94
+#define SERIAL_LINK_START2           0xc3
+#define SERIAL_LINK_FRAME_MAX        512
+
+struct serial_link_dir_stats {
+    uint32_t bytes;
+    uint32_t frames;
+    uint32_t bad_frames;                 // Length out of range
+    uint32_t dropped;                    // Not accepted by the driver
+    uint32_t bps;                        // Over the last rate window
+    uint32_t peak_bps;
+};
+
+struct serial_link_stats {
+    struct serial_link_dir_stats rx;
+    struct serial_link_dir_stats tx;
+    uint32_t framing_errors;
+    uint32_t parity_errors;
+    uint32_t break_errors;
+    uint32_t overruns;                   // At least one byte lost each
+    uint32_t fifo_full;                  // Polls that found the RX FIFO full
+    uint32_t fallbacks;
+    uint32_t retries;                    // Back to the preferred rate
+    uint32_t ring_max;                   // RX ring occupancy high-water
+    uint32_t ring_hist[SERIAL_LINK_HIST_BUCKETS];  // Sampled on each read
+    uint32_t process_calls;
+    uint64_t process_us_total;
+    uint32_t process_us_max;
+};
+
+/*
+ * Accounts for the traffic on one UART, as seen through its read and
+ * write calls, samples the occupancy of its receive ring on every read
+ * and keeps the time spent decoding what was read. It also manages the
+ * baud rate. A rate other than the fallback rate is on probation until
+ * enough well-formed frames have been received; too many line errors,
+ * or no frames at all, within the probation period put the UART back on
+ * the fallback rate. The probation clock can be held off while the
+ * radio boots. If no frames arrive on the fallback rate either, the
+ * preferred rate is tried again, so a radio that was slow to come up
+ * is not left on the wrong rate.
+ *
+ * Not thread-safe; it is driven by meshtastic_task.
+ */
+class SerialLink {
+
+public:
+
+    SerialLink(uart_inst_t *uart, unsigned int fallbackBaud =
+               SERIAL_LINK_DEFAULT_BAUD);
+    ~SerialLink();
+
+    bool setBaud(unsigned int baud, uint32_t graceMs = 0);
+    unsigned int baud(void) const;
+    unsigned int preferredBaud(void) const;
+    unsigned int fallbackBaud(void) const;
+    bool onProbation(void) const;
+    bool rateChanged(void);
+
+    void rx(const uint8_t *buf, size_t size, int pending);
+    void tx(const uint8_t *buf, size_t size, int accepted);
+    void processed(uint32_t us);
+    void setFilter(PacketFilter *filter);
+    PacketFilter *filter(void) const;
+    void poll(void);
+
+    const struct serial_link_stats &getStats(void) const;
+    void resetStats(void);
+
+    static bool isValidBaud(unsigned int baud);
+    static SerialLink *get(unsigned int index);
+
+private:
+
+    struct frame_parser {
+        uint8_t state;
+        uint16_t len;
+        uint16_t got;
+    };
+
+    static void parse(struct frame_parser &parser,
+                      const uint8_t *buf, size_t size,
+                      struct serial_link_dir_stats &stats);
+    void switchBaud(unsigned int baud);
+    void fallback(void);
+    void retry(void);
+
+    uart_inst_t *_uart;
+    PacketFilter *_filter;
+    unsigned int _baud;
+    unsigned int _preferredBaud;
+    unsigned int _fallbackBaud;
+    bool _probation;
+    bool _retrying;                      // On the fallback rate, unconfirmed
+    bool _rateChanged;
+    uint64_t _probationUs;               // When the probation clock starts
+    uint32_t _probationErrors;
+    uint32_t _probationFrames;
+    struct frame_parser _rxParser;
+    struct frame_parser _txParser;
+    uint64_t _rateUs;
+    uint32_t _rateRxBytes;
+    uint32_t _rateTxBytes;
+    struct serial_link_stats _stats;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,91 @@
+/*
+ * SpscRing.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef SPSCRING_HXX
+#define SPSCRING_HXX
+
+#include <atomic>
+
+using namespace std;
+
+/*
+ * Lock-free single-producer/single-consumer ring of N fixed-size
+ * entries, for handing work from a task on one core to a task on the
+ * other without taking the kernel's cross-core lock. Entries are filled
+ * and consumed in place: the producer calls acquire(), fills the slot
+ * and publish()es it; the consumer calls front(), uses the slot and
+ * pop()s it. Only 32-bit atomic loads and stores are used, which are
+ * lock-free on the Cortex-M0+.
+ */
+template <class T, unsigned int N>
+class SpscRing {
+
+public:
+
+    SpscRing() : _head(0), _tail(0) {
+
+    }
+
+    // Producer side
+    T *acquire(void) {
+        unsigned int head = _head.load(memory_order_relaxed);
+
+        if ((head - _tail.load(memory_order_acquire)) >= N) {
+            return NULL;
+        }
+
+        return &_slots[head % N];
+    }
+
+    void publish(void) {
+        _head.store(_head.load(memory_order_relaxed) + 1,
+                    memory_order_release);
+    }
+
+    // Consumer side
+    T *front(void) {
+        unsigned int tail = _tail.load(memory_order_relaxed);
+
+        if (tail == _head.load(memory_order_acquire)) {
+            return NULL;
+        }
+
+        return &_slots[tail % N];
+    }
+
+    void pop(void) {
+        _tail.store(_tail.load(memory_order_relaxed) + 1,
+                    memory_order_release);
+    }
+
+    unsigned int size(void) const {
+        return _head.load(memory_order_acquire) -
+            _tail.load(memory_order_acquire);
+    }
+
+    unsigned int capacity(void) const {
+        return N;
+    }
+
+private:
+
+    T _slots[N];
+    atomic<unsigned int> _head;
+    atomic<unsigned int> _tail;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,360 @@
+/*
+ * TxScheduler.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <pico/time.h>
+#include <TxScheduler.hxx>
+
+#define TX_BURST_US  ((uint64_t) TX_AIRTIME_BURST_MS * 1000)
+#define TX_HOLD_US   ((uint64_t) TX_COALESCE_MS * 1000)
+
+TxScheduler::TxScheduler(unsigned int dutyPct)
+{
+    bzero(_slots, sizeof(_slots));
+    bzero(_requests, sizeof(_requests));
+    _seq = 0;
+    _dutyPct = dutyPct;
+    _budgetUs = TX_BURST_US;
+    _refilled = time_us_64();
+    bzero(&_stats, sizeof(_stats));
+}
+
+TxScheduler::~TxScheduler()
+{
+
+}
+
+uint32_t TxScheduler::airtimeUs(size_t len)
+{
+    return TX_AIRTIME_BASE_US + (len * TX_AIRTIME_BYTE_US);
+}
+
+void TxScheduler::refill(uint64_t now)
+{
+    _budgetUs += ((now - _refilled) * _dutyPct) / 100;
+    if (_budgetUs > TX_BURST_US) {
+        _budgetUs = TX_BURST_US;
+    }
+    _refilled = now;
+}
+
+struct TxScheduler::slot *TxScheduler::allocSlot(uint64_t ts)
+{
+    struct slot *s = NULL;
+    unsigned int depth = 1;
+
+    for (int i = 0; i < TX_QUEUE_DEPTH; i++) {
+        if (_slots[i].valid) {
+            depth++;
+        } else if (s == NULL) {
+            s = &_slots[i];
+        }
+    }
+
+    if (s == NULL) {
+        _stats.dropped++;
+        return NULL;
+    }
+
+    s->valid = true;
+    s->deferred = false;
+    s->mergeable = false;
+    s->seq = _seq++;
+    s->last = ts;
+    s->due = ts;
+    s->item.ts = ts;
+
+    _stats.queued++;
+    if (depth > _stats.depth_max) {
+        _stats.depth_max = depth;
+    }
+
+    return s;
+}
+
+bool TxScheduler::submit(uint32_t dest, uint8_t channel, const char *text,
+                         uint64_t ts, bool mergeable, uint32_t delayMs)
+{
+    struct slot *s = NULL;
+    size_t len = strlen(text);
+
+    if (len > TX_TEXT_MAX) {
+        len = TX_TEXT_MAX;
+    }
+
+    for (int i = 0; mergeable && (i < TX_QUEUE_DEPTH); i++) {
+        s = &_slots[i];
+
+        if ((s->valid == false) || (s->mergeable == false) ||
+            (s->item.dest != dest) || (s->item.channel != channel) ||
+            ((ts - s->last) >= TX_HOLD_US) ||
+            ((s->item.size + 1 + len) > TX_TEXT_MAX)) {
+            continue;
+        }
+
+        s->item.text[s->item.size] = '\n';
+        memcpy(&s->item.text[s->item.size + 1], text, len);
+        s->item.size += 1 + len;
+        s->item.text[s->item.size] = '\0';
+        s->last = ts;
+        s->due = ts + TX_HOLD_US;
+        _stats.merged++;
+
+        return true;
+    }
+
+    s = allocSlot(ts);
+    if (s == NULL) {
+        return false;
+    }
+
+    s->mergeable = mergeable;
+    s->due = ts + (mergeable ? TX_HOLD_US : 0) + ((uint64_t) delayMs * 1000);
+    s->item.kind = TX_REPLY;
+    s->item.dest = dest;
+    s->item.channel = channel;
+    s->item.portnum = 0;
+    s->item.size = len;
+    memcpy(s->item.text, text, len);
+    s->item.text[len] = '\0';
+
+    return true;
+}
+
+bool TxScheduler::submitData(uint32_t dest, uint8_t channel,
+                             uint16_t portnum,
+                             const uint8_t *buf, size_t size, uint64_t ts)
+{
+    struct slot *s = NULL;
+
+    if (size > TX_TEXT_MAX) {
+        _stats.dropped++;
+        return false;
+    }
+
+    s = allocSlot(ts);
+    if (s == NULL) {
+        return false;
+    }
+
+    s->item.kind = TX_DATA;
+    s->item.dest = dest;
+    s->item.channel = channel;
+    s->item.portnum = portnum;
+    s->item.size = size;
+    memcpy(s->item.text, buf, size);
+
+    return true;
+}
+
+void TxScheduler::request(enum Kind kind)
+{
+    if ((kind < TX_WANT_CONFIG) || (kind >= TX_KIND_MAX)) {
+        return;
+    }
+
+    _requests[kind] = true;
+}
+
+bool TxScheduler::pop(struct tx_item &item)
+{
+    struct slot *next = NULL;
+    uint64_t now = time_us_64();
+
+    refill(now);
+
+    for (int i = 0; i < TX_QUEUE_DEPTH; i++) {
+        struct slot *s = &_slots[i];
+
+        if ((s->valid == false) || (now < s->due)) {
+            continue;
+        }
+
+        if ((next == NULL) || ((int) (s->seq - next->seq) < 0)) {
+            next = s;
+        }
+    }
+
+    if (next != NULL) {
+        if ((_dutyPct >= 100) ||
+            (_budgetUs >= airtimeUs(next->item.size))) {
+            memcpy(&item, &next->item, sizeof(item));
+            next->valid = false;
+            return true;
+        }
+
+        if (next->deferred == false) {
+            next->deferred = true;
+            _stats.deferred++;
+        }
+    }
+
+    for (int k = TX_WANT_CONFIG; k < TX_KIND_MAX; k++) {
+        if (_requests[k]) {
+            _requests[k] = false;
+            item.kind = k;
+            item.ts = now;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TxScheduler::complete(const struct tx_item &item, bool success)
+{
+    uint32_t airtime, latency;
+
+    switch (item.kind) {
+    case TX_REPLY:
+    case TX_DATA:
+        if (success == false) {
+            _stats.failed++;
+            break;
+        }
+
+        airtime = airtimeUs(item.size);
+        _budgetUs = (_budgetUs > airtime) ? (_budgetUs - airtime) : 0;
+        _stats.airtime_us += airtime;
+        _stats.sent++;
+
+        latency = time_us_64() - item.ts;
+        _stats.latency_us_total += latency;
+        if (latency > _stats.latency_us_max) {
+            _stats.latency_us_max = latency;
+        }
+        break;
+    case TX_WANT_CONFIG:
+        if (success) {
+            _stats.want_configs++;
+        } else {
+            _stats.failed++;
+        }
+        break;
+    case TX_HEARTBEAT:
+        if (success) {
+            _stats.heartbeats++;
+        } else {
+            _stats.failed++;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * How long meshtastic_task may sleep before something becomes
+ * sendable: the end of a coalescing window or pacing delay, or enough
+ * refilled budget.
+ */
+TickType_t TxScheduler::nextDeadline(void)
+{
+    uint64_t now = time_us_64();
+    uint64_t wait_us = UINT64_MAX;
+    uint64_t w;
+    uint32_t airtime;
+    TickType_t ticks;
+
+    refill(now);
+
+    for (int k = TX_WANT_CONFIG; k < TX_KIND_MAX; k++) {
+        if (_requests[k]) {
+            return 0;
+        }
+    }
+
+    for (int i = 0; i < TX_QUEUE_DEPTH; i++) {
+        struct slot *s = &_slots[i];
+
+        if (s->valid == false) {
+            continue;
+        }
+
+        w = 0;
+        if (now < s->due) {
+            w = s->due - now;
+        }
+
+        airtime = airtimeUs(s->item.size);
+        if ((_dutyPct < 100) && (_budgetUs < airtime)) {
+            uint64_t b = ((airtime - _budgetUs) * 100) / _dutyPct;
+            if (b > w) {
+                w = b;
+            }
+        }
+
+        if (w < wait_us) {
+            wait_us = w;
+        }
+    }
+
+    if (wait_us == UINT64_MAX) {
+        return portMAX_DELAY;
+    }
+
+    ticks = pdMS_TO_TICKS((wait_us + 999) / 1000);
+    if ((ticks == 0) && (wait_us > 0)) {
+        ticks = 1;
+    }
+
+    return ticks;
+}
+
+unsigned int TxScheduler::pending(void) const
+{
+    unsigned int count = 0;
+
+    for (int i = 0; i < TX_QUEUE_DEPTH; i++) {
+        if (_slots[i].valid) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+bool TxScheduler::full(void) const
+{
+    return pending() >= TX_QUEUE_DEPTH;
+}
+
+void TxScheduler::setDutyCycle(unsigned int pct)
+{
+    refill(time_us_64());
+    if (pct < 1) {
+        pct = 1;
+    } else if (pct > 100) {
+        pct = 100;
+    }
+    _dutyPct = pct;
+}
+
+unsigned int TxScheduler::dutyCycle(void) const
+{
+    return _dutyPct;
+}
+
+uint32_t TxScheduler::budgetMs(void) const
+{
+    return _budgetUs / 1000;
+}
+
+const struct tx_stats &TxScheduler::getStats(void) const
+{
+    return _stats;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,135 @@
+/*
+ * TxScheduler.hxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef TXSCHEDULER_HXX
+#define TXSCHEDULER_HXX
+
+#include <FreeRTOS.h>
+#include <libmeshtastic.h>
+
+#define TX_QUEUE_DEPTH          8
+#define TX_TEXT_MAX             meshtastic_Constants_DATA_PAYLOAD_LEN
+#define TX_COALESCE_MS          200
+#define TX_DUTY_CYCLE_PCT       10
+#define TX_AIRTIME_BURST_MS     10000
+
+/*
+ * Rough LongFast (SF11/250 kHz) on-air time: preamble, header and the
+ * mesh packet envelope, plus the payload.
+ */
+#define TX_AIRTIME_BASE_US      250000
+#define TX_AIRTIME_BYTE_US      7500
+
+struct tx_item {
+    int kind;
+    uint32_t dest;
+    uint8_t channel;
+    uint16_t portnum;
+    uint16_t size;
+    char text[TX_TEXT_MAX + 1];
+    uint64_t ts;
+};
+
+struct tx_stats {
+    unsigned int queued;
+    unsigned int merged;
+    unsigned int dropped;
+    unsigned int deferred;
+    unsigned int sent;
+    unsigned int failed;
+    unsigned int heartbeats;
+    unsigned int want_configs;
+    unsigned int depth_max;
+    uint64_t airtime_us;
+    uint64_t latency_us_total;
+    uint32_t latency_us_max;
+};
+
+/*
+ * Orders everything MeshRoom writes to the radio. Interactive replies
+ * (text or binary data) go first, then want-config and heartbeat
+ * requests (at most one of each pending). Replies to the same
+ * destination and channel that arrive within the coalescing window are
+ * joined into one packet (except for chunks of a framed reply, which are
+ * paced instead), and replies are only released while the estimated
+ * airtime fits in a duty-cycle budget refilled at the configured
+ * percentage of wall time.
+ * Heartbeats and want-config only travel to the attached radio and are
+ * not charged airtime.
+ *
+ * Not thread-safe; it is owned by meshtastic_task.
+ */
+class TxScheduler {
+
+public:
+
+    enum Kind {
+        TX_REPLY,
+        TX_DATA,
+        TX_WANT_CONFIG,
+        TX_HEARTBEAT,
+        TX_KIND_MAX,
+    };
+
+    TxScheduler(unsigned int dutyPct = TX_DUTY_CYCLE_PCT);
+    ~TxScheduler();
+
+    bool submit(uint32_t dest, uint8_t channel, const char *text,
+                uint64_t ts, bool mergeable = true,
+                uint32_t delayMs = 0);
+    bool submitData(uint32_t dest, uint8_t channel, uint16_t portnum,
+                    const uint8_t *buf, size_t size, uint64_t ts);
+    void request(enum Kind kind);
+    bool pop(struct tx_item &item);
+    void complete(const struct tx_item &item, bool success);
+    TickType_t nextDeadline(void);
+    unsigned int pending(void) const;
+    bool full(void) const;
+
+    void setDutyCycle(unsigned int pct);
+    unsigned int dutyCycle(void) const;
+    uint32_t budgetMs(void) const;
+
+    const struct tx_stats &getStats(void) const;
+
+    static uint32_t airtimeUs(size_t len);
+
+private:
+
+    struct slot;
+
+    void refill(uint64_t now);
+    struct slot *allocSlot(uint64_t ts);
+
+    struct slot {
+        bool valid;
+        bool deferred;
+        bool mergeable;
+        unsigned int seq;
+        uint64_t last;
+        uint64_t due;
+        struct tx_item item;
+    } _slots[TX_QUEUE_DEPTH];
+    bool _requests[TX_KIND_MAX];
+    unsigned int _seq;
+    unsigned int _dutyPct;
+    uint64_t _budgetUs;
+    uint64_t _refilled;
+    struct tx_stats _stats;
+
+};
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
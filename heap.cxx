@@ -0,0 +1,295 @@
+/*
+ * heap.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <string.h>
+#include <new>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <meshroom.h>
+
+/*
+ * C++ allocations are served from the FreeRTOS heap_4 pool so that
+ * std::string/std::vector and pvPortMalloc() share one pool whose
+ * free space, largest free block and low-water mark are all visible
+ * through vPortGetHeapStats().
+ */
+
+void *operator new(size_t size)
+{
+    void *ptr = pvPortMalloc((size > 0) ? size : 1);
+
+    if (ptr == NULL) {
+        throw std::bad_alloc();
+    }
+
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return pvPortMalloc((size > 0) ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return pvPortMalloc((size > 0) ? size : 1);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    vPortFree(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    vPortFree(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept
+{
+    (void)(size);
+
+    vPortFree(ptr);
+}
+
+void operator delete[](void *ptr, size_t size) noexcept
+{
+    (void)(size);
+
+    vPortFree(ptr);
+}
+
+/*
+ * Per-task accounting. The hooks are called by heap_4 with the scheduler
+ * suspended, which also serializes updates to these tables. Slot 0
+ * collects allocations made before the scheduler starts.
+ *
+ * Each live block is remembered with its size and the slot of the task
+ * that allocated it, so a free is charged to the owner whichever task
+ * releases it, and a task's live bytes can be used to find leaks. The
+ * block table is open-addressed with linear probing; when it is full a
+ * block goes untracked and its free is charged to the freeing task.
+ */
+
+#define HEAP_TRACE_SIZE_MASK   0x00ffffff
+#define HEAP_TRACE_OWNER_SHIFT 24
+
+static struct heap_trace_slot {
+    TaskHandle_t task;
+    struct heap_task_stats stats;
+} heap_trace_slots[HEAP_TRACE_MAX_TASKS];
+
+static struct heap_trace_block {
+    void *ptr;                          // NULL when empty
+    uint32_t info;                      // Owner slot << 24 | size
+} heap_trace_blocks[HEAP_TRACE_MAX_ALLOCS];
+
+static unsigned int heap_trace_untracked_blocks = 0;
+
+static int heap_trace_lookup(void)
+{
+    TaskHandle_t task = NULL;
+    struct heap_trace_slot *slot = NULL;
+    unsigned int i;
+
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        task = xTaskGetCurrentTaskHandle();
+    }
+
+    for (i = 0; i < HEAP_TRACE_MAX_TASKS; i++) {
+        slot = &heap_trace_slots[i];
+        if (slot->stats.name == NULL) {
+            slot->task = task;
+            slot->stats.name = (task != NULL) ? pcTaskGetName(task) : "(init)";
+            break;
+        }
+        if (slot->task == task) {
+            break;
+        }
+    }
+
+    if (i == HEAP_TRACE_MAX_TASKS) {
+        return -1;
+    }
+
+    return i;
+}
+
+static unsigned int heap_trace_hash(const void *ptr)
+{
+    uint32_t h = ((uintptr_t) ptr >> 3) * 0x9e3779b1;
+
+    return (h >> 16) & (HEAP_TRACE_MAX_ALLOCS - 1);
+}
+
+static bool heap_trace_insert(void *ptr, size_t size, int owner)
+{
+    unsigned int i = heap_trace_hash(ptr);
+
+    for (unsigned int n = 0; n < HEAP_TRACE_MAX_ALLOCS; n++) {
+        if (heap_trace_blocks[i].ptr == NULL) {
+            heap_trace_blocks[i].ptr = ptr;
+            heap_trace_blocks[i].info =
+                ((uint32_t) owner << HEAP_TRACE_OWNER_SHIFT) |
+                (size & HEAP_TRACE_SIZE_MASK);
+            return true;
+        }
+        i = (i + 1) & (HEAP_TRACE_MAX_ALLOCS - 1);
+    }
+
+    return false;
+}
+
+/*
+ * Removes the block and closes the gap by shifting back the entries
+ * that probed past it, so lookups never need tombstones.
+ */
+static bool heap_trace_remove(void *ptr, uint32_t &info)
+{
+    unsigned int mask = HEAP_TRACE_MAX_ALLOCS - 1;
+    unsigned int i = heap_trace_hash(ptr);
+    unsigned int j, home;
+
+    while (heap_trace_blocks[i].ptr != ptr) {
+        if (heap_trace_blocks[i].ptr == NULL) {
+            return false;
+        }
+        i = (i + 1) & mask;
+    }
+    info = heap_trace_blocks[i].info;
+
+    for (j = (i + 1) & mask; heap_trace_blocks[j].ptr != NULL;
+         j = (j + 1) & mask) {
+        home = heap_trace_hash(heap_trace_blocks[j].ptr);
+        // Can the entry at j move back to i without passing its home?
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            heap_trace_blocks[i] = heap_trace_blocks[j];
+            i = j;
+        }
+    }
+    heap_trace_blocks[i].ptr = NULL;
+
+    return true;
+}
+
+extern "C" void heap_trace_malloc(void *ptr, size_t size)
+{
+    int owner = heap_trace_lookup();
+    struct heap_task_stats *stats = NULL;
+
+    if (owner < 0) {
+        return;
+    }
+
+    stats = &heap_trace_slots[owner].stats;
+    if (ptr == NULL) {
+        stats->failures++;
+        return;
+    }
+
+    stats->allocs++;
+    stats->alloc_bytes += size;
+    stats->cur_bytes += size;
+    if (stats->cur_bytes > stats->peak_bytes) {
+        stats->peak_bytes = stats->cur_bytes;
+    }
+
+    if (heap_trace_insert(ptr, size, owner) == false) {
+        heap_trace_untracked_blocks++;
+    }
+}
+
+extern "C" void heap_trace_free(void *ptr, size_t size)
+{
+    int owner = -1;
+    uint32_t info = 0;
+    struct heap_task_stats *stats = NULL;
+
+    if (heap_trace_remove(ptr, info)) {
+        owner = info >> HEAP_TRACE_OWNER_SHIFT;
+        size = info & HEAP_TRACE_SIZE_MASK;
+    } else {
+        owner = heap_trace_lookup();
+    }
+
+    if (owner < 0) {
+        return;
+    }
+
+    stats = &heap_trace_slots[owner].stats;
+    stats->frees++;
+    stats->free_bytes += size;
+    stats->cur_bytes = (stats->cur_bytes > size) ? stats->cur_bytes - size : 0;
+}
+
+unsigned int heap_trace_task_stats(struct heap_task_stats *stats,
+                                   unsigned int max)
+{
+    unsigned int n = 0;
+
+    vTaskSuspendAll();
+    for (unsigned int i = 0; (i < HEAP_TRACE_MAX_TASKS) && (n < max); i++) {
+        if (heap_trace_slots[i].stats.name == NULL) {
+            break;
+        }
+        memcpy(&stats[n], &heap_trace_slots[i].stats, sizeof(*stats));
+        n++;
+    }
+    xTaskResumeAll();
+
+    return n;
+}
+
+unsigned int heap_trace_current_allocs(void)
+{
+    int slot;
+    unsigned int allocs = 0;
+
+    vTaskSuspendAll();
+    slot = heap_trace_lookup();
+    if (slot >= 0) {
+        allocs = heap_trace_slots[slot].stats.allocs;
+    }
+    xTaskResumeAll();
+
+    return allocs;
+}
+
+void heap_trace_reset(void)
+{
+    vTaskSuspendAll();
+    for (unsigned int i = 0; i < HEAP_TRACE_MAX_TASKS; i++) {
+        heap_trace_slots[i].stats.allocs = 0;
+        heap_trace_slots[i].stats.frees = 0;
+        heap_trace_slots[i].stats.failures = 0;
+        heap_trace_slots[i].stats.alloc_bytes = 0;
+        heap_trace_slots[i].stats.free_bytes = 0;
+        // Live bytes are not history; the peak restarts from them
+        heap_trace_slots[i].stats.peak_bytes =
+            heap_trace_slots[i].stats.cur_bytes;
+    }
+    xTaskResumeAll();
+}
+
+unsigned int heap_trace_untracked(void)
+{
+    return heap_trace_untracked_blocks;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
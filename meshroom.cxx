@@ -19,6 +19,7 @@
 #include <task.h>
 #include <semphr.h>
 #include <memory>
+#include <new>
 #include <libmeshtastic.h>
 #include <MeshRoom.hxx>
 #include <MeshRoomShell.hxx>
@@ -29,12 +30,18 @@
 #define WATCHDOG_TASK_PRIORITY         30
 #define LED_TASK_STACK_SIZE            1024
 #define LED_TASK_PRIORITY              25
+#define LED_BLINK_MS                   1000
+#define LED_MESH_RX_MS                 1000
 #define USB_TASK_STACK_SIZE            2048
 #define USB_TASK_PRIORITY              20
 #define MORSEBUZZER_TASK_STACK_SIZE    1024
 #define MORSEBUZZER_TASK_PRIORITY      29
 #define MESHTASTIC_TASK_STACK_SIZE     4096
 #define MESHTASTIC_TASK_PRIORITY       15
+#define COMMAND_TASK_STACK_SIZE        4096
+#define COMMAND_TASK_PRIORITY          15
+#define BUTTON_TASK_STACK_SIZE         1024
+#define BUTTON_TASK_PRIORITY           25
 #define SHELL0_TASK_STACK_SIZE         2048
 #define SHELL0_TASK_PRIORITY           10
 #define SHELL1_TASK_STACK_SIZE         2048
@@ -44,6 +51,54 @@ shared_ptr<MeshRoom> meshroom = NULL;
 static shared_ptr<MeshRoomShell> shell0 = NULL;
 static shared_ptr<MeshRoomShell> shell1 = NULL;
 
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+
+/*
+ * Task stacks and control blocks, the idle/timer service tasks and the
+ * long-lived objects live in .bss so the RAM map produced at link time
+ * is the worst-case footprint.
+ */
+#define TASK_STATIC_STORAGE(name, size)         \
+    static StackType_t name##_stack[size];      \
+    static StaticTask_t name##_tcb
+
+#define TASK_STORAGE(name) name##_stack, &name##_tcb
+
+TASK_STATIC_STORAGE(watchdog, WATCHDOG_TASK_STACK_SIZE);
+TASK_STATIC_STORAGE(led, LED_TASK_STACK_SIZE);
+TASK_STATIC_STORAGE(usb, USB_TASK_STACK_SIZE);
+#if !defined(MESHROOM_MORSE_ALARM)
+TASK_STATIC_STORAGE(morsebuzzer, MORSEBUZZER_TASK_STACK_SIZE);
+#endif
+TASK_STATIC_STORAGE(meshtastic, MESHTASTIC_TASK_STACK_SIZE);
+TASK_STATIC_STORAGE(command, COMMAND_TASK_STACK_SIZE);
+TASK_STATIC_STORAGE(button, BUTTON_TASK_STACK_SIZE);
+TASK_STATIC_STORAGE(shell0, SHELL0_TASK_STACK_SIZE);
+TASK_STATIC_STORAGE(shell1, SHELL1_TASK_STACK_SIZE);
+TASK_STATIC_STORAGE(idle, configMINIMAL_STACK_SIZE);
+TASK_STATIC_STORAGE(timer, configTIMER_TASK_STACK_DEPTH);
+#if (configNUMBER_OF_CORES > 1)
+static StackType_t
+passive_idle_stack[configNUMBER_OF_CORES - 1][configMINIMAL_STACK_SIZE];
+static StaticTask_t passive_idle_tcb[configNUMBER_OF_CORES - 1];
+#endif
+
+alignas(MeshRoom) static uint8_t meshroom_storage[sizeof(MeshRoom)];
+alignas(MeshRoomShell) static uint8_t shell0_storage[sizeof(MeshRoomShell)];
+alignas(MeshRoomShell) static uint8_t shell1_storage[sizeof(MeshRoomShell)];
+
+template <class T>
+static shared_ptr<T> make_static(uint8_t *storage)
+{
+    return shared_ptr<T>(new (storage) T(), [](T *) { });
+}
+
+#else
+
+#define TASK_STORAGE(name) NULL, NULL
+
+#endif
+
 static string banner = "The meshroom firmware for Raspberry Pi Pico";
 static string version = string("Version: ") + string(MYPROJECT_VERSION_STRING);
 static string built = string("Built: ") +
@@ -62,17 +117,44 @@ static void watchdog_task(__unused void *params)
     }
 }
 
+/*
+ * The onboard LED blinks once a second; the alert LED is driven by bus
+ * events: lit while Morse code plays and flashed on mesh traffic.
+ */
 static void led_task(__unused void *params)
 {
+    EventBus &bus = meshroom->events();
+    struct room_event event;
+    TickType_t last, now;
+    int id;
+
+    id = bus.subscribe(xTaskGetCurrentTaskHandle(),
+                       EVENT_MASK(EVENT_MESH_RX) | EVENT_MASK(EVENT_MORSE));
+    last = xTaskGetTickCount();
+    meshroom->flipOnboardLed();
+
     for (;;) {
-        meshroom->flipOnboardLed();
-        if ((meshroom->meshDeviceLastRecivedSecondsAgo() <= 1) ||
-            (meshroom->isMorseEmpty() == false)) {
-            meshroom->setAlertLed(true);
-        } else {
-            meshroom->setAlertLed(false);
+        now = xTaskGetTickCount();
+        if ((now - last) >= pdMS_TO_TICKS(LED_BLINK_MS)) {
+            meshroom->flipOnboardLed();
+            last = now;
+#if !defined(MESHROOM_MORSE_ALARM)
+            // MorseBuzzer does not report the end of playback
+            if (meshroom->isAlertLedOn() && !meshroom->isMorsePlaying()) {
+                meshroom->setAlertLed(false);
+            }
+#endif
+        }
+
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LED_BLINK_MS) - (now - last));
+
+        while (bus.next(id, event)) {
+            if (event.type == EVENT_MORSE) {
+                meshroom->setAlertLed(event.u.morse.playing);
+            } else if (event.type == EVENT_MESH_RX) {
+                meshroom->blinkAlertLed(1, LED_MESH_RX_MS, 0);
+            }
         }
-        vTaskDelay(pdMS_TO_TICKS(1000));
     }
 }
 
@@ -84,45 +166,47 @@ static void usb_task(__unused void *params)
     }
 }
 
+#if !defined(MESHROOM_MORSE_ALARM)
 static void morsebuzzer_task(__unused void *params)
 {
     for (;;) {
         meshroom->runMorseThread();
     }
 }
+#endif
 
 static void meshtastic_task(__unused void *params)
 {
     int ret = 0;
     time_t now, last_want_config, last_heartbeat;
+    TickType_t wait;
+    uint64_t t0;
+    bool busy;
 
     if (meshroom->loadNvm() == false) {
         meshroom->saveNvm();
     }
     meshroom->applyNvmToHomeChat();
+    meshroom->startSerialLink();
 
     now = time(NULL);
     last_heartbeat = now;
     last_want_config = now;
 
-    meshroom->addMorseText("s");
+    meshroom->buzzMorseCode("s");
 
     for (;;) {
         now = time(NULL);
 
         if (meshroom->isConnected() &&
-            (meshroom->meshDeviceLastRecivedSecondsAgo() > 300) &&
+            (meshroom->radioIdleSecs() > 300) &&
             (meshroom->getLastResetSecsAgo() > 300)) {
             consoles_printf("detected meshtastic stuck!\n");
             meshroom->reset();
         }
 
         if (!meshroom->isConnected() && ((now - last_want_config) >= 5)) {
-            ret = meshroom->sendWantConfig();
-            if (ret == false) {
-                consoles_printf("sendWantConfig failed!\n");
-            }
-
+            meshroom->requestWantConfig();
             last_want_config = now;
         } else if (meshroom->isConnected()) {
             last_want_config = now;
@@ -130,33 +214,63 @@ static void meshtastic_task(__unused void *params)
 
         if (meshroom->isConnected() &&
             ((now - last_heartbeat) >= 60)) {
-            ret = meshroom->sendHeartbeat();
-            if (ret == false) {
-                consoles_printf("sendHeartbeat failed!\n");
-            }
-
+            meshroom->requestHeartbeat();
             last_heartbeat = now;
         }
 
+        busy = false;
         for (;;) {
             ret = serial1_rx_ready();
             if (ret == 0) {
                 break;
             } if (ret > 0) {
+                // The worker holds the client while it runs a handler
+                if (meshroom->lockClient(pdMS_TO_TICKS(10)) == false) {
+                    busy = true;
+                    break;
+                }
+                t0 = time_us_64();
                 ret = mt_serial_process(&meshroom->_mtc, 0);
+                meshroom->serialLink().processed(time_us_64() - t0);
+                meshroom->unlockClient();
                 if (ret < 0) {
                     consoles_printf("mt_serial_process failed!\n");
                 }
             }
             taskYIELD();
         }
+        meshroom->pollSerialLink();
+
+        meshroom->processReplies();
 
         ret = serial1_check_markers();
         if (ret != 0) {
             consoles_printf("serial1 markers violated: %d\n", ret);
         }
 
-        xSemaphoreTake(uart1_sem, pdMS_TO_TICKS(1000));
+        wait = meshroom->txNextDeadline();
+        if (wait > pdMS_TO_TICKS(1000)) {
+            wait = pdMS_TO_TICKS(1000);
+        }
+        if (busy && (wait > pdMS_TO_TICKS(10))) {
+            // Frames are still waiting in serial1
+            wait = pdMS_TO_TICKS(10);
+        }
+        xSemaphoreTake(uart1_sem, wait);
+    }
+}
+
+static void command_task(__unused void *params)
+{
+    for (;;) {
+        meshroom->runCommandWorker();
+    }
+}
+
+static void button_task(__unused void *params)
+{
+    for (;;) {
+        meshroom->runButton();
     }
 }
 
@@ -220,6 +334,66 @@ int consoles_vprintf(const char *format, va_list ap)
     return ret;
 }
 
+uint64_t run_time_counter(void)
+{
+    return time_us_64();
+}
+
+static TaskHandle_t task_create(TaskFunction_t func,
+                                const char *name,
+                                uint32_t stack_size,
+                                UBaseType_t priority,
+                                StackType_t *stack,
+                                StaticTask_t *tcb)
+{
+    TaskHandle_t handle = NULL;
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    handle = xTaskCreateStatic(func, name, stack_size, NULL, priority,
+                               stack, tcb);
+#else
+    (void)(stack);
+    (void)(tcb);
+    xTaskCreate(func, name, stack_size, NULL, priority, &handle);
+#endif
+
+    return handle;
+}
+
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+
+void vApplicationGetIdleTaskMemory(StaticTask_t **ppxIdleTaskTCBBuffer,
+                                   StackType_t **ppxIdleTaskStackBuffer,
+                                   configSTACK_DEPTH_TYPE *puxIdleTaskStackSize)
+{
+    *ppxIdleTaskTCBBuffer = &idle_tcb;
+    *ppxIdleTaskStackBuffer = idle_stack;
+    *puxIdleTaskStackSize = configMINIMAL_STACK_SIZE;
+}
+
+#if (configNUMBER_OF_CORES > 1)
+void vApplicationGetPassiveIdleTaskMemory(StaticTask_t **ppxIdleTaskTCBBuffer,
+                                          StackType_t **ppxIdleTaskStackBuffer,
+                                          configSTACK_DEPTH_TYPE *puxIdleTaskStackSize,
+                                          BaseType_t xPassiveIdleTaskIndex)
+{
+    *ppxIdleTaskTCBBuffer = &passive_idle_tcb[xPassiveIdleTaskIndex];
+    *ppxIdleTaskStackBuffer = passive_idle_stack[xPassiveIdleTaskIndex];
+    *puxIdleTaskStackSize = configMINIMAL_STACK_SIZE;
+}
+#endif
+
+void vApplicationGetTimerTaskMemory(StaticTask_t **ppxTimerTaskTCBBuffer,
+                                    StackType_t **ppxTimerTaskStackBuffer,
+                                    configSTACK_DEPTH_TYPE *puxTimerTaskStackSize)
+{
+    *ppxTimerTaskTCBBuffer = &timer_tcb;
+    *ppxTimerTaskStackBuffer = timer_stack;
+    *puxTimerTaskStackSize = configTIMER_TASK_STACK_DEPTH;
+}
+
+#endif
+
 void vApplicationStackOverflowHook(TaskHandle_t xTask, char *pcTaskName)
 {
     (void)(xTask);
@@ -239,8 +413,12 @@ int main(void)
     TaskHandle_t watchdogTask;
     TaskHandle_t ledTask;
     TaskHandle_t usbTask;
+#if !defined(MESHROOM_MORSE_ALARM)
     TaskHandle_t morsebuzzerTask;
+#endif
     TaskHandle_t meshtasticTask;
+    TaskHandle_t commandTask;
+    TaskHandle_t buttonTask;
     TaskHandle_t shell0Task;
     TaskHandle_t shell1Task;
 
@@ -254,7 +432,11 @@ int main(void)
     serial_init();
     cyw43_arch_init();
 
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    meshroom = make_static<MeshRoom>(meshroom_storage);
+#else
     meshroom = make_shared<MeshRoom>();
+#endif
     meshroom->setBanner(banner);
     meshroom->setVersion(version);
     meshroom->setBuilt(built);
@@ -263,71 +445,98 @@ int main(void)
     meshroom->setNvm(meshroom);
     meshroom->sendDisconnect();
 
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    shell0 = make_static<MeshRoomShell>(shell0_storage);
+#else
     shell0 = make_shared<MeshRoomShell>();
+#endif
     shell0->setClient(meshroom);
     shell0->setNvm(meshroom);
     shell0->attach((void *) 1);
 
+#if (configSUPPORT_STATIC_ALLOCATION == 1)
+    shell1 = make_static<MeshRoomShell>(shell1_storage);
+#else
     shell1 = make_shared<MeshRoomShell>();
+#endif
     shell1->setClient(meshroom);
     shell1->setNvm(meshroom);
     shell1->attach((void *) 2);
 
-    xTaskCreate(watchdog_task,
-                "Watchdog",
-                WATCHDOG_TASK_STACK_SIZE,
-                NULL,
-                WATCHDOG_TASK_PRIORITY,
-                &watchdogTask);
-
-    xTaskCreate(led_task,
-                "Led",
-                LED_TASK_STACK_SIZE,
-                NULL,
-                LED_TASK_PRIORITY,
-                &ledTask);
-
-    xTaskCreate(usb_task,
-                "USB",
-                USB_TASK_STACK_SIZE,
-                NULL,
-                USB_TASK_PRIORITY,
-                &usbTask);
-
-    xTaskCreate(morsebuzzer_task,
-                "MorseBuzzer",
-                MORSEBUZZER_TASK_STACK_SIZE,
-                NULL,
-                MORSEBUZZER_TASK_PRIORITY,
-                &morsebuzzerTask);
-
-    xTaskCreate(meshtastic_task,
-                "Meshtastic",
-                MESHTASTIC_TASK_STACK_SIZE,
-                NULL,
-                MESHTASTIC_TASK_PRIORITY,
-                &meshtasticTask);
-
-    xTaskCreate(shell0_task,
-                "Shell0",
-                SHELL0_TASK_STACK_SIZE,
-                NULL,
-                SHELL0_TASK_PRIORITY,
-                &shell0Task);
-
-    xTaskCreate(shell1_task,
-                "Shell1",
-                SHELL1_TASK_STACK_SIZE,
-                NULL,
-                SHELL1_TASK_PRIORITY,
-                &shell1Task);
+    watchdogTask = task_create(watchdog_task,
+                               "Watchdog",
+                               WATCHDOG_TASK_STACK_SIZE,
+                               WATCHDOG_TASK_PRIORITY,
+                               TASK_STORAGE(watchdog));
+
+    ledTask = task_create(led_task,
+                          "Led",
+                          LED_TASK_STACK_SIZE,
+                          LED_TASK_PRIORITY,
+                          TASK_STORAGE(led));
+
+    usbTask = task_create(usb_task,
+                          "USB",
+                          USB_TASK_STACK_SIZE,
+                          USB_TASK_PRIORITY,
+                          TASK_STORAGE(usb));
+
+#if !defined(MESHROOM_MORSE_ALARM)
+    morsebuzzerTask = task_create(morsebuzzer_task,
+                                  "MorseBuzzer",
+                                  MORSEBUZZER_TASK_STACK_SIZE,
+                                  MORSEBUZZER_TASK_PRIORITY,
+                                  TASK_STORAGE(morsebuzzer));
+#endif
 
+    meshtasticTask = task_create(meshtastic_task,
+                                 "Meshtastic",
+                                 MESHTASTIC_TASK_STACK_SIZE,
+                                 MESHTASTIC_TASK_PRIORITY,
+                                 TASK_STORAGE(meshtastic));
+
+    commandTask = task_create(command_task,
+                              "Command",
+                              COMMAND_TASK_STACK_SIZE,
+                              COMMAND_TASK_PRIORITY,
+                              TASK_STORAGE(command));
+    meshroom->setCommandWorker(commandTask);
+
+    buttonTask = task_create(button_task,
+                             "Button",
+                             BUTTON_TASK_STACK_SIZE,
+                             BUTTON_TASK_PRIORITY,
+                             TASK_STORAGE(button));
+    meshroom->setButtonTask(buttonTask);
+
+    shell0Task = task_create(shell0_task,
+                             "Shell0",
+                             SHELL0_TASK_STACK_SIZE,
+                             SHELL0_TASK_PRIORITY,
+                             TASK_STORAGE(shell0));
+
+    shell1Task = task_create(shell1_task,
+                             "Shell1",
+                             SHELL1_TASK_STACK_SIZE,
+                             SHELL1_TASK_PRIORITY,
+                             TASK_STORAGE(shell1));
+
+    /*
+     * Default affinity map: the decode stage (Meshtastic) and the shells
+     * on core 1, the application stage (Command) and the housekeeping
+     * tasks on core 0. The map can be changed at run time from the shell
+     * with the "affinity" command, guided by "cpu".
+     */
 #if defined(configUSE_CORE_AFFINITY) && (configNUMBER_OF_CORES > 1)
     vTaskCoreAffinitySet(watchdogTask, 0x1);
     vTaskCoreAffinitySet(ledTask, 0x1);
     vTaskCoreAffinitySet(usbTask, 0x1);
+#if !defined(MESHROOM_MORSE_ALARM)
     vTaskCoreAffinitySet(morsebuzzerTask, 0x1);
+#endif
     vTaskCoreAffinitySet(meshtasticTask, 0x2);
+    vTaskCoreAffinitySet(commandTask, 0x1);
+    vTaskCoreAffinitySet(buttonTask, 0x1);
     vTaskCoreAffinitySet(shell0Task, 0x2);
     vTaskCoreAffinitySet(shell1Task, 0x2);
 #endif
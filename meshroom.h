@@ -37,6 +37,42 @@ extern int shell2_process(void);
 extern int consoles_printf(const char *format, ...);
 extern int consoles_vprintf(const char *format, va_list ap);
 
+#define HEAP_TRACE_MAX_TASKS 16
+#define HEAP_TRACE_MAX_ALLOCS 512       // Live blocks; power of two
+
+struct heap_task_stats {
+    const char *name;
+    unsigned int allocs;
+    unsigned int frees;                 // Of its blocks, by any task
+    unsigned int failures;
+    size_t alloc_bytes;
+    size_t free_bytes;
+    size_t cur_bytes;                   // Live blocks it allocated
+    size_t peak_bytes;
+};
+
+extern unsigned int heap_trace_task_stats(struct heap_task_stats *stats,
+                                          unsigned int max);
+extern void heap_trace_reset(void);
+extern unsigned int heap_trace_untracked(void);
+extern unsigned int heap_trace_current_allocs(void);
+
+struct task_info {
+    const char *name;
+    unsigned int number;
+    char state;                         // X, R, B, S or D
+    unsigned int base_priority;
+    unsigned int priority;              // Including inheritance
+    unsigned long affinity;
+    size_t stack_free;                  // High-water, in bytes
+    uint64_t runtime;                   // us
+    uint64_t total_runtime;
+};
+
+typedef void (*task_info_fn)(const struct task_info *info, void *arg);
+
+extern int task_info_foreach(task_info_fn fn, void *arg);
+
 EXTERN_C_END
 
 #endif
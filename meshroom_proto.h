@@ -0,0 +1,153 @@
+/*
+ * meshroom_proto.h
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#ifndef MESHROOM_PROTO_H
+#define MESHROOM_PROTO_H
+
+#include <stdint.h>
+
+/*
+ * Binary request/response protocol carried on the Meshtastic private
+ * application port, for scripts that would otherwise drive the text chat
+ * interface. All multi-byte fields are little-endian and every struct is
+ * packed.
+ *
+ * A request is a struct mr_hdr followed by the op-specific body. Every
+ * request is answered with a struct mr_rsp: MR_OP_ENV carries a struct
+ * mr_env, MR_OP_LINK a struct mr_link, every other op the complete room
+ * state in a struct mr_state (after the change has been applied).
+ * Requests from senders that are not admins or mates are ignored;
+ * MR_OP_RESET requires an admin. When enabled from the shell, MR_OP_LINK
+ * responses with seq 0 are also broadcast periodically.
+ */
+
+#define MESHROOM_PROTO_PORT     256     /* meshtastic_PortNum_PRIVATE_APP */
+#define MESHROOM_PROTO_VERSION  1
+
+#define MR_OP_STATUS    0x01
+#define MR_OP_ENV       0x02
+#define MR_OP_LINK      0x03
+#define MR_OP_TV        0x10
+#define MR_OP_AC        0x11
+#define MR_OP_BUZZ      0x20
+#define MR_OP_RESET     0x21
+#define MR_OP_RESPONSE  0x80    /* or'ed into op of the response */
+
+#define MR_OK           0
+#define MR_ERR_VERSION  1
+#define MR_ERR_OP       2
+#define MR_ERR_LENGTH   3
+#define MR_ERR_DENIED   4
+#define MR_ERR_VALUE    5
+
+struct mr_hdr {
+    uint8_t version;
+    uint8_t op;
+    uint8_t seq;        /* echoed in the response */
+} __attribute__((packed));
+
+/* MR_OP_TV: only the fields flagged in set are applied */
+struct mr_tv_req {
+    uint8_t set;
+#define MR_TV_SET_POWER     0x01
+#define MR_TV_SET_VOL       0x02
+#define MR_TV_SET_CHAN      0x04
+    uint8_t power;
+    uint8_t vol;
+    uint16_t chan;
+} __attribute__((packed));
+
+/* MR_OP_AC: only the fields flagged in set are applied */
+struct mr_ac_req {
+    uint8_t set;
+#define MR_AC_SET_POWER     0x01
+#define MR_AC_SET_MODE      0x02
+#define MR_AC_SET_TEMP      0x04
+#define MR_AC_SET_FANSPEED  0x08
+#define MR_AC_SET_FANDIR    0x10
+    uint8_t power;
+    uint8_t mode;       /* 0: ac, 1: heater, 2: dehumidifier, 3: auto */
+    uint8_t temp;
+    uint8_t fanspeed;
+    uint8_t fandir;
+} __attribute__((packed));
+
+/* MR_OP_BUZZ */
+struct mr_buzz_req {
+    uint16_t ms;
+} __attribute__((packed));
+
+struct mr_state {
+    uint8_t flags;
+#define MR_STATE_TV_POWER   0x01
+#define MR_STATE_AC_POWER   0x02
+#define MR_STATE_ALERT_LED  0x04
+#define MR_STATE_MORSE      0x08
+    uint8_t tv_vol;
+    uint16_t tv_chan;
+    uint8_t ac_mode;
+    uint8_t ac_temp;
+    uint8_t ac_fanspeed;
+    uint8_t ac_fandir;
+    uint8_t ir_pending;
+    int16_t board_temp;         /* 0.1 C */
+    uint16_t reset_count;
+    uint32_t last_reset_secs;   /* seconds ago */
+    uint32_t uptime_secs;
+} __attribute__((packed));
+
+struct mr_env {
+    uint8_t flags;
+#define MR_ENV_TEMPERATURE  0x01
+#define MR_ENV_HUMIDITY     0x02
+#define MR_ENV_PRESSURE     0x04
+    int16_t temperature;        /* 0.1 C */
+    uint16_t humidity;          /* 0.1 % */
+    uint16_t pressure;          /* 0.1 hPa */
+    uint32_t age_secs;
+} __attribute__((packed));
+
+struct mr_link_uart {
+    uint32_t baud;
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    uint32_t rx_frames;
+    uint32_t tx_frames;
+    uint32_t rx_bps;
+    uint32_t tx_bps;
+    uint16_t line_errors;       /* framing, parity and break */
+    uint16_t overruns;
+    uint16_t tx_dropped;
+    uint16_t ring_max;
+} __attribute__((packed));
+
+struct mr_link {
+    struct mr_link_uart uart[2];        /* serial0, serial1 */
+    uint32_t process_us_avg;            /* mt_serial_process() */
+    uint32_t process_us_max;
+} __attribute__((packed));
+
+struct mr_rsp {
+    struct mr_hdr hdr;
+    uint8_t status;
+    union {
+        struct mr_state state;
+        struct mr_env env;
+        struct mr_link link;
+    } u;
+} __attribute__((packed));
+
+#endif
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
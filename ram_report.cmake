@@ -0,0 +1,58 @@
+# ram_report.cmake
+#
+# Copyright (C) 2025, Charles Chiou
+#
+# Writes a RAM map of the statically allocated (.data/.bss) symbols of an
+# ELF file, largest first, with per-section totals.
+#
+# Usage: cmake -DNM=<nm> -DELF=<elf> -DOUT=<report> -P ram_report.cmake
+
+execute_process(
+  COMMAND ${NM} --print-size --size-sort --reverse-sort --radix=d ${ELF}
+  OUTPUT_VARIABLE NM_OUTPUT
+  RESULT_VARIABLE NM_RESULT
+  )
+if (NOT NM_RESULT EQUAL 0)
+  message(FATAL_ERROR "${NM} failed on ${ELF}")
+endif()
+
+string(REPLACE "\n" ";" NM_LINES "${NM_OUTPUT}")
+
+set(DATA_TOTAL 0)
+set(BSS_TOTAL 0)
+set(SYMBOLS "")
+foreach(LINE ${NM_LINES})
+  if (LINE MATCHES "^[0-9]+ ([0-9]+) ([bBdD]) (.+)$")
+    math(EXPR SIZE "${CMAKE_MATCH_1}")
+    set(TYPE ${CMAKE_MATCH_2})
+    set(NAME ${CMAKE_MATCH_3})
+    if (TYPE MATCHES "[dD]")
+      math(EXPR DATA_TOTAL "${DATA_TOTAL} + ${SIZE}")
+      set(SECTION ".data")
+    else()
+      math(EXPR BSS_TOTAL "${BSS_TOTAL} + ${SIZE}")
+      set(SECTION ".bss ")
+    endif()
+    string(LENGTH "${SIZE}" SIZE_LEN)
+    set(SPACES "")
+    if (SIZE_LEN LESS 10)
+      math(EXPR PAD "10 - ${SIZE_LEN}")
+      string(SUBSTRING "          " 0 ${PAD} SPACES)
+    endif()
+    string(APPEND SYMBOLS "${SPACES}${SIZE}  ${SECTION}  ${NAME}\n")
+  endif()
+endforeach()
+
+math(EXPR TOTAL "${DATA_TOTAL} + ${BSS_TOTAL}")
+
+file(WRITE ${OUT}
+  "RAM map of ${ELF}\n"
+  "\n"
+  "  .data: ${DATA_TOTAL} bytes\n"
+  "  .bss:  ${BSS_TOTAL} bytes\n"
+  "  total: ${TOTAL} bytes\n"
+  "\n"
+  "      size  section symbol\n"
+  "${SYMBOLS}")
+
+message(STATUS "RAM map: ${TOTAL} bytes static (.data ${DATA_TOTAL}, .bss ${BSS_TOTAL}) -> ${OUT}")
@@ -0,0 +1,100 @@
+/*
+ * tasks.cxx
+ *
+ * Copyright (C) 2025, Charles Chiou
+ */
+
+#include <FreeRTOS.h>
+#include <task.h>
+#include <meshroom.h>
+
+#define TASK_INFO_SLACK    4
+#define TASK_INFO_RETRIES  3
+
+static char task_state_char(eTaskState state)
+{
+    char c = '?';
+
+    switch (state) {
+    case eRunning:
+        c = 'X';
+        break;
+    case eReady:
+        c = 'R';
+        break;
+    case eBlocked:
+        c = 'B';
+        break;
+    case eSuspended:
+        c = 'S';
+        break;
+    case eDeleted:
+        c = 'D';
+        break;
+    default:
+        break;
+    }
+
+    return c;
+}
+
+/*
+ * The snapshot lives on the heap only for the duration of the walk, so
+ * the caller's stack use doesn't depend on the number of tasks. A few
+ * spare entries absorb tasks created between counting and sampling;
+ * uxTaskGetSystemState() returns 0 if they were not enough.
+ */
+int task_info_foreach(task_info_fn fn, void *arg)
+{
+    int ret = 0;
+    TaskStatus_t *tasks = NULL;
+    UBaseType_t max, n = 0;
+    configRUN_TIME_COUNTER_TYPE total = 0;
+    struct task_info info;
+
+    for (unsigned int i = 0; (n == 0) && (i < TASK_INFO_RETRIES); i++) {
+        vPortFree(tasks);
+        max = uxTaskGetNumberOfTasks() + TASK_INFO_SLACK;
+        tasks = (TaskStatus_t *) pvPortMalloc(max * sizeof(TaskStatus_t));
+        if (tasks == NULL) {
+            ret = -1;
+            goto done;
+        }
+        n = uxTaskGetSystemState(tasks, max, &total);
+    }
+
+    for (UBaseType_t i = 0; i < n; i++) {
+        info.name = tasks[i].pcTaskName;
+        info.number = tasks[i].xTaskNumber;
+        info.state = task_state_char(tasks[i].eCurrentState);
+        info.base_priority = tasks[i].uxBasePriority;
+        info.priority = tasks[i].uxCurrentPriority;
+#if defined(configUSE_CORE_AFFINITY) && (configNUMBER_OF_CORES > 1)
+        info.affinity = tasks[i].uxCoreAffinityMask;
+#else
+        info.affinity = 1;
+#endif
+        info.stack_free = tasks[i].usStackHighWaterMark * sizeof(StackType_t);
+        info.runtime = tasks[i].ulRunTimeCounter;
+        info.total_runtime = total;
+        fn(&info, arg);
+    }
+
+    ret = n;
+
+done:
+
+    vPortFree(tasks);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * mode: C++
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */